@@ -0,0 +1,358 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+
+#define INPUT_TABLE_SIZE 48000
+#define STITCH_WINDOW    4096  // Default search window, clamped by the plugin to the longest tail
+
+typedef enum {
+	STATE_IDLE,
+	STATE_WAITING_FOR_BAR,
+	STATE_RECORDING,
+	STATE_RECORDING_TAIL,
+	STATE_CROSSFADE,
+	STATE_PLAYING,
+	N_STATES
+} BenchState;
+
+static const char* const state_names[N_STATES] = {
+	"idle",
+	"waiting_for_bar",
+	"recording",
+	"recording_tail",
+	"crossfade",
+	"playing"
+};
+
+typedef struct {
+	uint64_t blocks;
+	uint64_t samples;
+	uint64_t total_ns;
+	uint64_t worst_ns;
+} BenchStats;
+
+typedef struct {
+	RemusHost  host;
+	float      input[INPUT_TABLE_SIZE];
+	uint32_t   input_pos;
+	uint32_t   block_size;
+	uint32_t   loop_frames;
+	uint64_t   record_frames;
+	bool       stitched;      // The take ended in the last block
+	double     record_bpm;
+	double     play_bpm;
+	bool       counting;
+	BenchStats stats[N_STATES];
+} Bench;
+
+/* Deterministic test signal: two partials plus a little noise */
+static void
+fill_input_table(float* table, double sample_rate)
+{
+	uint32_t seed = 0x12345678u;
+
+	for (uint32_t i = 0; i < INPUT_TABLE_SIZE; i++) {
+		const double t = (double)i / sample_rate;
+		seed = seed * 1664525u + 1013904223u;
+		const float noise = ((float)(seed >> 8) / 16777216.0f - 0.5f) * 0.02f;
+		table[i] = (float)(0.5 * sin(2.0 * M_PI * 220.0 * t) +
+		                   0.25 * sin(2.0 * M_PI * 331.0 * t)) + noise;
+	}
+}
+
+static bool
+output_is_silent(const float* out, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		if (out[i] != 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Run one block and account its time to the state it started in: a take
+ * that fills the loop or ends its tail within the block still counts as
+ * recording it, the first block after the take plays the crossfade.
+ */
+static void
+run_block(Bench* bench)
+{
+	RemusHost*     host = &bench->host;
+	const uint32_t n    = bench->block_size;
+
+	// Channels get the test signal at different offsets
+	for (uint32_t i = 0; i < n; i++) {
+		for (uint32_t c = 0; c < host->n_channels; c++) {
+			host->audio_in[c][i] = bench->input[(bench->input_pos + c * 1000) % INPUT_TABLE_SIZE];
+		}
+		if (++bench->input_pos >= INPUT_TABLE_SIZE) {
+			bench->input_pos = 0;
+		}
+	}
+
+	const bool     was_recording = host->recording > 0.5f;
+	const bool     was_armed     = host->armed > 0.5f;
+	const bool     stitched      = bench->stitched;
+	const uint64_t frame         = host->frame;
+
+	remus_host_run(host, n);
+	const uint64_t elapsed = host->run_ns;
+
+	// The stitched loop was swapped in by the worker response of the last block
+	bench->stitched = was_recording && host->recording < 0.5f;
+
+	BenchState state;
+	if (stitched && host->recorded > 0.5f) {
+		state = STATE_CROSSFADE;
+	} else if (was_recording) {
+		state = (bench->record_frames < bench->loop_frames)
+			? STATE_RECORDING : STATE_RECORDING_TAIL;
+		bench->record_frames += n;
+	} else if (was_armed) {
+		state = STATE_WAITING_FOR_BAR;
+		if (host->recording > 0.5f) {
+			// The take started at the bar start within the block
+			const double   frames_per_bar = host->beats_per_bar * 60.0 * host->sample_rate / host->bpm;
+			const uint64_t bar = (uint64_t)ceil((double)frame / frames_per_bar) * (uint64_t)frames_per_bar;
+			bench->record_frames = frame + n - bar;
+		}
+	} else if (host->recorded > 0.5f && host->rolling &&
+	           !output_is_silent(host->audio_out[0], n)) {
+		state = STATE_PLAYING;
+	} else {
+		state = STATE_IDLE;
+	}
+
+	if (host->recording < 0.5f) {
+		bench->record_frames = 0;
+	}
+
+	if (bench->counting) {
+		BenchStats* stats = &bench->stats[state];
+		stats->blocks++;
+		stats->samples += n;
+		stats->total_ns += elapsed;
+		if (elapsed > stats->worst_ns) {
+			stats->worst_ns = elapsed;
+		}
+	}
+}
+
+static void
+run_frames(Bench* bench, uint64_t frames)
+{
+	for (uint64_t done = 0; done < frames; done += bench->block_size) {
+		run_block(bench);
+	}
+}
+
+/*
+ * One record cycle: idle with transport stopped, arm in the middle of a bar,
+ * record the loop and its tail, then play it back for two loop lengths, at
+ * the playback tempo.
+ */
+static void
+run_cycle(Bench* bench)
+{
+	RemusHost*     host           = &bench->host;
+
+	host->bpm = bench->record_bpm;
+	const uint64_t frames_per_bar = (uint64_t)(
+		host->beats_per_bar * 60.0 * host->sample_rate / host->bpm);
+
+	host->rolling = false;
+	run_frames(bench, frames_per_bar / 2);
+
+	host->rolling = true;
+	run_frames(bench, frames_per_bar / 2);
+
+	// Arm: record is triggered on the falling edge of record_enable, in the
+	// next block, before the old loop stops counting as recorded
+	host->record_enable = 1.0f;
+	run_block(bench);
+	host->record_enable = 0.0f;
+	run_block(bench);
+
+	// Wait until the take is finished and stitched
+	const uint64_t limit = frames_per_bar * (uint64_t)(host->loop_length + 3.0f);
+	uint64_t       done  = 0;
+	while ((host->armed > 0.5f || host->recording > 0.5f || host->recorded < 0.5f)
+	       && done < limit) {
+		run_block(bench);
+		done += bench->block_size;
+	}
+
+	host->bpm = bench->play_bpm;
+	run_frames(bench, 2 * (uint64_t)bench->loop_frames + frames_per_bar);
+}
+
+static int
+bench_block_size(Bench* bench, uint32_t block_size, uint32_t cycles,
+                 double sample_rate, uint32_t n_channels, float loop_length,
+                 float stitch_search, bool long_loop, float storage, float follow, double play_bpm,
+                 bool freewheel)
+{
+	if (remus_host_init(&bench->host, sample_rate, n_channels)) {
+		fprintf(stderr, "error: failed to instantiate plugin\n");
+		return 1;
+	}
+
+	RemusHost* host = &bench->host;
+	host->loop_length = loop_length;
+	host->stitch_search = stitch_search;
+	host->long_loop = long_loop ? 1.0f : 0.0f;
+	host->storage = storage;
+	host->follow = follow;
+	host->freewheel = freewheel ? 1.0f : 0.0f;
+
+	bench->block_size = block_size;
+	bench->record_bpm = host->bpm;
+	bench->play_bpm = (play_bpm > 0.0) ? play_bpm : host->bpm;
+	bench->input_pos = 0;
+	bench->record_frames = 0;
+	bench->stitched = false;
+	bench->loop_frames = (uint32_t)(
+		((uint32_t)(host->beats_per_bar * loop_length) * 60.0 * sample_rate) / host->bpm);
+	memset(bench->stats, 0, sizeof(bench->stats));
+
+	// Warm-up cycle is not counted
+	bench->counting = false;
+	run_cycle(bench);
+
+	bench->counting = true;
+	for (uint32_t c = 0; c < cycles; c++) {
+		run_cycle(bench);
+	}
+
+	remus_host_free(host);
+
+	const double block_ns = (double)block_size / sample_rate * 1e9;
+	for (int s = 0; s < N_STATES; s++) {
+		const BenchStats* stats = &bench->stats[s];
+		if (!stats->blocks) {
+			printf("%5u  %-16s %8s\n", block_size, state_names[s], "-");
+			continue;
+		}
+		printf("%5u  %-16s %8llu %11.2f %11.2f %10.2f\n",
+		       block_size, state_names[s],
+		       (unsigned long long)stats->blocks,
+		       (double)stats->total_ns / (double)stats->samples,
+		       (double)stats->worst_ns / 1000.0,
+		       (double)stats->worst_ns / block_ns * 100.0);
+	}
+	return 0;
+}
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr,
+	        "Usage: %s [-b BLOCK] [-c CYCLES] [-d] [-f QUALITY] [-l BARS] [-n CHANNELS] [-p BITS] [-r RATE]\n"
+	        "          [-s SAMPLES] [-t BPM] [-w]\n"
+	        "  -b BLOCK   only benchmark this block size (16..4096)\n"
+	        "  -c CYCLES  number of measured record cycles (default 4)\n"
+	        "  -d         long loops, recorded on disk\n"
+	        "  -f QUALITY follow the tempo: 1 fast, 2 good, 3 best resampling\n"
+	        "  -l BARS    loop length in bars (default 1)\n"
+	        "  -n CHANNELS plugin variant: 1, 2 or 4 channels (default 1)\n"
+	        "  -p BITS    pack idle loops to 24 or 16-bit samples\n"
+	        "  -r RATE    sample rate in Hz (default 48000)\n"
+	        "  -s SAMPLES correlation stitch search window (default %u, the longest tail;\n"
+	        "             0 for zero-crossings)\n"
+	        "  -t BPM     play loops back at this tempo (default 120)\n"
+	        "  -w         freewheel, like a host rendering offline\n",
+	        name, STITCH_WINDOW);
+}
+
+int
+main(int argc, char** argv)
+{
+	uint32_t only_block  = 0;
+	uint32_t cycles      = 4;
+	float    loop_length = 1.0f;
+	uint32_t n_channels  = 1;
+	double   sample_rate = 48000.0;
+	float    stitch_search = STITCH_WINDOW;
+	bool     long_loop   = false;
+	float    storage     = 0.0f;
+	float    follow      = 0.0f;
+	double   play_bpm    = 0.0;
+	bool     freewheel   = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:c:df:l:n:p:r:s:t:wh")) != -1) {
+		switch (opt) {
+		case 'b':
+			only_block = (uint32_t)atoi(optarg);
+			break;
+		case 'c':
+			cycles = (uint32_t)atoi(optarg);
+			break;
+		case 'd':
+			long_loop = true;
+			break;
+		case 'f':
+			follow = (float)atoi(optarg);
+			break;
+		case 'l':
+			loop_length = (float)atof(optarg);
+			break;
+		case 'n':
+			n_channels = (uint32_t)atoi(optarg);
+			break;
+		case 'p':
+			storage = (atoi(optarg) == 16) ? 2.0f : (atoi(optarg) == 24) ? 1.0f : 0.0f;
+			break;
+		case 'r':
+			sample_rate = atof(optarg);
+			break;
+		case 's':
+			stitch_search = (float)atof(optarg);
+			break;
+		case 't':
+			play_bpm = atof(optarg);
+			break;
+		case 'w':
+			freewheel = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (only_block && (only_block < 16 || only_block > HOST_MAX_BLOCK)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	Bench* bench = (Bench*)calloc(1, sizeof(Bench));
+	if (!bench) {
+		return 1;
+	}
+	fill_input_table(bench->input, sample_rate);
+
+	printf("Remus offline benchmark: %u channel(s), %.0f Hz, 120 BPM, 4/4, %.0f-bar loop, %u cycles\n\n",
+	       n_channels, sample_rate, loop_length, cycles);
+	printf("block  state              blocks   ns/sample   worst(us)  budget(%%)\n");
+
+	int ret = 0;
+	for (uint32_t block_size = 16; block_size <= HOST_MAX_BLOCK; block_size *= 2) {
+		if (only_block && block_size != only_block) {
+			continue;
+		}
+		if ((ret = bench_block_size(bench, block_size, cycles, sample_rate,
+		                            n_channels, loop_length, stitch_search, long_loop, storage,
+		                            follow, play_bpm, freewheel))) {
+			break;
+		}
+	}
+
+	free(bench);
+	return ret;
+}
@@ -0,0 +1,313 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "lv2/buf-size/buf-size.h"
+#include "lv2/time/time.h"
+#include "lv2/urid/urid.h"
+
+#define REMUS_HOST_URI "http://github.com/lbovet/remus"
+
+static LV2_URID
+map_uri(LV2_URID_Map_Handle handle, const char* uri)
+{
+	RemusHost* host = (RemusHost*)handle;
+
+	for (uint32_t i = 0; i < host->n_uris; i++) {
+		if (!strcmp(host->uris[i], uri)) {
+			return i + 1;
+		}
+	}
+
+	if (host->n_uris >= HOST_MAX_URIS) {
+		return 0;
+	}
+
+	host->uris[host->n_uris] = strdup(uri);
+	return ++host->n_uris;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static LV2_Worker_Status
+queue_push(HostQueue* queue, uint32_t size, const void* data)
+{
+	if (queue->n_messages >= HOST_MAX_MESSAGES || size > HOST_MESSAGE_SIZE) {
+		return LV2_WORKER_ERR_NO_SPACE;
+	}
+
+	HostMessage* message = &queue->messages[queue->n_messages++];
+	message->size = size;
+	memcpy(message->data, data, size);
+	return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+schedule_work(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+	RemusHost* host = (RemusHost*)handle;
+	return queue_push(&host->jobs, size, data);
+}
+
+static LV2_Worker_Status
+respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+	RemusHost* host = (RemusHost*)handle;
+	return queue_push(&host->responses, size, data);
+}
+
+/* Run pending jobs as the worker thread, then deliver their responses */
+static void
+run_worker(RemusHost* host)
+{
+	if (!host->worker) {
+		return;
+	}
+
+	// Jobs scheduled from work_response() wait for the next block
+	HostQueue jobs = host->jobs;
+	host->jobs.n_messages = 0;
+	for (uint32_t i = 0; i < jobs.n_messages; i++) {
+		host->worker->work(host->instance, respond, host,
+		                   jobs.messages[i].size, jobs.messages[i].data);
+	}
+
+	const uint64_t start = now_ns();
+	for (uint32_t i = 0; i < host->responses.n_messages; i++) {
+		host->worker->work_response(host->instance,
+		                            host->responses.messages[i].size,
+		                            host->responses.messages[i].data);
+	}
+	host->responses.n_messages = 0;
+	if (host->worker->end_run) {
+		host->worker->end_run(host->instance);
+	}
+	host->run_ns += now_ns() - start;
+}
+
+/* Plugin URI of the variant with n_channels, NULL if there is none */
+static const char*
+plugin_uri(uint32_t n_channels)
+{
+	switch (n_channels) {
+	case 1:
+		return REMUS_HOST_URI;
+	case 2:
+		return REMUS_HOST_URI "#stereo";
+	case 4:
+		return REMUS_HOST_URI "#quad";
+	default:
+		return NULL;
+	}
+}
+
+int
+remus_host_init(RemusHost* host, double sample_rate, uint32_t n_channels)
+{
+	memset(host, 0, sizeof(RemusHost));
+
+	host->map.handle = host;
+	host->map.map = map_uri;
+	host->map_feature.URI = LV2_URID__map;
+	host->map_feature.data = &host->map;
+	host->schedule.handle = host;
+	host->schedule.schedule_work = schedule_work;
+	host->schedule_feature.URI = LV2_WORKER__schedule;
+	host->schedule_feature.data = &host->schedule;
+	host->max_block = HOST_MAX_BLOCK;
+	host->options[0] = (LV2_Options_Option){
+		LV2_OPTIONS_INSTANCE, 0, map_uri(host, LV2_BUF_SIZE__maxBlockLength),
+		sizeof(int32_t), map_uri(host, LV2_ATOM__Int), &host->max_block
+	};
+	host->options_feature.URI = LV2_OPTIONS__options;
+	host->options_feature.data = host->options;
+	host->features[0] = &host->map_feature;
+	host->features[1] = &host->schedule_feature;
+	host->features[2] = &host->options_feature;
+	host->features[3] = NULL;
+
+	lv2_atom_forge_init(&host->forge, &host->map);
+	host->time_Position = map_uri(host, LV2_TIME__Position);
+	host->time_frame = map_uri(host, LV2_TIME__frame);
+	host->time_speed = map_uri(host, LV2_TIME__speed);
+	host->time_bar = map_uri(host, LV2_TIME__bar);
+	host->time_barBeat = map_uri(host, LV2_TIME__barBeat);
+	host->time_beatUnit = map_uri(host, LV2_TIME__beatUnit);
+	host->time_beatsPerBar = map_uri(host, LV2_TIME__beatsPerBar);
+	host->time_beatsPerMinute = map_uri(host, LV2_TIME__beatsPerMinute);
+	host->remus_Command = map_uri(host, REMUS_HOST_URI "#Command");
+	host->remus_action = map_uri(host, REMUS_HOST_URI "#action");
+	host->remus_slot = map_uri(host, REMUS_HOST_URI "#slot");
+	host->remus_select = map_uri(host, REMUS_HOST_URI "#select");
+
+	host->sample_rate = sample_rate;
+	host->bpm = 120.0;
+	host->beats_per_bar = 4.0;
+	host->loop_length = 4.0f;
+	host->persist_enable = 0.0f;
+	host->stitch_search = 0.0f;
+
+	const char* uri = plugin_uri(n_channels);
+	if (!uri) {
+		return 1;
+	}
+	for (uint32_t i = 0; (host->descriptor = lv2_descriptor(i)); i++) {
+		if (!strcmp(host->descriptor->URI, uri)) {
+			break;
+		}
+	}
+	if (!host->descriptor) {
+		return 1;
+	}
+	host->n_channels = n_channels;
+
+	host->instance = host->descriptor->instantiate(
+		host->descriptor, sample_rate, "", host->features);
+	if (!host->instance) {
+		return 1;
+	}
+
+	const LV2_Descriptor* d = host->descriptor;
+	if (d->extension_data) {
+		host->worker = (const LV2_Worker_Interface*)d->extension_data(LV2_WORKER__interface);
+	}
+
+	d->connect_port(host->instance, 0, host->audio_in[0]);
+	d->connect_port(host->instance, 1, host->audio_out[0]);
+	d->connect_port(host->instance, 2, host->time_buf);
+	d->connect_port(host->instance, 3, &host->record_enable);
+	d->connect_port(host->instance, 4, &host->loop_length);
+	d->connect_port(host->instance, 5, &host->persist_enable);
+	d->connect_port(host->instance, 6, &host->armed);
+	d->connect_port(host->instance, 7, &host->recording);
+	d->connect_port(host->instance, 8, &host->recorded);
+	d->connect_port(host->instance, 9, &host->stitch_search);
+	d->connect_port(host->instance, 10, &host->slot);
+	d->connect_port(host->instance, 11, &host->overdub);
+	d->connect_port(host->instance, 12, &host->long_loop);
+	d->connect_port(host->instance, 13, &host->storage);
+	d->connect_port(host->instance, 14, &host->follow);
+	d->connect_port(host->instance, 15, &host->capture_ring);
+	d->connect_port(host->instance, 16, &host->capture);
+	d->connect_port(host->instance, 18, &host->freewheel);
+	for (uint32_t c = 1; c < n_channels; c++) {
+		d->connect_port(host->instance, 20 + 2 * (c - 1), host->audio_in[c]);
+		d->connect_port(host->instance, 21 + 2 * (c - 1), host->audio_out[c]);
+	}
+
+	d->activate(host->instance);
+	return 0;
+}
+
+/* Write a time:Position for the current transport state at frame 0 */
+static void
+write_position(RemusHost* host)
+{
+	LV2_Atom_Forge* forge = &host->forge;
+	LV2_Atom_Forge_Frame seq_frame;
+	LV2_Atom_Forge_Frame obj_frame;
+
+	const double frames_per_beat = host->sample_rate * 60.0 / host->bpm;
+	const double beats = (double)host->frame / frames_per_beat;
+	const int64_t bar = (int64_t)floor(beats / host->beats_per_bar);
+	const double bar_beat = beats - (double)bar * host->beats_per_bar;
+
+	lv2_atom_forge_set_buffer(forge, (uint8_t*)host->time_buf, sizeof(host->time_buf));
+	lv2_atom_forge_sequence_head(forge, &seq_frame, 0);
+	lv2_atom_forge_frame_time(forge, 0);
+	lv2_atom_forge_object(forge, &obj_frame, 0, host->time_Position);
+	lv2_atom_forge_key(forge, host->time_frame);
+	lv2_atom_forge_long(forge, host->frame);
+	lv2_atom_forge_key(forge, host->time_speed);
+	lv2_atom_forge_float(forge, host->rolling ? 1.0f : 0.0f);
+	lv2_atom_forge_key(forge, host->time_bar);
+	lv2_atom_forge_long(forge, bar);
+	lv2_atom_forge_key(forge, host->time_barBeat);
+	lv2_atom_forge_float(forge, (float)bar_beat);
+	lv2_atom_forge_key(forge, host->time_beatUnit);
+	lv2_atom_forge_int(forge, 4);
+	lv2_atom_forge_key(forge, host->time_beatsPerBar);
+	lv2_atom_forge_float(forge, (float)host->beats_per_bar);
+	lv2_atom_forge_key(forge, host->time_beatsPerMinute);
+	lv2_atom_forge_float(forge, (float)host->bpm);
+	lv2_atom_forge_pop(forge, &obj_frame);
+
+	for (uint32_t i = 0; i < host->n_commands; i++) {
+		const HostCommand* command = &host->commands[i];
+		lv2_atom_forge_frame_time(forge, command->frame);
+		lv2_atom_forge_object(forge, &obj_frame, 0, host->remus_Command);
+		lv2_atom_forge_key(forge, host->remus_action);
+		lv2_atom_forge_urid(forge, command->action);
+		if (command->action == host->remus_select) {
+			lv2_atom_forge_key(forge, host->remus_slot);
+			lv2_atom_forge_int(forge, command->slot);
+		}
+		lv2_atom_forge_pop(forge, &obj_frame);
+	}
+	host->n_commands = 0;
+	lv2_atom_forge_pop(forge, &seq_frame);
+}
+
+void
+remus_host_run(RemusHost* host, uint32_t n_samples)
+{
+	write_position(host);
+	if (host->peaks_connected) {
+		// Output sequences get the capacity of their buffer
+		LV2_Atom* sequence = (LV2_Atom*)(void*)host->peaks_buf;
+		sequence->size = sizeof(host->peaks_buf) - sizeof(LV2_Atom);
+	}
+
+	const uint64_t start = now_ns();
+	host->descriptor->run(host->instance, n_samples);
+	host->run_ns = now_ns() - start;
+
+	run_worker(host);
+
+	if (host->rolling) {
+		host->frame += n_samples;
+	}
+}
+
+void
+remus_host_connect_peaks(RemusHost* host)
+{
+	host->descriptor->connect_port(host->instance, 19, host->peaks_buf);
+	host->peaks_connected = true;
+}
+
+void
+remus_host_command(RemusHost* host, uint32_t frame, const char* action, int32_t slot)
+{
+	char uri[128];
+	snprintf(uri, sizeof(uri), REMUS_HOST_URI "#%s", action);
+	if (host->n_commands < HOST_MAX_COMMANDS) {
+		host->commands[host->n_commands++] = (HostCommand){ frame, map_uri(host, uri), slot };
+	}
+}
+
+void
+remus_host_free(RemusHost* host)
+{
+	if (host->instance) {
+		// Let the plugin retire what it still has in flight
+		run_worker(host);
+		run_worker(host);
+		host->descriptor->deactivate(host->instance);
+		host->descriptor->cleanup(host->instance);
+		host->instance = NULL;
+	}
+
+	for (uint32_t i = 0; i < host->n_uris; i++) {
+		free(host->uris[i]);
+	}
+	host->n_uris = 0;
+}
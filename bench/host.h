@@ -0,0 +1,145 @@
+#ifndef REMUS_HOST_H
+#define REMUS_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lv2/core/lv2.h"
+#include "lv2/atom/atom.h"
+#include "lv2/atom/forge.h"
+#include "lv2/urid/urid.h"
+#include "lv2/worker/worker.h"
+#include "lv2/options/options.h"
+
+#define HOST_MAX_URIS 256
+#define HOST_MAX_BLOCK 4096
+#define HOST_MAX_CHANNELS 4
+#define HOST_SEQ_SIZE 4096
+#define HOST_MAX_MESSAGES 64
+#define HOST_MESSAGE_SIZE 256
+#define HOST_MAX_COMMANDS 16
+
+/* Worker request or response, copied like a host ring buffer would */
+typedef struct {
+	uint32_t size;
+	uint64_t data[HOST_MESSAGE_SIZE / sizeof(uint64_t)];
+} HostMessage;
+
+typedef struct {
+	HostMessage messages[HOST_MAX_MESSAGES];
+	uint32_t    n_messages;
+} HostQueue;
+
+/* remus:Command sent at a frame of the next block */
+typedef struct {
+	uint32_t frame;
+	LV2_URID action;
+	int32_t  slot;
+} HostCommand;
+
+/*
+ * Minimal headless LV2 host driving one Remus instance, mono or one of the
+ * multichannel variants.
+ *
+ * The host owns the port buffers and a simple transport. Every call to
+ * remus_host_run() sends a time:Position at frame 0 of the block, like most
+ * DAWs do, followed by the commands queued for the block, then runs the
+ * plugin and advances the transport. Worker jobs
+ * scheduled during a block are executed synchronously after run(), and their
+ * responses are delivered before the block ends, as jalv does.
+ */
+typedef struct {
+	// URID map
+	char*         uris[HOST_MAX_URIS];
+	uint32_t      n_uris;
+	LV2_URID_Map  map;
+	LV2_Feature   map_feature;
+	LV2_Worker_Schedule schedule;
+	LV2_Feature   schedule_feature;
+	int32_t       max_block;
+	LV2_Options_Option options[2];
+	LV2_Feature   options_feature;
+	const LV2_Feature* features[4];
+
+	// Worker
+	const LV2_Worker_Interface* worker;
+	HostQueue     jobs;
+	HostQueue     responses;
+
+	LV2_Atom_Forge forge;
+	LV2_URID      time_Position;
+	LV2_URID      time_frame;
+	LV2_URID      time_speed;
+	LV2_URID      time_bar;
+	LV2_URID      time_barBeat;
+	LV2_URID      time_beatUnit;
+	LV2_URID      time_beatsPerBar;
+	LV2_URID      time_beatsPerMinute;
+	LV2_URID      remus_Command;
+	LV2_URID      remus_action;
+	LV2_URID      remus_slot;
+	LV2_URID      remus_select;
+
+	// Plugin
+	const LV2_Descriptor* descriptor;
+	LV2_Handle    instance;
+
+	// Port buffers
+	uint32_t      n_channels;
+	float         audio_in[HOST_MAX_CHANNELS][HOST_MAX_BLOCK];
+	float         audio_out[HOST_MAX_CHANNELS][HOST_MAX_BLOCK];
+	uint64_t      time_buf[HOST_SEQ_SIZE / sizeof(uint64_t)];
+	HostCommand   commands[HOST_MAX_COMMANDS];
+	uint32_t      n_commands;
+	uint64_t      peaks_buf[HOST_SEQ_SIZE / sizeof(uint64_t)];
+	bool          peaks_connected;
+	float         record_enable;
+	float         loop_length;
+	float         persist_enable;
+	float         stitch_search;
+	float         slot;
+	float         overdub;
+	float         long_loop;
+	float         storage;
+	float         follow;
+	float         capture_ring;
+	float         capture;
+	float         freewheel;
+	float         armed;
+	float         recording;
+	float         recorded;
+
+	// Transport
+	double        sample_rate;
+	double        bpm;
+	double        beats_per_bar;
+	int64_t       frame;
+	bool          rolling;
+
+	// Time spent in audio thread callbacks during the last block
+	uint64_t      run_ns;
+} RemusHost;
+
+/* Instantiate and activate the plugin with 1, 2 or 4 channels. Returns 0 on success. */
+int
+remus_host_init(RemusHost* host, double sample_rate, uint32_t n_channels);
+
+/* Run one block of n_samples (at most HOST_MAX_BLOCK) frames. */
+void
+remus_host_run(RemusHost* host, uint32_t n_samples);
+
+/*
+ * Queue a command for the next block, at frame, in frame order. action is a
+ * remus URI fragment like "arm", slot is only sent for "select".
+ */
+void
+remus_host_command(RemusHost* host, uint32_t frame, const char* action, int32_t slot);
+
+/* Connect the peaks port, it is read from peaks_buf after each block. */
+void
+remus_host_connect_peaks(RemusHost* host);
+
+/* Deactivate and free the plugin instance. */
+void
+remus_host_free(RemusHost* host);
+
+#endif
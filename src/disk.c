@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "disk.h"
+
+#define PAGE_BYTES ((size_t)REMUS_PAGE_FRAMES * sizeof(float))
+
+// Page states in RemusDisk.locked
+#define PAGE_ON_DISK  0  // May be out of memory
+#define PAGE_RESIDENT 1  // Faulted in, the memory lock limit was reached
+#define PAGE_LOCKED   2  // Faulted in and locked
+
+static size_t
+page_offset(const RemusDisk* self, const float* page)
+{
+	return (size_t)(page - self->base) * sizeof(float);
+}
+
+void
+remus_disk_init(RemusDisk* self)
+{
+	memset(self, 0, sizeof(RemusDisk));
+	pthread_mutex_init(&self->lock, NULL);
+	self->fd = -1;
+}
+
+bool
+remus_disk_open(RemusDisk* self)
+{
+	pthread_mutex_lock(&self->lock);
+	if (self->base) {
+		pthread_mutex_unlock(&self->lock);
+		return true;
+	}
+
+	const char* dir = getenv("TMPDIR");
+	char        path[4096];
+	snprintf(path, sizeof(path), "%s/remus-XXXXXX", dir ? dir : "/var/tmp");
+
+	self->free = (uint32_t*)malloc(REMUS_DISK_MAX_PAGES * sizeof(uint32_t));
+	self->locked = (uint8_t*)calloc(REMUS_DISK_MAX_PAGES, 1);
+	self->fd = mkstemp(path);
+	if (self->fd >= 0) {
+		// Nothing else needs the name, the file goes away with the descriptor
+		unlink(path);
+	}
+
+	void* base = MAP_FAILED;
+	if (self->free && self->locked && self->fd >= 0) {
+		base = mmap(NULL, (size_t)REMUS_DISK_MAX_PAGES * PAGE_BYTES,
+		            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, self->fd, 0);
+	}
+	if (base == MAP_FAILED) {
+		if (self->fd >= 0) {
+			close(self->fd);
+		}
+		free(self->free);
+		free(self->locked);
+		self->fd = -1;
+		self->free = NULL;
+		self->locked = NULL;
+		pthread_mutex_unlock(&self->lock);
+		return false;
+	}
+
+	self->base = (float*)base;
+	self->n_pages = 0;
+	self->n_free = 0;
+	pthread_mutex_unlock(&self->lock);
+	return true;
+}
+
+void
+remus_disk_close(RemusDisk* self)
+{
+	if (self->base) {
+		munmap(self->base, (size_t)REMUS_DISK_MAX_PAGES * PAGE_BYTES);
+		close(self->fd);
+		free(self->free);
+		free(self->locked);
+	}
+	pthread_mutex_destroy(&self->lock);
+	remus_disk_init(self);
+}
+
+float*
+remus_disk_acquire(RemusDisk* self)
+{
+	float* page = NULL;
+
+	pthread_mutex_lock(&self->lock);
+	if (!self->base) {
+		// Not open
+	} else if (self->n_free > 0) {
+		// Released pages are holes in the file, they read back as zeros
+		page = self->base + (size_t)self->free[--self->n_free] * REMUS_PAGE_FRAMES;
+	} else if (self->n_pages < REMUS_DISK_MAX_PAGES
+	           && !ftruncate(self->fd, (off_t)(self->n_pages + 1) * (off_t)PAGE_BYTES)) {
+		page = self->base + (size_t)self->n_pages++ * REMUS_PAGE_FRAMES;
+	}
+	pthread_mutex_unlock(&self->lock);
+	return page;
+}
+
+void
+remus_disk_release(RemusDisk* self, float* page)
+{
+	if (!remus_disk_owns(self, page)) {
+		return;
+	}
+
+	const uint32_t index = (uint32_t)((page - self->base) / REMUS_PAGE_FRAMES);
+
+	pthread_mutex_lock(&self->lock);
+	if (self->locked[index] == PAGE_LOCKED) {
+		munlock(page, PAGE_BYTES);
+	}
+	self->locked[index] = PAGE_ON_DISK;
+
+	// Discard the contents, fall back to clearing where holes are not supported
+	if (fallocate(self->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	              (off_t)page_offset(self, page), (off_t)PAGE_BYTES)) {
+		memset(page, 0, PAGE_BYTES);
+	}
+	madvise(page, PAGE_BYTES, MADV_DONTNEED);
+	self->free[self->n_free++] = index;
+	pthread_mutex_unlock(&self->lock);
+}
+
+bool
+remus_disk_lock(RemusDisk* self, float* page)
+{
+	const uint32_t index = (uint32_t)((page - self->base) / REMUS_PAGE_FRAMES);
+
+	pthread_mutex_lock(&self->lock);
+	if (self->locked[index] == PAGE_ON_DISK) {
+		// Fault the page in writable, run() may record into it
+#ifdef MADV_POPULATE_WRITE
+		if (madvise(page, PAGE_BYTES, MADV_POPULATE_WRITE)) {
+			madvise(page, PAGE_BYTES, MADV_WILLNEED);
+		}
+#else
+		madvise(page, PAGE_BYTES, MADV_WILLNEED);
+#endif
+		self->locked[index] = mlock(page, PAGE_BYTES) ? PAGE_RESIDENT : PAGE_LOCKED;
+	}
+	const bool locked = self->locked[index] == PAGE_LOCKED;
+	pthread_mutex_unlock(&self->lock);
+	return locked;
+}
+
+void
+remus_disk_unlock(RemusDisk* self, float* page)
+{
+	const uint32_t index = (uint32_t)((page - self->base) / REMUS_PAGE_FRAMES);
+
+	pthread_mutex_lock(&self->lock);
+	if (self->locked[index] != PAGE_ON_DISK) {
+		if (self->locked[index] == PAGE_LOCKED) {
+			munlock(page, PAGE_BYTES);
+		}
+		self->locked[index] = PAGE_ON_DISK;
+
+		// Write back, then drop the page from the process and the page cache
+		msync(page, PAGE_BYTES, MS_SYNC);
+		madvise(page, PAGE_BYTES, MADV_DONTNEED);
+		posix_fadvise(self->fd, (off_t)page_offset(self, page), (off_t)PAGE_BYTES,
+		              POSIX_FADV_DONTNEED);
+	}
+	pthread_mutex_unlock(&self->lock);
+}
@@ -0,0 +1,71 @@
+#ifndef REMUS_DISK_H
+#define REMUS_DISK_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "pool.h"
+
+#define REMUS_DISK_MAX_PAGES (1u << 20)  // Address space reserved for the file (16 GiB)
+
+/*
+ * Disk-backed sample pages for long loops.
+ *
+ * Pages are slices of an unlinked temporary file, mapped in one reserved
+ * address range so they never move. A page is only guaranteed to be in
+ * memory while it is locked: run() must only touch locked pages, the worker
+ * locks them ahead of the play and record positions and unlocks them behind,
+ * which writes them back and drops them from memory. Every function may
+ * block: call them from instantiate/cleanup, state or worker context, never
+ * from run().
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	int             fd;
+	float*          base;     // Reserved mapping, NULL until opened
+	uint32_t        n_pages;  // Pages in the file, handed out or free
+	uint32_t*       free;     // Indices of released pages
+	uint32_t        n_free;
+	uint8_t*        locked;   // Per page, whether it is held in memory
+} RemusDisk;
+
+/* Prepare a closed disk, nothing is created before remus_disk_open() */
+void
+remus_disk_init(RemusDisk* self);
+
+/* Create the backing file in TMPDIR (or /var/tmp) if needed. Returns false on failure. */
+bool
+remus_disk_open(RemusDisk* self);
+
+/* Unmap and delete the backing file, all pages must have been released */
+void
+remus_disk_close(RemusDisk* self);
+
+/* Whether page belongs to this disk */
+static inline bool
+remus_disk_owns(const RemusDisk* self, const float* page)
+{
+	return self->base && page >= self->base
+		&& page < self->base + (uint64_t)REMUS_DISK_MAX_PAGES * REMUS_PAGE_FRAMES;
+}
+
+/* Get a zero-filled page, not locked, or NULL if the disk is full or not open */
+float*
+remus_disk_acquire(RemusDisk* self);
+
+/* Return a page to the disk, its contents are discarded */
+void
+remus_disk_release(RemusDisk* self, float* page);
+
+/*
+ * Fault page in, writable, and lock it in memory. Returns false if it could
+ * only be prefaulted, when the memory lock limit is reached.
+ */
+bool
+remus_disk_lock(RemusDisk* self, float* page);
+
+/* Write page back and drop it from memory, if it was locked */
+void
+remus_disk_unlock(RemusDisk* self, float* page);
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef REMUS_DSP_H
+#define REMUS_DSP_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Block kernels used by run() on state-homogeneous spans.
+ *
+ * Plain copies and silence go through memcpy/memset, which the C library
+ * already vectorizes. Kernels doing arithmetic have an AVX, SSE2 or NEON
+ * body selected at compile time, and a scalar loop for the remainder and for
+ * other targets. They give the same results as the scalar code. kernels.c
+ * builds them once per instruction set and run() calls them through the
+ * table picked at instantiate time, see kernels.h.
+ */
+
+static inline void
+remus_copy(float* dst, const float* src, uint32_t n)
+{
+	memcpy(dst, src, n * sizeof(float));
+}
+
+static inline void
+remus_zero(float* dst, uint32_t n)
+{
+	memset(dst, 0, n * sizeof(float));
+}
+
+/* Mix src into dst in place: dst[i] += src[i] */
+static inline void
+remus_add(float* dst, const float* src, uint32_t n)
+{
+	uint32_t i = 0;
+
+#if defined(__AVX512F__)
+	for (; i < (n & ~15u); i += 16) {
+		_mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+	}
+#endif
+#if defined(__AVX__)
+	for (; i < (n & ~7u); i += 8) {
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	for (; i < (n & ~3u); i += 4) {
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+	}
+#elif defined(__ARM_NEON)
+	for (; i < (n & ~3u); i += 4) {
+		vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[i] += src[i];
+	}
+}
+
+/* Mix n_src planar channels down to dst: the average of src[0..n_src)[i] */
+static inline void
+remus_mix_down(float* dst, const float* const* src, uint32_t n_src, uint32_t n)
+{
+	const float gain = 1.0f / (float)n_src;
+
+	remus_copy(dst, src[0], n);
+	for (uint32_t c = 1; c < n_src; c++) {
+		for (uint32_t i = 0; i < n; i++) {
+			dst[i] += src[c][i];
+		}
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		dst[i] *= gain;
+	}
+}
+
+/* Expand 16-bit samples: dst[i] = hi[i] * scale */
+static inline void
+remus_unpack16(float* dst, const int16_t* hi, float scale, uint32_t n)
+{
+	uint32_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; i < (n & ~7u); i += 8) {
+		const __m128i h = _mm_loadu_si128((const __m128i*)(hi + i));
+		// Sign-extend by placing each word in the top half of a lane
+		const __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(h, h), 16);
+		const __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(h, h), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), vscale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), vscale));
+	}
+#elif defined(__ARM_NEON)
+	for (; i < (n & ~7u); i += 8) {
+		const int16x8_t h = vld1q_s16(hi + i);
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(h))), scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(h))), scale));
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[i] = (float)hi[i] * scale;
+	}
+}
+
+/*
+ * Expand 24-bit samples split in a high word and a low byte:
+ * dst[i] = (hi[i] * 256 + lo[i]) * scale
+ */
+static inline void
+remus_unpack24(float* dst, const int16_t* hi, const uint8_t* lo, float scale, uint32_t n)
+{
+	uint32_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128  vscale = _mm_set1_ps(scale);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i < (n & ~7u); i += 8) {
+		const __m128i h = _mm_loadu_si128((const __m128i*)(hi + i));
+		const __m128i l = _mm_unpacklo_epi8(zero, _mm_loadl_epi64((const __m128i*)(lo + i)));
+		// Lanes hold hi << 16 | lo << 8, the arithmetic shift sign-extends
+		const __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(l, h), 8);
+		const __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(l, h), 8);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), vscale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), vscale));
+	}
+#elif defined(__ARM_NEON)
+	for (; i < (n & ~7u); i += 8) {
+		const int16x8_t  h = vld1q_s16(hi + i);
+		const uint16x8_t l = vmovl_u8(vld1_u8(lo + i));
+		const int32x4_t  a = vorrq_s32(vshlq_n_s32(vmovl_s16(vget_low_s16(h)), 8),
+		                               vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(l))));
+		const int32x4_t  b = vorrq_s32(vshlq_n_s32(vmovl_s16(vget_high_s16(h)), 8),
+		                               vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(l))));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(a), scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(b), scale));
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[i] = (float)((int32_t)hi[i] * 256 + lo[i]) * scale;
+	}
+}
+
+/*
+ * Dot product of n samples of x with coefficients interpolated between two
+ * filter phases: the sum of x[i] * (c[i] + t * d[i]). n is a multiple of 8.
+ * The SIMD bodies add the products in another order than the scalar loop,
+ * and fuse them where the target has FMA.
+ */
+static inline float
+remus_fir(const float* x, const float* c, const float* d, float t, uint32_t n)
+{
+	uint32_t i = 0;
+	float    sum = 0.0f;
+
+#if defined(__AVX512F__)
+	const __m512 vt16 = _mm512_set1_ps(t);
+	__m512       acc16 = _mm512_setzero_ps();
+	for (; i < (n & ~15u); i += 16) {
+		const __m512 h = _mm512_fmadd_ps(vt16, _mm512_loadu_ps(d + i), _mm512_loadu_ps(c + i));
+		acc16 = _mm512_fmadd_ps(h, _mm512_loadu_ps(x + i), acc16);
+	}
+	sum = _mm512_reduce_add_ps(acc16);
+#endif
+#if defined(__AVX__)
+	const __m256 vt = _mm256_set1_ps(t);
+	__m256       acc = _mm256_setzero_ps();
+	for (; i < (n & ~7u); i += 8) {
+#if defined(__FMA__)
+		const __m256 h = _mm256_fmadd_ps(vt, _mm256_loadu_ps(d + i), _mm256_loadu_ps(c + i));
+		acc = _mm256_fmadd_ps(h, _mm256_loadu_ps(x + i), acc);
+#else
+		const __m256 h = _mm256_add_ps(_mm256_loadu_ps(c + i), _mm256_mul_ps(vt, _mm256_loadu_ps(d + i)));
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(h, _mm256_loadu_ps(x + i)));
+#endif
+	}
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	sum += _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128 vt = _mm_set1_ps(t);
+	__m128       acc = _mm_setzero_ps();
+	for (; i < (n & ~3u); i += 4) {
+		const __m128 h = _mm_add_ps(_mm_loadu_ps(c + i), _mm_mul_ps(vt, _mm_loadu_ps(d + i)));
+		acc = _mm_add_ps(acc, _mm_mul_ps(h, _mm_loadu_ps(x + i)));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	sum = _mm_cvtss_f32(_mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1)));
+#elif defined(__ARM_NEON)
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	for (; i < (n & ~3u); i += 4) {
+		const float32x4_t h = vmlaq_n_f32(vld1q_f32(c + i), vld1q_f32(d + i), t);
+		acc = vmlaq_f32(acc, h, vld1q_f32(x + i));
+	}
+	const float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+
+	for (; i < n; i++) {
+		sum += x[i] * (c[i] + t * d[i]);
+	}
+	return sum;
+}
+
+/*
+ * Linear crossfade from src into dst:
+ * dst[i] = src[i] * (1 - g) + dst[i] * g, with g = (first + i) / (length - 1).
+ *
+ * first is the index of dst[0] in a fade of length samples, so a fade can be
+ * applied in several pieces.
+ */
+static inline void
+remus_crossfade(float* dst, const float* src, uint32_t n, uint32_t first, uint32_t length)
+{
+	const float denom = (float)(length - 1);
+	uint32_t    i     = 0;
+
+#if defined(__AVX__)
+	const __m256 vdenom = _mm256_set1_ps(denom);
+	const __m256 vone = _mm256_set1_ps(1.0f);
+	for (; i < (n & ~7u); i += 8) {
+		const int32_t k = (int32_t)(first + i);
+		const __m256 g = _mm256_div_ps(
+			_mm256_cvtepi32_ps(_mm256_setr_epi32(k, k + 1, k + 2, k + 3, k + 4, k + 5, k + 6, k + 7)),
+			vdenom);
+		const __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), _mm256_sub_ps(vone, g));
+		const __m256 b = _mm256_mul_ps(_mm256_loadu_ps(dst + i), g);
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(a, b));
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128 vdenom = _mm_set1_ps(denom);
+	const __m128 vone = _mm_set1_ps(1.0f);
+	for (; i < (n & ~3u); i += 4) {
+		const int32_t k = (int32_t)(first + i);
+		const __m128 g = _mm_div_ps(_mm_cvtepi32_ps(_mm_setr_epi32(k, k + 1, k + 2, k + 3)), vdenom);
+		const __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), _mm_sub_ps(vone, g));
+		const __m128 b = _mm_mul_ps(_mm_loadu_ps(dst + i), g);
+		_mm_storeu_ps(dst + i, _mm_add_ps(a, b));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const float32x4_t vdenom = vdupq_n_f32(denom);
+	const float32x4_t vone = vdupq_n_f32(1.0f);
+	for (; i < (n & ~3u); i += 4) {
+		const uint32_t k = first + i;
+		const uint32_t idx[4] = { k, k + 1, k + 2, k + 3 };
+		const float32x4_t g = vdivq_f32(vcvtq_f32_u32(vld1q_u32(idx)), vdenom);
+		const float32x4_t a = vmulq_f32(vld1q_f32(src + i), vsubq_f32(vone, g));
+		const float32x4_t b = vmulq_f32(vld1q_f32(dst + i), g);
+		vst1q_f32(dst + i, vaddq_f32(a, b));
+	}
+#endif
+
+	for (; i < n; i++) {
+		const float fade_in = (float)(first + i) / denom;
+		const float fade_out = 1.0f - fade_in;
+		dst[i] = src[i] * fade_out + dst[i] * fade_in;
+	}
+}
+
+/*
+ * Index the zero-crossings of x: bit i of rising (falling) is set when the
+ * signal crosses zero upwards (downwards) between x[i - 1] and x[i], for
+ * 0 < i < n. The masks must hold n bits and start cleared.
+ */
+static inline void
+remus_zero_crossings(const float* x, uint32_t n, uint64_t* rising, uint64_t* falling)
+{
+	uint32_t i = 1;
+
+#if defined(__AVX__)
+	const uint32_t n_vec = (n > 0) ? 1 + ((n - 1) & ~7u) : 0;
+	const __m256   zero = _mm256_setzero_ps();
+	for (; i < n_vec; i += 8) {
+		const __m256 prev = _mm256_loadu_ps(x + i - 1);
+		const __m256 cur = _mm256_loadu_ps(x + i);
+		const uint64_t up = (uint64_t)_mm256_movemask_ps(_mm256_and_ps(
+			_mm256_cmp_ps(prev, zero, _CMP_LT_OQ), _mm256_cmp_ps(cur, zero, _CMP_GE_OQ)));
+		const uint64_t down = (uint64_t)_mm256_movemask_ps(_mm256_and_ps(
+			_mm256_cmp_ps(prev, zero, _CMP_GT_OQ), _mm256_cmp_ps(cur, zero, _CMP_LE_OQ)));
+		rising[i >> 6] |= up << (i & 63);
+		falling[i >> 6] |= down << (i & 63);
+		if ((i & 63) > 56) {
+			rising[(i >> 6) + 1] |= up >> (64 - (i & 63));
+			falling[(i >> 6) + 1] |= down >> (64 - (i & 63));
+		}
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	const uint32_t n_vec = (n > 0) ? 1 + ((n - 1) & ~3u) : 0;
+	const __m128   zero = _mm_setzero_ps();
+	for (; i < n_vec; i += 4) {
+		const __m128 prev = _mm_loadu_ps(x + i - 1);
+		const __m128 cur = _mm_loadu_ps(x + i);
+		const uint64_t up = (uint64_t)_mm_movemask_ps(_mm_and_ps(
+			_mm_cmplt_ps(prev, zero), _mm_cmpge_ps(cur, zero)));
+		const uint64_t down = (uint64_t)_mm_movemask_ps(_mm_and_ps(
+			_mm_cmpgt_ps(prev, zero), _mm_cmple_ps(cur, zero)));
+		rising[i >> 6] |= up << (i & 63);
+		falling[i >> 6] |= down << (i & 63);
+		if ((i & 63) > 60) {
+			rising[(i >> 6) + 1] |= up >> (64 - (i & 63));
+			falling[(i >> 6) + 1] |= down >> (64 - (i & 63));
+		}
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint32_t    n_vec = (n > 0) ? 1 + ((n - 1) & ~3u) : 0;
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const uint32_t    weights[4] = { 1, 2, 4, 8 };
+	const uint32x4_t  vweights = vld1q_u32(weights);
+	for (; i < n_vec; i += 4) {
+		const float32x4_t prev = vld1q_f32(x + i - 1);
+		const float32x4_t cur = vld1q_f32(x + i);
+		const uint64_t up = vaddvq_u32(vandq_u32(
+			vandq_u32(vcltq_f32(prev, zero), vcgeq_f32(cur, zero)), vweights));
+		const uint64_t down = vaddvq_u32(vandq_u32(
+			vandq_u32(vcgtq_f32(prev, zero), vcleq_f32(cur, zero)), vweights));
+		rising[i >> 6] |= up << (i & 63);
+		falling[i >> 6] |= down << (i & 63);
+		if ((i & 63) > 60) {
+			rising[(i >> 6) + 1] |= up >> (64 - (i & 63));
+			falling[(i >> 6) + 1] |= down >> (64 - (i & 63));
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (x[i - 1] < 0.0f && x[i] >= 0.0f) {
+			rising[i >> 6] |= (uint64_t)1 << (i & 63);
+		} else if (x[i - 1] > 0.0f && x[i] <= 0.0f) {
+			falling[i >> 6] |= (uint64_t)1 << (i & 63);
+		}
+	}
+}
+
+/* Bits [first, first + n) of mask as an integer, n < 64 */
+static inline uint64_t
+remus_mask_bits(const uint64_t* mask, uint32_t first, uint32_t n)
+{
+	const uint32_t shift = first & 63;
+	uint64_t       bits = mask[first >> 6] >> shift;
+	if (shift + n > 64) {
+		bits |= mask[(first >> 6) + 1] << (64 - shift);
+	}
+	return bits & (((uint64_t)1 << n) - 1);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file.h"
+
+#define PAGE_BYTES ((size_t)REMUS_PAGE_FRAMES * sizeof(float))
+#define FILE_MAGIC "REMUSF32"
+#define TEMP_SUFFIX ".XXXXXX"  // Of the file written before it replaces a loop file
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+/* Last bytes of a loop file, in native byte order */
+typedef struct {
+	char     magic[8];
+	uint32_t n_channels;
+	uint32_t n_samples;
+} FileTrailer;
+
+/* Write all of buf, retrying short writes */
+static bool
+write_all(int fd, const void* buf, size_t n)
+{
+	const char* p = (const char*)buf;
+	while (n > 0) {
+		const ssize_t written = write(fd, p, n);
+		if (written <= 0) {
+			return false;
+		}
+		p += written;
+		n -= (size_t)written;
+	}
+	return true;
+}
+
+void
+remus_files_init(RemusFiles* self)
+{
+	memset(self, 0, sizeof(RemusFiles));
+	pthread_mutex_init(&self->lock, NULL);
+}
+
+void
+remus_files_close(RemusFiles* self)
+{
+	for (uint32_t m = 0; m < REMUS_FILE_MAX_MAPS; m++) {
+		if (self->maps[m].base) {
+			munmap(self->maps[m].base, self->maps[m].n_bytes);
+		}
+	}
+	pthread_mutex_destroy(&self->lock);
+	remus_files_init(self);
+}
+
+bool
+remus_file_write(const char* path, float* const* table, uint32_t n_channels, uint32_t n_samples)
+{
+	// Write aside and rename over path: a restored loop may be playing from a
+	// mapping of the file it replaces, which keeps the old contents
+	const size_t n_path = strlen(path);
+	char*        temp = (char*)malloc(n_path + sizeof(TEMP_SUFFIX));
+	if (!temp) {
+		return false;
+	}
+	memcpy(temp, path, n_path);
+	memcpy(temp + n_path, TEMP_SUFFIX, sizeof(TEMP_SUFFIX));
+	const int fd = mkstemp(temp);
+	if (fd < 0) {
+		free(temp);
+		return false;
+	}
+
+	// Channel after channel, the last page of each is padded with zeros
+	const uint32_t n_pages = remus_pages_for(n_samples);
+	float          padded[REMUS_PAGE_FRAMES];
+	bool           ok = true;
+	for (uint32_t c = 0; c < n_channels && ok; c++) {
+		for (uint32_t p = 0; p < n_pages && ok; p++) {
+			const float*   page = table[p * n_channels + c];
+			const uint32_t used = n_samples - p * REMUS_PAGE_FRAMES;
+			if (used < REMUS_PAGE_FRAMES) {
+				memcpy(padded, page, used * sizeof(float));
+				memset(padded + used, 0, (REMUS_PAGE_FRAMES - used) * sizeof(float));
+				page = padded;
+			}
+			ok = write_all(fd, page, PAGE_BYTES);
+		}
+	}
+
+	FileTrailer trailer = { .n_channels = n_channels, .n_samples = n_samples };
+	memcpy(trailer.magic, FILE_MAGIC, sizeof(trailer.magic));
+	ok = ok && write_all(fd, &trailer, sizeof(trailer));
+	ok = !fchmod(fd, 0644) && !fdatasync(fd) && ok;
+	ok = !close(fd) && ok && !rename(temp, path);
+	if (!ok) {
+		unlink(temp);
+	}
+	free(temp);
+	return ok;
+}
+
+float**
+remus_file_map(RemusFiles* self, const char* path, uint32_t n_channels, uint32_t* n_samples,
+               uint32_t resident_samples, bool* locked)
+{
+	*locked = false;
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	// Check the trailer against the file size before trusting it
+	struct stat st;
+	FileTrailer trailer;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(trailer)
+	    || pread(fd, &trailer, sizeof(trailer), st.st_size - (off_t)sizeof(trailer))
+	       != (ssize_t)sizeof(trailer)
+	    || memcmp(trailer.magic, FILE_MAGIC, sizeof(trailer.magic))
+	    || trailer.n_channels != n_channels || trailer.n_samples == 0) {
+		close(fd);
+		return NULL;
+	}
+	const uint32_t n_pages = remus_pages_for(trailer.n_samples);
+	const size_t   n_bytes = (size_t)n_pages * n_channels * PAGE_BYTES;
+	if ((size_t)st.st_size != n_bytes + sizeof(trailer)) {
+		close(fd);
+		return NULL;
+	}
+
+	// Private and writable: takes and overdubs copy the pages they change
+	const bool resident = trailer.n_samples <= resident_samples;
+	void* base = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | (resident ? MAP_POPULATE : 0), fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	// Prefaulted pages can still be reclaimed, lock them so run() never faults
+	*locked = resident && !mlock(base, n_bytes);
+
+	float** table = (float**)calloc((size_t)n_pages * n_channels, sizeof(float*));
+	RemusMap* map = NULL;
+	pthread_mutex_lock(&self->lock);
+	for (uint32_t m = 0; m < REMUS_FILE_MAX_MAPS && table && !map; m++) {
+		if (!self->maps[m].base) {
+			map = &self->maps[m];
+			map->base = (float*)base;
+			map->n_bytes = n_bytes;
+			map->n_live = n_pages * n_channels;
+			map->locked = *locked;
+		}
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (!map) {
+		free(table);
+		munmap(base, n_bytes);
+		return NULL;
+	}
+
+	for (uint32_t c = 0; c < n_channels; c++) {
+		for (uint32_t p = 0; p < n_pages; p++) {
+			table[p * n_channels + c] = (float*)base + ((size_t)c * n_pages + p) * REMUS_PAGE_FRAMES;
+		}
+	}
+	*n_samples = trailer.n_samples;
+	return table;
+}
+
+bool
+remus_files_release(RemusFiles* self, float* page)
+{
+	bool owned = false;
+
+	pthread_mutex_lock(&self->lock);
+	for (uint32_t m = 0; m < REMUS_FILE_MAX_MAPS && !owned; m++) {
+		RemusMap* map = &self->maps[m];
+		if (map->base && page >= map->base
+		    && (const char*)page < (const char*)map->base + map->n_bytes) {
+			owned = true;
+			if (--map->n_live == 0) {
+				munmap(map->base, map->n_bytes);
+				memset(map, 0, sizeof(RemusMap));
+			} else {
+				// Give back the private copy, if the page was written
+				if (map->locked) {
+					munlock(page, PAGE_BYTES);
+				}
+				madvise(page, PAGE_BYTES, MADV_DONTNEED);
+			}
+		}
+	}
+	pthread_mutex_unlock(&self->lock);
+	return owned;
+}
@@ -0,0 +1,69 @@
+#ifndef REMUS_FILE_H
+#define REMUS_FILE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pool.h"
+
+#define REMUS_FILE_MAX_MAPS 64  // Loop files mapped at once, per instance
+
+/*
+ * Loop files saved next to the session.
+ *
+ * A loop file holds the pages of each channel one channel after the other,
+ * raw float32 zero-padded to whole pages, followed by a small trailer giving
+ * the channel count and loop length. Restoring maps the file and hands out
+ * pointers into the mapping as loop pages, so nothing is decoded or copied
+ * in user space. A mapping is private: recording over a restored loop never
+ * changes the file. It is unmapped when its last page is released. Every
+ * function may block: call them from instantiate/cleanup, state or worker
+ * context, never from run().
+ */
+typedef struct {
+	float*   base;
+	size_t   n_bytes;
+	uint32_t n_live;  // Pages still in a table
+	bool     locked;  // Locked in memory, pages are unlocked as they are released
+} RemusMap;
+
+typedef struct {
+	pthread_mutex_t lock;
+	RemusMap        maps[REMUS_FILE_MAX_MAPS];
+} RemusFiles;
+
+/* Prepare an empty set of mappings */
+void
+remus_files_init(RemusFiles* self);
+
+/* Unmap every file, all pages must have been released */
+void
+remus_files_close(RemusFiles* self);
+
+/*
+ * Write the first n_samples of every channel of table to path. Page p of
+ * channel c is entry p * n_channels + c. The file is written next to path
+ * and renamed over it, so a mapping of the previous file is left intact.
+ * Returns false on failure.
+ */
+bool
+remus_file_write(const char* path, float* const* table, uint32_t n_channels, uint32_t n_samples);
+
+/*
+ * Map the loop file at path and return a table of its pages, with the loop
+ * length in n_samples, or NULL if the file is missing or does not hold
+ * n_channels. Loops up to resident_samples long are faulted in as private
+ * memory and locked, so run() can use them right away and they stay
+ * resident. locked tells if the lock succeeded, it needs a sufficient
+ * memlock limit. Longer loops are read from the file on first access.
+ */
+float**
+remus_file_map(RemusFiles* self, const char* path, uint32_t n_channels, uint32_t* n_samples,
+               uint32_t resident_samples, bool* locked);
+
+/* Release a page of a mapped file. Returns false if page is not one. */
+bool
+remus_files_release(RemusFiles* self, float* page);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdbool.h>
+#include <string.h>
+#include "kernels.h"
+
+/*
+ * Every build of this file defines one table. REMUS_KERNELS names the table
+ * of a build for an instruction set beyond the baseline of the target; the
+ * plain build defines the baseline table and the selection.
+ */
+#ifndef REMUS_KERNELS
+#define REMUS_KERNELS          remus_kernels_baseline
+#define REMUS_KERNELS_SELECTOR 1
+#endif
+
+#if defined(__AVX512F__)
+#define KERNELS_NAME "avx512"
+#elif defined(__AVX2__)
+#define KERNELS_NAME "avx2"
+#elif defined(__AVX__)
+#define KERNELS_NAME "avx"
+#elif defined(__SSE2__) || defined(_M_X64)
+#define KERNELS_NAME "sse2"
+#elif defined(__ARM_NEON)
+#define KERNELS_NAME "neon"
+#else
+#define KERNELS_NAME "scalar"
+#endif
+
+static void
+kernel_add(float* dst, const float* src, uint32_t n)
+{
+	remus_add(dst, src, n);
+}
+
+static void
+kernel_unpack16(float* dst, const int16_t* hi, float scale, uint32_t n)
+{
+	remus_unpack16(dst, hi, scale, n);
+}
+
+static void
+kernel_unpack24(float* dst, const int16_t* hi, const uint8_t* lo, float scale, uint32_t n)
+{
+	remus_unpack24(dst, hi, lo, scale, n);
+}
+
+static void
+kernel_crossfade(float* dst, const float* src, uint32_t n, uint32_t first, uint32_t length)
+{
+	remus_crossfade(dst, src, n, first, length);
+}
+
+static void
+kernel_zero_crossings(const float* x, uint32_t n, uint64_t* rising, uint64_t* falling)
+{
+	remus_zero_crossings(x, n, rising, falling);
+}
+
+static uint64_t
+kernel_resample(const RemusFilter* filter, const float* src, uint64_t phase, uint64_t step,
+                float* dst, uint32_t n)
+{
+	return remus_resample(filter, src, phase, step, dst, n);
+}
+
+const RemusKernels REMUS_KERNELS = {
+	.name           = KERNELS_NAME,
+	.add            = kernel_add,
+	.unpack16       = kernel_unpack16,
+	.unpack24       = kernel_unpack24,
+	.crossfade      = kernel_crossfade,
+	.zero_crossings = kernel_zero_crossings,
+	.resample       = kernel_resample,
+};
+
+#ifdef REMUS_KERNELS_SELECTOR
+
+#ifdef REMUS_KERNELS_X86
+extern const RemusKernels remus_kernels_avx2;
+extern const RemusKernels remus_kernels_avx512;
+
+/* Whether the CPU runs the kernels of a table */
+static bool
+supported(const RemusKernels* kernels)
+{
+	const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (kernels == &remus_kernels_avx512) {
+		return avx2 && __builtin_cpu_supports("avx512f");
+	}
+	return kernels != &remus_kernels_avx2 || avx2;
+}
+#endif
+
+const RemusKernels*
+remus_kernels_select(const char* limit)
+{
+	// Widest first, the baseline always runs
+	const RemusKernels* tables[] = {
+#ifdef REMUS_KERNELS_X86
+		&remus_kernels_avx512,
+		&remus_kernels_avx2,
+#endif
+		&remus_kernels_baseline,
+	};
+	const uint32_t n_tables = sizeof(tables) / sizeof(tables[0]);
+
+#ifdef REMUS_KERNELS_X86
+	__builtin_cpu_init();
+#endif
+
+	// Skip the tables wider than the limit, unless it names none of them
+	uint32_t first = 0;
+	if (limit) {
+		while (first < n_tables && strcmp(tables[first]->name, limit) != 0) {
+			first++;
+		}
+		if (first == n_tables) {
+			first = 0;
+		}
+	}
+
+	for (uint32_t t = first; t < n_tables - 1; t++) {
+#ifdef REMUS_KERNELS_X86
+		if (supported(tables[t])) {
+			return tables[t];
+		}
+#endif
+	}
+	return tables[n_tables - 1];
+}
+
+#endif
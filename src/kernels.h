@@ -0,0 +1,34 @@
+#ifndef REMUS_KERNELS_H
+#define REMUS_KERNELS_H
+
+#include <stdint.h>
+#include "resample.h"
+
+/*
+ * Arithmetic kernels of dsp.h and resample.h, built once per instruction set.
+ *
+ * kernels.c is compiled with the flags of each instruction set the Makefile
+ * knows for the target (SSE2, AVX2 and AVX-512 on x86-64, NEON on aarch64),
+ * each build exporting a table of these kernels. instantiate() picks the
+ * widest table the CPU supports and run() calls through it. Plain copies stay
+ * with memcpy, which the C library dispatches already.
+ */
+typedef struct {
+	const char* name;
+	void        (*add)(float* dst, const float* src, uint32_t n);
+	void        (*unpack16)(float* dst, const int16_t* hi, float scale, uint32_t n);
+	void        (*unpack24)(float* dst, const int16_t* hi, const uint8_t* lo, float scale, uint32_t n);
+	void        (*crossfade)(float* dst, const float* src, uint32_t n, uint32_t first, uint32_t length);
+	void        (*zero_crossings)(const float* x, uint32_t n, uint64_t* rising, uint64_t* falling);
+	uint64_t    (*resample)(const RemusFilter* filter, const float* src, uint64_t phase, uint64_t step,
+	                        float* dst, uint32_t n);
+} RemusKernels;
+
+/*
+ * The kernels of the widest instruction set the CPU supports, not wider than
+ * the one named by limit if it is not NULL (not RT safe, once at instantiate).
+ */
+const RemusKernels*
+remus_kernels_select(const char* limit);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+
+void
+remus_log_init(RemusLog*              self,
+               LV2_Log_Log*           log,
+               LV2_URID_Map*          map,
+               const RemusLogMessage* messages,
+               uint32_t               n_messages)
+{
+	memset(self->levels, 0, sizeof(self->levels));
+	self->log = log;
+	self->messages = messages;
+	self->n_messages = n_messages;
+	atomic_init(&self->head, 0);
+	atomic_init(&self->tail, 0);
+	atomic_init(&self->dropped, 0);
+	atomic_init(&self->draining, false);
+
+	if (log && map) {
+		self->levels[REMUS_LOG_TRACE] = map->map(map->handle, LV2_LOG__Trace);
+		self->levels[REMUS_LOG_NOTE] = map->map(map->handle, LV2_LOG__Note);
+		self->levels[REMUS_LOG_WARNING] = map->map(map->handle, LV2_LOG__Warning);
+		self->levels[REMUS_LOG_ERROR] = map->map(map->handle, LV2_LOG__Error);
+	}
+}
+
+static void
+log_vprintf(RemusLog* self, RemusLogLevel level, const char* format, va_list args)
+{
+	if (self->log) {
+		self->log->vprintf(self->log->handle, self->levels[level], format, args);
+	} else {
+		vfprintf(stderr, format, args);
+	}
+}
+
+void
+remus_log_printf(RemusLog* self, RemusLogLevel level, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	log_vprintf(self, level, format, args);
+	va_end(args);
+}
+
+/* Print a record, passing all arguments whatever the format uses */
+static void
+log_record(RemusLog* self, RemusLogLevel level, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	log_vprintf(self, level, format, args);
+	va_end(args);
+}
+
+void
+remus_log_drain(RemusLog* self)
+{
+	const unsigned head = atomic_load_explicit(&self->head, memory_order_acquire);
+	unsigned       tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+	for (; tail != head; tail++) {
+		const RemusLogRecord* record = &self->ring[tail & (REMUS_LOG_RING_SIZE - 1)];
+		if (record->code < self->n_messages) {
+			const RemusLogMessage* message = &self->messages[record->code];
+			log_record(self, message->level, message->format,
+			           (long long)record->args[0], (long long)record->args[1],
+			           (long long)record->args[2], (long long)record->args[3]);
+		}
+	}
+	atomic_store_explicit(&self->tail, tail, memory_order_release);
+
+	const unsigned dropped = atomic_exchange_explicit(&self->dropped, 0, memory_order_relaxed);
+	if (dropped) {
+		remus_log_printf(self, REMUS_LOG_WARNING,
+		                 "REMUS: %u log messages dropped, ring full\n", dropped);
+	}
+
+	atomic_store_explicit(&self->draining, false, memory_order_release);
+}
@@ -0,0 +1,141 @@
+#ifndef REMUS_LOG_H
+#define REMUS_LOG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "lv2/log/log.h"
+#include "lv2/urid/urid.h"
+
+/* Build with -DREMUS_DIAGNOSTICS=0 to compile out traces and the audio thread ring */
+#ifndef REMUS_DIAGNOSTICS
+#define REMUS_DIAGNOSTICS 1
+#endif
+
+#define REMUS_LOG_RING_SIZE 64  // Records, must be a power of two
+
+typedef enum {
+	REMUS_LOG_TRACE,
+	REMUS_LOG_NOTE,
+	REMUS_LOG_WARNING,
+	REMUS_LOG_ERROR,
+	REMUS_LOG_N_LEVELS
+} RemusLogLevel;
+
+/* Message of the table, the format takes up to four long long arguments */
+typedef struct {
+	RemusLogLevel level;
+	const char*   format;
+} RemusLogMessage;
+
+/* Fixed-size record written by the audio thread */
+typedef struct {
+	uint32_t code;
+	int64_t  args[4];
+} RemusLogRecord;
+
+/*
+ * Diagnostics channel.
+ *
+ * The audio thread never formats text: it pushes fixed-size records into a
+ * single-producer/single-consumer ring, and a non real-time consumer (the
+ * worker) formats them from the message table and hands them to the host
+ * log:Log feature, or stderr when the host has none.
+ */
+typedef struct {
+	LV2_Log_Log*           log;
+	LV2_URID               levels[REMUS_LOG_N_LEVELS];
+	const RemusLogMessage* messages;
+	uint32_t               n_messages;
+
+	RemusLogRecord         ring[REMUS_LOG_RING_SIZE];
+	atomic_uint            head;     // Next record to write, owned by the producer
+	atomic_uint            tail;     // Next record to read, owned by the consumer
+	atomic_uint            dropped;  // Records lost because the ring was full
+	atomic_bool            draining; // A drain is scheduled and not finished
+} RemusLog;
+
+void
+remus_log_init(RemusLog*              self,
+               LV2_Log_Log*           log,
+               LV2_URID_Map*          map,
+               const RemusLogMessage* messages,
+               uint32_t               n_messages);
+
+/* Queue a record from the audio thread, it is dropped if the ring is full */
+static inline void
+remus_log_push(RemusLog* self, uint32_t code,
+               int64_t a, int64_t b, int64_t c, int64_t d)
+{
+	const unsigned head = atomic_load_explicit(&self->head, memory_order_relaxed);
+	const unsigned tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+
+	if (head - tail >= REMUS_LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	RemusLogRecord* record = &self->ring[head & (REMUS_LOG_RING_SIZE - 1)];
+	record->code = code;
+	record->args[0] = a;
+	record->args[1] = b;
+	record->args[2] = c;
+	record->args[3] = d;
+	atomic_store_explicit(&self->head, head + 1, memory_order_release);
+}
+
+/* Whether records are waiting for the consumer */
+static inline bool
+remus_log_pending(RemusLog* self)
+{
+	return atomic_load_explicit(&self->head, memory_order_acquire)
+		!= atomic_load_explicit(&self->tail, memory_order_acquire);
+}
+
+/* Records waiting for the consumer */
+static inline unsigned
+remus_log_backlog(RemusLog* self)
+{
+	return atomic_load_explicit(&self->head, memory_order_acquire)
+		- atomic_load_explicit(&self->tail, memory_order_acquire);
+}
+
+/*
+ * Whether the producer should schedule a drain: records are queued and no
+ * drain is in flight. The flag is cleared by remus_log_drain().
+ */
+static inline bool
+remus_log_begin_drain(RemusLog* self)
+{
+	return remus_log_pending(self)
+		&& !atomic_exchange_explicit(&self->draining, true, memory_order_acq_rel);
+}
+
+/* Give up a drain that could not be scheduled */
+static inline void
+remus_log_cancel_drain(RemusLog* self)
+{
+	atomic_store_explicit(&self->draining, false, memory_order_release);
+}
+
+/* Format and emit all queued records (not RT safe) */
+void
+remus_log_drain(RemusLog* self);
+
+/* Format and emit a message directly (not RT safe) */
+void
+remus_log_printf(RemusLog* self, RemusLogLevel level, const char* format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#if REMUS_DIAGNOSTICS
+#define REMUS_RT_LOG(log, code, a, b, c, d) \
+	remus_log_push((log), (code), (a), (b), (c), (d))
+#define REMUS_TRACE(log, ...) remus_log_printf((log), REMUS_LOG_TRACE, __VA_ARGS__)
+#else
+#define REMUS_RT_LOG(log, code, a, b, c, d) ((void)0)
+#define REMUS_TRACE(log, ...) ((void)0)
+#endif
+
+#define REMUS_ERROR(log, ...) remus_log_printf((log), REMUS_LOG_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,68 @@
+#include <math.h>
+#include <stdlib.h>
+#include "pack.h"
+
+#define PACK_ALIGNMENT 64  // Cache line, also enough for any SIMD load
+
+/* Quantize one block to the format, returning its scale */
+static float
+pack_block(const float* src, int16_t* hi, uint8_t* lo, RemusPackFormat format)
+{
+	float peak = 0.0f;
+	for (uint32_t i = 0; i < REMUS_PACK_BLOCK; i++) {
+		peak = fmaxf(peak, fabsf(src[i]));
+	}
+
+	const float full_scale = (format == REMUS_PACK_24) ? 8388607.0f : 32767.0f;
+	const float gain = (peak > 0.0f) ? full_scale / peak : 0.0f;
+	for (uint32_t i = 0; i < REMUS_PACK_BLOCK; i++) {
+		int32_t q = (int32_t)lrintf(src[i] * gain);
+		q = (q > (int32_t)full_scale) ? (int32_t)full_scale : (q < -(int32_t)full_scale) ? -(int32_t)full_scale : q;
+		if (format == REMUS_PACK_24) {
+			lo[i] = (uint8_t)(q & 0xff);
+			hi[i] = (int16_t)((q - lo[i]) / 256);
+		} else {
+			hi[i] = (int16_t)q;
+		}
+	}
+	return peak / full_scale;
+}
+
+RemusPack*
+remus_pack(float* const* table, uint32_t n_entries, RemusPackFormat format)
+{
+	RemusPack* pack = (RemusPack*)calloc(1, sizeof(RemusPack));
+	if (!pack) {
+		return NULL;
+	}
+
+	pack->format = format;
+	pack->n_entries = n_entries;
+	pack->page_bytes = REMUS_PACK_BLOCKS * sizeof(float) + REMUS_PAGE_FRAMES * sizeof(int16_t)
+		+ ((format == REMUS_PACK_24) ? REMUS_PAGE_FRAMES : 0);
+	if (posix_memalign((void**)&pack->data, PACK_ALIGNMENT, (size_t)n_entries * pack->page_bytes)) {
+		free(pack);
+		return NULL;
+	}
+
+	for (uint32_t e = 0; e < n_entries; e++) {
+		uint8_t* page = pack->data + e * pack->page_bytes;
+		float*   scale = (float*)page;
+		int16_t* hi = (int16_t*)(page + REMUS_PACK_BLOCKS * sizeof(float));
+		uint8_t* lo = (uint8_t*)(hi + REMUS_PAGE_FRAMES);
+		for (uint32_t b = 0; b < REMUS_PACK_BLOCKS; b++) {
+			const uint32_t first = b * REMUS_PACK_BLOCK;
+			scale[b] = pack_block(table[e] + first, hi + first, lo + first, format);
+		}
+	}
+	return pack;
+}
+
+void
+remus_pack_free(RemusPack* pack)
+{
+	if (pack) {
+		free(pack->data);
+		free(pack);
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef REMUS_PACK_H
+#define REMUS_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "kernels.h"
+#include "pool.h"
+
+#define REMUS_PACK_BLOCK  256  // Samples sharing a scale
+#define REMUS_PACK_BLOCKS (REMUS_PAGE_FRAMES / REMUS_PACK_BLOCK)
+
+/* Sample formats of idle loops, the values of the storage port */
+typedef enum {
+	REMUS_PACK_FLOAT = 0,  // Not packed
+	REMUS_PACK_24    = 1,  // 24-bit, 75% of the float size
+	REMUS_PACK_16    = 2   // 16-bit, 50% of the float size
+} RemusPackFormat;
+
+/*
+ * A loop table packed as block floating point.
+ *
+ * Every page keeps REMUS_PACK_BLOCKS scales, one per block of samples, the
+ * top 16 bits of each sample, and in 24-bit format their low bytes in a
+ * separate plane. Splitting the planes keeps unpacking to plain SIMD
+ * widening. Packed loops are read only: they are unpacked again before
+ * anything is recorded into them. Packing allocates: call remus_pack() and
+ * remus_pack_free() from the worker, never from run().
+ */
+typedef struct {
+	RemusPackFormat format;
+	uint32_t        n_entries;   // Pages, all channels
+	size_t          page_bytes;
+	uint8_t*        data;
+} RemusPack;
+
+/* Pack the n_entries pages of table, or return NULL if out of memory */
+RemusPack*
+remus_pack(float* const* table, uint32_t n_entries, RemusPackFormat format);
+
+/* Free a packed table, NULL is ignored */
+void
+remus_pack_free(RemusPack* pack);
+
+/* Unpack n samples of page entry from offset, within the page (RT safe) */
+static inline void
+remus_pack_read(const RemusPack* pack, const RemusKernels* kernels, uint32_t entry, uint32_t offset,
+                float* dst, uint32_t n)
+{
+	const uint8_t* page = pack->data + entry * pack->page_bytes;
+	const float*   scale = (const float*)page;
+	const int16_t* hi = (const int16_t*)(page + REMUS_PACK_BLOCKS * sizeof(float));
+	const uint8_t* lo = (const uint8_t*)(hi + REMUS_PAGE_FRAMES);
+
+	while (n > 0) {
+		const uint32_t block = offset / REMUS_PACK_BLOCK;
+		const uint32_t left = REMUS_PACK_BLOCK - offset % REMUS_PACK_BLOCK;
+		const uint32_t chunk = (n < left) ? n : left;
+		if (pack->format == REMUS_PACK_24) {
+			kernels->unpack24(dst, hi + offset, lo + offset, scale[block], chunk);
+		} else {
+			kernels->unpack16(dst, hi + offset, scale[block], chunk);
+		}
+		offset += chunk;
+		dst += chunk;
+		n -= chunk;
+	}
+}
+
+#endif
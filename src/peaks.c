@@ -0,0 +1,186 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peaks.h"
+
+// Bytes of a remus:Peaks event around its bins: event and object headers,
+// level and first properties, the data key and chunk header, and padding
+#define PEAK_MESSAGE_OVERHEAD 112
+
+RemusPeaks*
+remus_peaks_new(uint32_t capacity)
+{
+	uint32_t n_bins = 0;
+	for (uint32_t l = 0; l < REMUS_PEAK_LEVELS; l++) {
+		n_bins += remus_peak_bins(capacity, l);
+	}
+
+	RemusPeaks* self = (RemusPeaks*)calloc(1, sizeof(RemusPeaks) + n_bins * sizeof(RemusPeak));
+	if (!self) {
+		return NULL;
+	}
+	self->capacity = capacity;
+
+	RemusPeak* bins = (RemusPeak*)(self + 1);
+	for (uint32_t l = 0; l < REMUS_PEAK_LEVELS; l++) {
+		self->n_bins[l] = remus_peak_bins(capacity, l);
+		self->bins[l] = bins;
+		bins += self->n_bins[l];
+	}
+	return self;
+}
+
+void
+remus_peaks_free(RemusPeaks* self)
+{
+	free(self);
+}
+
+/* A sample in 1/127 of full scale, rounded away from the other bound */
+static inline int8_t
+quantize(float value, bool up)
+{
+	const float scaled = value * 127.0f;
+	const float rounded = up ? ceilf(scaled) : floorf(scaled);
+	return (int8_t)((rounded > 127.0f) ? 127.0f : (rounded < -127.0f) ? -127.0f : rounded);
+}
+
+void
+remus_peaks_scan(RemusPeaks* self, uint32_t bin, const float* const* channels, uint32_t n_channels,
+                 uint32_t n)
+{
+	if (bin >= self->n_bins[0] || n == 0) {
+		return;
+	}
+
+	float lo = channels[0][0];
+	float hi = lo;
+	for (uint32_t c = 0; c < n_channels; c++) {
+		const float* samples = channels[c];
+		for (uint32_t i = 0; i < n; i++) {
+			lo = (samples[i] < lo) ? samples[i] : lo;
+			hi = (samples[i] > hi) ? samples[i] : hi;
+		}
+	}
+	self->bins[0][bin].min = quantize(lo, false);
+	self->bins[0][bin].max = quantize(hi, true);
+
+	// Merge the 8 bins below into each bin above
+	for (uint32_t l = 1; l < REMUS_PEAK_LEVELS; l++) {
+		bin >>= REMUS_PEAK_LEVEL_SHIFT;
+		const RemusPeak* below = self->bins[l - 1];
+		const uint32_t   first = bin << REMUS_PEAK_LEVEL_SHIFT;
+		uint32_t         end = first + (1u << REMUS_PEAK_LEVEL_SHIFT);
+		if (end > self->n_bins[l - 1]) {
+			end = self->n_bins[l - 1];
+		}
+
+		RemusPeak merged = below[first];
+		for (uint32_t b = first + 1; b < end; b++) {
+			merged.min = (below[b].min < merged.min) ? below[b].min : merged.min;
+			merged.max = (below[b].max > merged.max) ? below[b].max : merged.max;
+		}
+		self->bins[l][bin] = merged;
+	}
+}
+
+void
+remus_peak_port_init(RemusPeakPort* self, LV2_URID_Map* map)
+{
+	memset(self, 0, sizeof(RemusPeakPort));
+	lv2_atom_forge_init(&self->forge, map);
+	self->Waveform = map->map(map->handle, REMUS_PEAKS_URI "Waveform");
+	self->Peaks = map->map(map->handle, REMUS_PEAKS_URI "Peaks");
+	self->length = map->map(map->handle, REMUS_PEAKS_URI "length");
+	self->level = map->map(map->handle, REMUS_PEAKS_URI "level");
+	self->first = map->map(map->handle, REMUS_PEAKS_URI "first");
+	self->data = map->map(map->handle, REMUS_PEAKS_URI "data");
+}
+
+void
+remus_peak_port_mark(RemusPeakPort* self, uint32_t first, uint32_t end)
+{
+	if (first >= end) {
+		return;
+	}
+	for (uint32_t l = 0; l < REMUS_PEAK_LEVELS; l++) {
+		const uint32_t shift = l * REMUS_PEAK_LEVEL_SHIFT;
+		const uint32_t level_first = first >> shift;
+		const uint32_t level_end = ((end - 1) >> shift) + 1;
+		if (self->first_bin[l] >= self->end_bin[l]) {
+			self->first_bin[l] = level_first;
+			self->end_bin[l] = level_end;
+		} else {
+			self->first_bin[l] = (level_first < self->first_bin[l]) ? level_first : self->first_bin[l];
+			self->end_bin[l] = (level_end > self->end_bin[l]) ? level_end : self->end_bin[l];
+		}
+	}
+}
+
+/* Append n bins of level from first, returns false if they did not fit */
+static bool
+write_bins(RemusPeakPort* self, const RemusPeaks* peaks, uint32_t level, uint32_t first, uint32_t n)
+{
+	LV2_Atom_Forge*      forge = &self->forge;
+	LV2_Atom_Forge_Frame object;
+	if (!lv2_atom_forge_frame_time(forge, 0) || !lv2_atom_forge_object(forge, &object, 0, self->Peaks)) {
+		return false;
+	}
+	lv2_atom_forge_key(forge, self->level);
+	lv2_atom_forge_int(forge, (int32_t)level);
+	lv2_atom_forge_key(forge, self->first);
+	lv2_atom_forge_int(forge, (int32_t)first);
+	lv2_atom_forge_key(forge, self->data);
+	lv2_atom_forge_atom(forge, n * sizeof(RemusPeak), forge->Chunk);
+	lv2_atom_forge_write(forge, peaks->bins[level] + first, n * sizeof(RemusPeak));
+	lv2_atom_forge_pop(forge, &object);
+	return true;
+}
+
+void
+remus_peak_port_write(RemusPeakPort*     self,
+                      LV2_Atom_Sequence* port,
+                      const RemusPeaks*  peaks,
+                      uint32_t           length)
+{
+	LV2_Atom_Forge*      forge = &self->forge;
+	LV2_Atom_Forge_Frame sequence;
+	lv2_atom_forge_set_buffer(forge, (uint8_t*)port, port->atom.size);
+	lv2_atom_forge_sequence_head(forge, &sequence, 0);
+
+	// A new length restarts the bins, it is sent again next block if it does not fit
+	if (length != self->sent_length) {
+		LV2_Atom_Forge_Frame object;
+		if (lv2_atom_forge_frame_time(forge, 0) && lv2_atom_forge_object(forge, &object, 0, self->Waveform)) {
+			lv2_atom_forge_key(forge, self->length);
+			lv2_atom_forge_long(forge, length);
+			lv2_atom_forge_pop(forge, &object);
+			self->sent_length = length;
+			remus_peak_port_mark(self, 0, remus_peak_bins(length, 0));
+		}
+	}
+
+	// Coarsest level first, a UI has the whole loop before the detail
+	for (uint32_t l = REMUS_PEAK_LEVELS; peaks && l-- > 0;) {
+		uint32_t end = remus_peak_bins(self->sent_length, l);
+		end = (end < peaks->n_bins[l]) ? end : peaks->n_bins[l];
+		end = (end < self->end_bin[l]) ? end : self->end_bin[l];
+		while (self->first_bin[l] < end) {
+			const uint32_t space = forge->size - forge->offset;
+			if (space <= PEAK_MESSAGE_OVERHEAD + sizeof(RemusPeak)) {
+				break;
+			}
+			uint32_t n = (space - PEAK_MESSAGE_OVERHEAD) / sizeof(RemusPeak);
+			n = (n < end - self->first_bin[l]) ? n : end - self->first_bin[l];
+			if (!write_bins(self, peaks, l, self->first_bin[l], n)) {
+				break;
+			}
+			self->first_bin[l] += n;
+		}
+		if (self->first_bin[l] >= end) {
+			self->first_bin[l] = 0;
+			self->end_bin[l] = 0;
+		}
+	}
+	lv2_atom_forge_pop(forge, &sequence);
+}
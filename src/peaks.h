@@ -0,0 +1,99 @@
+#ifndef REMUS_PEAKS_H
+#define REMUS_PEAKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lv2/atom/atom.h"
+#include "lv2/atom/forge.h"
+#include "lv2/urid/urid.h"
+
+#define REMUS_PEAKS_URI        "http://github.com/lbovet/remus#"
+#define REMUS_PEAK_LEVELS      3
+#define REMUS_PEAK_SHIFT       6  // 64 frames per bin at the finest level
+#define REMUS_PEAK_LEVEL_SHIFT 3  // Each level has 8 times fewer bins: 512, then 4096 frames
+#define REMUS_PEAK_FRAMES      (1u << REMUS_PEAK_SHIFT)
+
+/* Lowest and highest sample of a bin over every channel, in 1/127 of full scale */
+typedef struct {
+	int8_t min;
+	int8_t max;
+} RemusPeak;
+
+/*
+ * Min/max pyramid of a loop.
+ *
+ * Bins of the finest level cover REMUS_PEAK_FRAMES frames, those of each
+ * level above merge 8 bins of the level below. The bins of every level are
+ * allocated with the pyramid, by the worker, for the frames of a loop.
+ */
+typedef struct {
+	uint32_t   capacity;  // Frames covered
+	uint32_t   n_bins[REMUS_PEAK_LEVELS];
+	RemusPeak* bins[REMUS_PEAK_LEVELS];
+} RemusPeaks;
+
+/*
+ * Publication of a pyramid on an atom output port.
+ *
+ * A remus:Waveform object gives the loop length whenever it changes, UIs
+ * drop their bins then. remus:Peaks objects carry a run of bins of one
+ * level from remus:first, as min/max byte pairs in a remus:data chunk.
+ * Bins are sent when marked, coarsest level first and as many as fit in
+ * the port, the rest in the next blocks.
+ */
+typedef struct {
+	LV2_Atom_Forge forge;
+	LV2_URID       Waveform;
+	LV2_URID       Peaks;
+	LV2_URID       length;
+	LV2_URID       level;
+	LV2_URID       first;
+	LV2_URID       data;
+
+	uint32_t       sent_length;                // Loop length of the last remus:Waveform
+	uint32_t       first_bin[REMUS_PEAK_LEVELS];  // Bins left to send of each level
+	uint32_t       end_bin[REMUS_PEAK_LEVELS];
+} RemusPeakPort;
+
+/* Bins of level needed for n_frames */
+static inline uint32_t
+remus_peak_bins(uint32_t n_frames, uint32_t level)
+{
+	const uint32_t shift = REMUS_PEAK_SHIFT + level * REMUS_PEAK_LEVEL_SHIFT;
+	return (uint32_t)(((uint64_t)n_frames + (1u << shift) - 1) >> shift);
+}
+
+/* Allocate a pyramid of empty bins for capacity frames, NULL if out of memory (not RT safe) */
+RemusPeaks*
+remus_peaks_new(uint32_t capacity);
+
+void
+remus_peaks_free(RemusPeaks* self);
+
+/*
+ * Set bin of the finest level from the n frames (at most REMUS_PEAK_FRAMES)
+ * of each channel, then the bins above that hold it (RT safe).
+ */
+void
+remus_peaks_scan(RemusPeaks* self, uint32_t bin, const float* const* channels, uint32_t n_channels,
+                 uint32_t n);
+
+void
+remus_peak_port_init(RemusPeakPort* self, LV2_URID_Map* map);
+
+/* Send the bins of the finest level from first to end, and those above holding them */
+void
+remus_peak_port_mark(RemusPeakPort* self, uint32_t first, uint32_t end);
+
+/*
+ * Start the sequence of the port for this block and append what is due: the
+ * length of the loop if it changed, then marked bins of peaks, if any, up
+ * to the port capacity (RT safe).
+ */
+void
+remus_peak_port_write(RemusPeakPort*     self,
+                      LV2_Atom_Sequence* port,
+                      const RemusPeaks*  peaks,
+                      uint32_t           length);
+
+#endif
@@ -0,0 +1,102 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+#define PAGE_ALIGNMENT 64  // Cache line, also enough for any SIMD load
+
+/* Free pages are chained through their first bytes */
+typedef struct FreePage {
+	struct FreePage* next;
+} FreePage;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static FreePage*       pool_free = NULL;
+static uint32_t        pool_n_free = 0;
+static uint32_t        pool_n_users = 0;
+
+/* Free pages to keep for the live instances (pool_lock held) */
+static uint32_t
+free_limit(void)
+{
+	const uint32_t limit = pool_n_users * REMUS_POOL_FREE_PER_USER;
+	return (limit < REMUS_POOL_MAX_FREE) ? limit : REMUS_POOL_MAX_FREE;
+}
+
+void
+remus_pool_ref(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_n_users++;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void
+remus_pool_unref(void)
+{
+	FreePage* trimmed = NULL;
+
+	// Unlink the pages past the new limit, free them outside the lock
+	pthread_mutex_lock(&pool_lock);
+	if (pool_n_users > 0) {
+		pool_n_users--;
+	}
+	while (pool_n_free > free_limit()) {
+		FreePage* page = pool_free;
+		pool_free = page->next;
+		pool_n_free--;
+		page->next = trimmed;
+		trimmed = page;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	while (trimmed) {
+		FreePage* next = trimmed->next;
+		free(trimmed);
+		trimmed = next;
+	}
+}
+
+float*
+remus_pool_acquire(void)
+{
+	float* page = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_free) {
+		page = (float*)pool_free;
+		pool_free = pool_free->next;
+		pool_n_free--;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (!page) {
+		if (posix_memalign((void**)&page, PAGE_ALIGNMENT,
+		                   REMUS_PAGE_FRAMES * sizeof(float))) {
+			return NULL;
+		}
+	}
+
+	memset(page, 0, REMUS_PAGE_FRAMES * sizeof(float));
+	return page;
+}
+
+void
+remus_pool_release(float* page)
+{
+	if (!page) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_n_free < free_limit()) {
+		FreePage* free_page = (FreePage*)page;
+		free_page->next = pool_free;
+		pool_free = free_page;
+		pool_n_free++;
+		page = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	free(page);
+}
@@ -0,0 +1,51 @@
+#ifndef REMUS_POOL_H
+#define REMUS_POOL_H
+
+#include <stdint.h>
+
+#define REMUS_PAGE_SHIFT  12
+#define REMUS_PAGE_FRAMES (1u << REMUS_PAGE_SHIFT)  // 4096 samples (16 KiB) per page
+#define REMUS_PAGE_MASK   (REMUS_PAGE_FRAMES - 1)
+
+#define REMUS_POOL_MAX_FREE      1024  // Free pages kept for reuse (16 MiB)
+#define REMUS_POOL_FREE_PER_USER 256   // Of which per live instance (4 MiB)
+
+/*
+ * Process-wide pool of fixed-size sample pages.
+ *
+ * Loop buffers are tables of pages drawn from this pool. Released pages are
+ * kept on a free list and handed to the next instance that grows, so resizes
+ * and instance churn rarely go back to the system allocator. The worker
+ * acquires the pages of a table before run() writes to them.
+ *
+ * Every instance holds a reference to the pool. The free list is bounded by
+ * the number of live instances, so the memory in use follows the audio
+ * actually recorded, and the last instance to go frees it entirely. The pool
+ * takes a mutex: call it from instantiate/cleanup, state or worker context,
+ * never from run().
+ */
+
+/* Number of pages needed to hold frames samples */
+static inline uint32_t
+remus_pages_for(uint32_t frames)
+{
+	return (frames + REMUS_PAGE_MASK) >> REMUS_PAGE_SHIFT;
+}
+
+/* Take a reference to the pool, from instantiate() */
+void
+remus_pool_ref(void);
+
+/* Drop a reference, after releasing all pages, and trim the free list */
+void
+remus_pool_unref(void);
+
+/* Get a zero-filled page, or NULL if out of memory */
+float*
+remus_pool_acquire(void);
+
+/* Return a page to the pool */
+void
+remus_pool_release(float* page);
+
+#endif
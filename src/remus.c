@@ -10,13 +10,59 @@
 #include "lv2/atom/util.h"
 #include "lv2/time/time.h"
 #include "lv2/state/state.h"
+#include "lv2/worker/worker.h"
+#include "lv2/log/log.h"
+#include "lv2/patch/patch.h"
+#include "lv2/options/options.h"
+#include "lv2/buf-size/buf-size.h"
+#include <stdatomic.h>
+#include <sched.h>
+#include "disk.h"
+#include "dsp.h"
+#include "file.h"
+#include "kernels.h"
+#include "log.h"
+#include "pack.h"
+#include "peaks.h"
+#include "pool.h"
+#include "resample.h"
+#include "stats.h"
 
 #define REMUS_URI "http://github.com/lbovet/remus"
+#define REMUS_STEREO_URI REMUS_URI "#stereo"
+#define REMUS_QUAD_URI REMUS_URI "#quad"
+
+#define REMUS_MAX_CHANNELS 4  // Channels of the widest variant
+#define REMUS_MAX_SLOTS 8     // Loop slots of an instance
 
 #define MAX_BUFFER_SIZE 48000 * 60 * 5  // 5 minutes at 48kHz
+#define DISK_BUFFER_SIZE 48000 * 60 * 60  // 1 hour at 48kHz, for loops on disk
+#define DISK_HEAD_PAGES 4    // Loop start pages kept in memory, playback restarts there
+#define DISK_AHEAD_PAGES 16  // Disk pages kept in memory from the play and record positions
 #define TAIL_BUFFER_SIZE 1024  // Maximum tail buffer size for zero-crossing alignment
 #define ZERO_CROSSING_DISTANCE 8  // Maximum distance for zero-crossing matching
+#define HEAD_INDEX_SIZE (TAIL_BUFFER_SIZE + ZERO_CROSSING_DISTANCE)  // Loop start samples indexed for crossings
+#define TAIL_CAPACITY REMUS_PAGE_FRAMES  // Tail samples kept, also bounds the correlation search
 #define CROSSFADE_SAMPLES 64  // Number of samples for crossfade transition
+#define PHASE_ONE ((uint64_t)1 << 32)  // One frame in the 32.32 fixed point of the bar phase
+#define PHASE_DRIFT (PHASE_ONE / 4)  // Host bar positions closer than this are rounding, not drift
+#define PHASE_JUMP (64 * PHASE_ONE)  // Host bar positions further than this are a relocation
+#define RESAMPLE_CHUNK 128    // Output samples resampled from one read of the loop
+#define RESAMPLE_MAX_RATIO 4  // Bounds of the tempo ratio, and of the loop read per output sample
+#define RESAMPLE_SPAN (RESAMPLE_CHUNK * RESAMPLE_MAX_RATIO + REMUS_RESAMPLE_MAX_TAPS)
+#define CAPTURE_MARGIN_BARS 2  // Bars the capture ring holds past the loop length, one for the worker
+#define UNDO_DEPTH 4           // Takes, overdubs and clears of each slot that can be undone
+#define UNDO_RESERVE_PAGES 16  // Fresh pages per channel kept for copy-on-write, refilled by the worker
+#define UNDO_MAX_PAGES ((MAX_BUFFER_SIZE + REMUS_PAGE_FRAMES - 1) / REMUS_PAGE_FRAMES)  // Per channel, loops with a history
+
+// The worker stitches the tail into a copy of the first loop page only
+#if TAIL_BUFFER_SIZE > TAIL_CAPACITY || TAIL_CAPACITY > REMUS_PAGE_FRAMES || HEAD_INDEX_SIZE > REMUS_PAGE_FRAMES
+#error "The tail and the loop start index must fit in a loop page"
+#endif
+
+#if (1 << ((REMUS_RESAMPLE_BANDS - 1) / REMUS_RESAMPLE_BAND_STEPS)) < RESAMPLE_MAX_RATIO
+#error "The resampling filters need a band for every tempo ratio"
+#endif
 
 typedef enum {
 	REMUS_AUDIO_IN      = 0,
@@ -27,13 +73,253 @@ typedef enum {
 	REMUS_PERSIST_EN    = 5,
 	REMUS_ARMED_OUT     = 6,
 	REMUS_RECORDING_OUT = 7,
-	REMUS_RECORDED_OUT  = 8
+	REMUS_RECORDED_OUT  = 8,
+	REMUS_STITCH_SEARCH = 9,
+	REMUS_SLOT          = 10,
+	REMUS_OVERDUB       = 11,
+	REMUS_LONG_LOOP     = 12,
+	REMUS_STORAGE       = 13,
+	REMUS_FOLLOW        = 14,
+	REMUS_CAPTURE_RING  = 15,
+	REMUS_CAPTURE       = 16,
+	REMUS_STATS         = 17,
+	REMUS_FREEWHEEL     = 18,
+	REMUS_PEAKS         = 19,
+	REMUS_EXTRA_AUDIO   = 20  // Input then output of each channel after the first
 } PortIndex;
 
+typedef enum {
+	REMUS_WORK_RESIZE,  // Build a table of n_pages, reusing the first pages of table
+	REMUS_WORK_FREE,    // Release a retired table and its pages from index first, head, pack and restored
+	REMUS_WORK_STITCH,  // Crossfade the tail into copies of head, the first loop page of each channel
+	REMUS_WORK_WINDOW,  // Keep the disk pages of table around cursor in memory
+	REMUS_WORK_PACK,    // Pack the n_pages of table to a compact format
+	REMUS_WORK_UNPACK,  // Unpack pack back to a table of float pages
+	REMUS_WORK_RING,    // Build a capture ring of n_pages, reusing the first pages of table
+	REMUS_WORK_CAPTURE, // Copy length frames of the capture ring table from ring_start to a new loop
+	REMUS_WORK_PEAKS,   // Build peaks for n_pages, of the first length frames of table or pack
+	REMUS_WORK_HISTORY, // Acquire n_pages pages for the undo reserve, and a spare layer if asked
+	REMUS_WORK_LOG      // Drain the diagnostics ring
+} RemusWorkType;
+
+/* Diagnostics queued by the audio thread, formatted by the worker */
+typedef enum {
+	LOG_RUN_RESTORED,
+	LOG_TRANSPORT_STOPPED,
+	LOG_TRANSPORT_STARTED,
+	LOG_TAIL_STOPPED,
+	LOG_LOOP_FILLED,
+	LOG_STITCH_MATCH_RISING,
+	LOG_STITCH_MATCH_FALLING,
+	LOG_STITCH_COLLECTING,
+	LOG_STITCH_COLLECTED,
+	LOG_TAIL_FULL,
+	LOG_UNALIGNED_DISTANCE,
+	LOG_UNALIGNED,
+	LOG_CROSSFADE_APPLIED,
+	LOG_STITCH_FAILED,
+	LOG_RESIZE_FAILED,
+	LOG_SLOT_SWITCHED,
+	LOG_OVERDUB_STARTED,
+	LOG_OVERDUB_STOPPED,
+	LOG_PACKED,
+	LOG_UNPACKED,
+	LOG_PACK_FAILED,
+	LOG_RING_FAILED,
+	LOG_CAPTURED,
+	LOG_CAPTURE_BUSY,
+	LOG_CAPTURE_MISSED,
+	LOG_CAPTURE_LATE,
+	LOG_CAPTURE_FAILED,
+	LOG_CLEARED,
+	LOG_PEAKS_FAILED,
+	LOG_UNDONE,
+	LOG_REDONE,
+	LOG_HISTORY_LOST,
+	LOG_HISTORY_FAILED,
+	N_LOG_MESSAGES
+} RemusLogCode;
+
+static const RemusLogMessage log_messages[N_LOG_MESSAGES] = {
+	[LOG_RUN_RESTORED] = { REMUS_LOG_TRACE,
+		"REMUS: In run() - has_recorded=%lld, loop_samples=%lld, recording=%lld, waiting_for_bar=%lld\n" },
+	[LOG_TRANSPORT_STOPPED] = { REMUS_LOG_NOTE,
+		"REMUS: Transport stopped, PLAYING -> IDLE\n" },
+	[LOG_TRANSPORT_STARTED] = { REMUS_LOG_NOTE,
+		"REMUS: Transport started -> IDLE\n" },
+	[LOG_TAIL_STOPPED] = { REMUS_LOG_TRACE,
+		"REMUS: Tail recording stopped manually\n" },
+	[LOG_LOOP_FILLED] = { REMUS_LOG_TRACE,
+		"REMUS: Loop filled (%lld samples), starting tail recording\n" },
+	[LOG_STITCH_MATCH_RISING] = { REMUS_LOG_TRACE,
+		"REMUS: Found zero-crossing match - tail[%lld] and loop[%lld], distance=%lld samples, slope=positive, midpoint=%lld\n" },
+	[LOG_STITCH_MATCH_FALLING] = { REMUS_LOG_TRACE,
+		"REMUS: Found zero-crossing match - tail[%lld] and loop[%lld], distance=%lld samples, slope=negative, midpoint=%lld\n" },
+	[LOG_STITCH_COLLECTING] = { REMUS_LOG_TRACE,
+		"REMUS: Continuing tail recording to collect crossfade samples (need %lld more samples)\n" },
+	[LOG_STITCH_COLLECTED] = { REMUS_LOG_TRACE,
+		"REMUS: Collected enough samples for crossfade (%lld samples)\n" },
+	[LOG_TAIL_FULL] = { REMUS_LOG_TRACE,
+		"REMUS: Tail buffer full - will use position %lld (no zero-crossing match)\n" },
+	[LOG_UNALIGNED_DISTANCE] = { REMUS_LOG_TRACE,
+		"REMUS: Finishing without zero-crossing alignment. "
+		"Considered %lld zero-crossings, minimal distance found: %lld samples\n" },
+	[LOG_UNALIGNED] = { REMUS_LOG_TRACE,
+		"REMUS: Finishing without zero-crossing alignment. "
+		"Considered %lld zero-crossings, no matching crossings found in loop\n" },
+	[LOG_CROSSFADE_APPLIED] = { REMUS_LOG_TRACE,
+		"REMUS: Applied %lld-sample crossfade around position %lld for click-free transition\n" },
+	[LOG_STITCH_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory stitching the loop, playing it without crossfade\n" },
+	[LOG_RESIZE_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory growing the loop buffer to %lld pages\n" },
+	[LOG_SLOT_SWITCHED] = { REMUS_LOG_NOTE,
+		"REMUS: Switched to loop slot %lld (%lld samples recorded)\n" },
+	[LOG_OVERDUB_STARTED] = { REMUS_LOG_TRACE,
+		"REMUS: Overdubbing loop slot %lld\n" },
+	[LOG_OVERDUB_STOPPED] = { REMUS_LOG_TRACE,
+		"REMUS: Overdub of loop slot %lld stopped\n" },
+	[LOG_PACKED] = { REMUS_LOG_TRACE,
+		"REMUS: Packed loop slot %lld to %lld-bit samples\n" },
+	[LOG_UNPACKED] = { REMUS_LOG_TRACE,
+		"REMUS: Unpacked loop slot %lld\n" },
+	[LOG_PACK_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory packing or unpacking loop slot %lld\n" },
+	[LOG_RING_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory growing the capture ring to %lld pages\n" },
+	[LOG_CAPTURED] = { REMUS_LOG_NOTE,
+		"REMUS: Captured the last %lld samples into loop slot %lld\n" },
+	[LOG_CAPTURE_BUSY] = { REMUS_LOG_NOTE,
+		"REMUS: Capture ignored during a take or a loop change\n" },
+	[LOG_CAPTURE_MISSED] = { REMUS_LOG_NOTE,
+		"REMUS: Capture ignored, the ring holds %lld of the %lld samples to capture\n" },
+	[LOG_CAPTURE_LATE] = { REMUS_LOG_ERROR,
+		"REMUS: Capture dropped, the ring was overwritten before it was copied\n" },
+	[LOG_CAPTURE_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory capturing %lld samples\n" },
+	[LOG_CLEARED] = { REMUS_LOG_NOTE,
+		"REMUS: Cleared loop slot %lld\n" },
+	[LOG_PEAKS_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory building the peaks of %lld pages\n" },
+	[LOG_UNDONE] = { REMUS_LOG_NOTE,
+		"REMUS: Undid an edit of loop slot %lld, %lld pages swapped back\n" },
+	[LOG_REDONE] = { REMUS_LOG_NOTE,
+		"REMUS: Redid an edit of loop slot %lld, %lld pages swapped back\n" },
+	[LOG_HISTORY_LOST] = { REMUS_LOG_ERROR,
+		"REMUS: Dropped the undo history of loop slot %lld, no fresh page was ready\n" },
+	[LOG_HISTORY_FAILED] = { REMUS_LOG_ERROR,
+		"REMUS: Out of memory keeping the undo history\n" },
+};
+
+/* Fields of a time:Position, each set only if its has_ flag is */
+typedef struct {
+	int64_t frame;
+	float   bar_beat;
+	float   bpm;
+	float   beats_per_bar;
+	float   speed;
+	bool    has_frame;
+	bool    has_bar;
+	bool    has_bar_beat;
+	bool    has_bpm;
+	bool    has_beats_per_bar;
+	bool    has_speed;
+} RemusPosition;
+
+/*
+ * Edit of the loop buffer that can be undone, see Remus.undo. It keeps the
+ * loop pages the edit replaced, n_channels of them per entry of index, and
+ * the loop on its other side. Swapping it puts them back in the table and
+ * keeps the pages they replace instead, so the same swap undoes and redoes.
+ */
+typedef struct RemusLayer {
+	struct RemusLayer* next;    // Layer below on its stack, or next in a chain to free
+	uint32_t n_replaced;        // Loop pages replaced
+	uint32_t end;               // Past the last loop page replaced
+	uint32_t recorded_samples;  // Loop on the other side of the layer
+	float    take_bpm;
+	bool     has_recorded;
+	bool     copy_on_write;     // Pages are replaced before they are written, not over an empty history
+	bool     overdub;           // Opened by an overdub, closed when it stops
+	uint32_t index[UNDO_MAX_PAGES];
+	float*   pages[];
+} RemusLayer;
+
+/* Worker message, used both for requests and responses */
+typedef struct {
+	RemusWorkType type;
+	float**       table;
+	uint32_t      n_pages;
+	uint32_t      first;
+	float*        head[REMUS_MAX_CHANNELS];  // Stitch: first loop pages, then their stitched copies
+	const float*  tail;             // Stitch: recorded tail of each channel, TAIL_CAPACITY apart
+	const float*  search;           // Stitch: tail mixed down for the correlation search
+	uint32_t      stitch_position;  // Stitch: crossfade center, Capture: set to fade the loop start in
+	uint32_t      window;           // Stitch: correlation search window, 0 if the center is set
+	uint32_t      take;             // Stitch, Capture: take the pages belong to, Pack: edit count of table
+	bool          disk;             // Resize: new pages past the loop start go to disk
+	uint32_t      cursor[2];        // Window: pages of the play and record positions
+	RemusPack*    pack;             // Pack, Unpack: the packed loop
+	RemusPackFormat format;         // Pack: sample format
+	struct RemusRestore* restored;  // Free: loops replaced by a restore
+	uint64_t      ring_start;       // Capture: first frame captured, counted like Remus.ring_pos
+	uint32_t      length;           // Capture: frames captured, the loop length
+	float         tempo;            // Capture: tempo of the captured bars
+	RemusPeaks*   peaks;            // Peaks: the pyramid built, Free: a retired one
+	RemusLayer*   layer;            // History: the spare layer built, Free: a chain of retired layers
+	bool          spare;            // History: build a spare layer
+} RemusWork;
+
+/* FREE job held back by the worker while a save may read what it retires */
+typedef struct RemusDeferred {
+	struct RemusDeferred* next;
+	RemusWork             job;
+} RemusDeferred;
+
+/* Loop slot parked while another one is active, see Remus.slots */
 typedef struct {
+	float**    pages;           // NULL while packed
+	RemusPack* packed;
+	uint32_t   n_pages;
+	uint32_t recorded_samples;
+	bool     has_recorded;
+	float    take_bpm;
+	RemusLayer* undo;           // Undo history, see Remus.undo
+	RemusLayer* redo;
+	uint32_t n_undo;
+	uint32_t n_redo;
+} RemusSlot;
+
+/*
+ * Loops read by restore(), which may run while run() plays. They are staged
+ * here and published in Remus.staged, run() swaps them in at the start of a
+ * block and hands back the loops they replace in the same structure.
+ */
+typedef struct RemusRestore {
+	RemusSlot slots[REMUS_MAX_SLOTS];  // The active slot holds the loop buffer
+	uint32_t  active_slot;
+	bool      disk_used;               // Some loop was loaded to disk pages
+} RemusRestore;
+
+/* Loop as save() found it, n_samples is 0 when there is nothing to save */
+typedef struct {
+	float* const*    pages;
+	const RemusPack* packed;
+	uint32_t         n_samples;
+	float            take_bpm;
+} RemusSavedLoop;
+
+/* Loops of an instance copied by save() while the audio thread was out */
+typedef struct {
+	uint32_t       active_slot;
+	RemusSavedLoop active;
+	RemusSavedLoop slots[REMUS_MAX_SLOTS];
+} RemusSaved;
+
+typedef struct Remus {
 	// Port buffers
-	const float*      audio_in;
-	float*            audio_out;
+	const float*      audio_in[REMUS_MAX_CHANNELS];
+	float*            audio_out[REMUS_MAX_CHANNELS];
 	const LV2_Atom_Sequence* time;
 	const float*      record_enable;
 	const float*      loop_length;
@@ -41,9 +327,39 @@ typedef struct {
 	float*            recording_status;
 	float*            armed_status;
 	float*            recorded_status;
+	const float*      stitch_search;
+	const float*      slot;
+	const float*      overdub;
+	const float*      long_loop;
+	const float*      storage;
+	const float*      follow;
+	const float*      capture_ring;
+	const float*      capture;
+	LV2_Atom_Sequence* stats_port;
+	const float*      freewheel;
+	LV2_Atom_Sequence* peaks_port;
 	
-	// URID map
+	// Features
 	LV2_URID_Map* map;
+	LV2_Worker_Schedule* schedule;
+	LV2_Log_Log* log_feature;
+	
+	// Diagnostics
+	RemusLog log;
+	RemusStats stats;           // Reported on the stats port when it is connected
+	
+	// Waveform of the loop buffer, for the peaks port when it is connected.
+	// Takes and overdubs rescan the bins they write, the worker rebuilds the
+	// pyramid when the loop changes as a whole, or grows it for a longer take
+	RemusPeaks*   peaks;
+	RemusPeakPort peak_port;
+	uint32_t      peaks_length;   // Frames the pyramid was built from
+	bool          peaks_dirty;    // The loop changed since, the worker rebuilds it once idle
+	bool          peaks_pending;  // Peaks job in flight
+	bool          peaks_failed;   // Out of memory, retried at the next bar
+	
+	// Kernels of the widest instruction set of the CPU
+	const RemusKernels* kernels;
 	
 	// URIDs
 	LV2_URID atom_Blank;
@@ -51,24 +367,145 @@ typedef struct {
 	LV2_URID atom_Float;
 	LV2_URID atom_Long;
 	LV2_URID atom_Int;
+	LV2_URID atom_URID;
+	LV2_URID atom_Path;
 	LV2_URID time_Position;
+	LV2_URID time_frame;
 	LV2_URID time_barBeat;
 	LV2_URID time_bar;
 	LV2_URID time_speed;
 	LV2_URID time_beatsPerMinute;
 	LV2_URID time_beatsPerBar;
+	LV2_URID patch_Set;
+	LV2_URID patch_property;
+	LV2_URID patch_value;
 	
 	// State URIDs
 	LV2_URID remus_buffer;
 	LV2_URID remus_loop_samples;
 	LV2_URID remus_has_recorded;
+	LV2_URID remus_slot;                          // Active slot, also a patch:Set property
+	LV2_URID remus_slot_buffer[REMUS_MAX_SLOTS];  // Loops of the parked slots
+	LV2_URID remus_tempo;                         // Tempo of the active loop
+	LV2_URID remus_slot_tempo[REMUS_MAX_SLOTS];   // Tempo of the parked loops
+	
+	// Command URIDs: a remus:Command names its remus:action, select also a remus:slot
+	LV2_URID remus_Command;
+	LV2_URID remus_action;
+	LV2_URID remus_arm;
+	LV2_URID remus_stop;
+	LV2_URID remus_clear;
+	LV2_URID remus_overdub;
+	LV2_URID remus_select;
+	LV2_URID remus_undo;
+	LV2_URID remus_redo;
+	
+	// Variant, the sample processing is specialized for its channel count
+	uint32_t n_channels;
+	void     (*process)(struct Remus* self, uint32_t offset, uint32_t n_samples);
+	
+	// Loop buffer: table of pool or disk pages, fitted to the loop by the worker.
+	// Channels are planar, page p of channel c is entry p * n_channels + c
+	float**  pages;
+	uint32_t n_pages;           // Pages per channel
+	uint32_t buffer_size;       // Capacity in samples
+	uint32_t recorded_samples;  // Length of the recorded take, kept across resizes
+	bool     resize_pending;
+	uint32_t resize_failed;     // Page count of the last failed resize, 0 if none
+	
+	// Idle loops are packed by the worker in the format of the storage port:
+	// pages is then NULL and run() plays the packed loop, until the worker
+	// unpacks it for a take, an overdub or a larger buffer
+	RemusPack* packed;
+	bool     pack_pending;
+	bool     unpack_pending;
+	bool     pack_failed;       // Out of memory, retried at the next bar
+	bool     resize_blocked;    // The buffer must grow but is packed
+	uint32_t edits;             // Takes and overdubs started, packs of older edits are stale
+	
+	// Loop slots: the active slot is the loop buffer above, the others keep
+	// their page tables here. Switching swaps tables at a bar start.
+	RemusSlot slots[REMUS_MAX_SLOTS];
+	uint32_t  active_slot;
+	uint32_t  next_slot;        // Requested by the slot port or a patch:Set
+	float     prev_slot;        // Last slot port value, requests are its changes
+	bool      overdubbing;      // Input is mixed into the playing loop
+	bool      overdub_latched;  // Overdub toggled on by commands, as if the overdub port were on
+	
+	// Undo history of the active slot. Arming a take, an overdub or a clear
+	// pushes a layer. The first write of a take or an overdub to a loop page
+	// swaps in a page of the reserve, a copy of it for an overdub, and keeps
+	// the page replaced in the layer. Undo and redo swap the pages of layers
+	// back at a bar start. The worker keeps the reserve full and a spare
+	// layer ready, and frees the layers dropped. Loops on disk keep none
+	RemusLayer* undo;           // Layers that can be undone, the latest first
+	RemusLayer* redo;           // Layers undone, the latest first
+	RemusLayer* layer;          // Layer of the take or overdub in progress, on top of undo
+	RemusLayer* spare;          // Empty layer for the next edit
+	RemusLayer* retired_layers; // Dropped layers not yet handed to the worker
+	uint32_t  n_undo;
+	uint32_t  n_redo;
+	int32_t   undo_steps;       // Asked for the next bar start: undo if negative, redo if positive
+	uint64_t  replaced[UNDO_MAX_PAGES / 64 + 1];  // Loop pages the open layer replaced
+	float*    reserve[UNDO_RESERVE_PAGES * REMUS_MAX_CHANNELS];
+	uint32_t  n_reserve;
+	float*    reserve_fill[UNDO_RESERVE_PAGES * REMUS_MAX_CHANNELS];  // Worker: pages for the reserve
+	bool      history_pending;  // History job in flight
+	bool      history_failed;   // Out of memory, retried at the next bar
+	
+	// Long loops: pages past the loop start come from a file on disk, the
+	// worker keeps a window of them in memory around the play and record
+	// positions so run() does not wait for the disk
+	RemusDisk disk;
+	RemusFiles files;           // Loop files mapped by restore()
+	bool      disk_used;        // A table with disk pages was swapped in
+	bool      window_pending;   // Window job in flight
+	bool      window_dirty;     // The table changed since the last window
+	uint32_t  window_cursor[2]; // Cursors of the last window job
+	float*    window[2 * DISK_AHEAD_PAGES * REMUS_MAX_CHANNELS];  // Worker: pages held
+	uint32_t  n_window;
+	bool      window_unlocked;  // Worker: the memory lock limit was hit
+	
+	// Restored loops: restore() publishes them, run() takes them when no
+	// resize is in flight and retires the loops they replace to the worker
+	_Atomic(RemusRestore*) staged;
+	RemusRestore* retired;      // Replaced loops not yet handed to the worker
+	
+	// Saves may run beside run() and work(): save() copies the loops while
+	// the audio thread is out of the plugin, and the worker holds back the
+	// memory retired while a save is in progress, so what it copied stays
+	atomic_uint    audio_gen;   // Odd while run() or work_response() runs
+	atomic_uint    n_saving;    // save() calls in progress
+	RemusDeferred* deferred;    // Worker: FREE jobs held back for a save
+	
+	// Tempo following: loops keep the tempo of their take, and are resampled
+	// to the transport tempo with the filter of the quality on the follow port
+	// and of the band of the tempo ratio
+	const RemusFilter* filters[REMUS_FOLLOW_QUALITIES][REMUS_RESAMPLE_BANDS];  // Shared
+	float    take_bpm;          // Tempo the loop was recorded at, 0 if unknown
+	uint64_t read_step;         // Loop samples per output sample in 32.32, 0 when not resampling
+	uint32_t read_band;         // Filter band of read_step
+	uint32_t read_frac;         // Fraction of read_pos, in 32 bits
+	float    resample_in[RESAMPLE_SPAN];  // Loop samples read for a resampled chunk
+	
+	// Capture ring: while the capture ring port is on, the input is copied
+	// here as the transport rolls, and the capture port turns the last bars
+	// into the loop at once, through the worker. Frames are counted since the
+	// ring was first written, frame f is at f modulo the ring capacity
+	float**  ring;              // Table of pool pages, planar like pages
+	uint32_t ring_pages;        // Pages per channel
+	uint64_t ring_pos;          // Frames written
+	uint64_t ring_valid;        // First frame written since the ring was last resized or restarted
+	uint64_t ring_bar;          // Frame of the last bar start
+	bool     ring_pending;      // Ring job in flight
+	uint32_t ring_failed;       // Page count of the last failed ring, 0 if none
+	bool     capture_pending;   // Capture job in flight
+	float    prev_capture;      // Last capture port value, captures are its rising edges
 	
 	// Internal state
-	float*   buffer;
-	uint32_t buffer_size;
 	uint32_t write_pos;
 	uint32_t read_pos;
-	uint32_t loop_samples;
+	uint32_t loop_samples;      // In samples at the loop tempo
 	
 	bool     recording;
 	bool     has_recorded;
@@ -78,27 +515,56 @@ typedef struct {
 	float    prev_record_enable;
 	
 	// Tail buffer for zero-crossing alignment (max TAIL_BUFFER_SIZE samples)
-	float    tail_buffer[TAIL_BUFFER_SIZE];
+	// or for the correlation search (stitch_window + CROSSFADE_SAMPLES / 2).
+	// All channels share one stitch, searched on their mix
+	float    tail_buffer[REMUS_MAX_CHANNELS][TAIL_CAPACITY];
+	float    tail_mix[TAIL_CAPACITY];
+	float*   tail_search;      // Mix of the tail, the tail itself for mono
+	float    head_mix[HEAD_INDEX_SIZE];
+	uint32_t stitch_window;    // Correlation search window of the take, 0 for zero-crossings
+	uint64_t head_rising[HEAD_INDEX_SIZE / 64 + 2];   // Crossings of the loop start, bit per sample
+	uint64_t head_falling[HEAD_INDEX_SIZE / 64 + 2];
 	uint32_t tail_pos;
 	bool     recording_tail;
 	uint32_t tail_zero_crossings;
 	int32_t  tail_min_distance;
 	uint32_t stitch_position;  // Position for crossfade, 0 means not set
 	
+	// The worker stitches a copy of the first loop page, swapped in by work_response
+	bool     stitch_pending;    // Tail complete, the loop waits for its stitched page
+	bool     stitch_scheduled;  // Stitch job in flight, excludes resizes
+	uint32_t take;              // Counts takes, stitches of an older take are dropped
+	
 	double   sample_rate;
  	int64_t transport_frame;      /* Current frame position from host */
-    int64_t bar_start_frame;      /* Frame position of the most recent bar start */
 	bool transport_rolling;
     bool transport_just_stopped;
+	
+	// Bar phase: frames since the last bar start, in 32.32 fixed point. It is
+	// advanced by the frames processed while the transport rolls, and taken
+	// from the host on a tempo or meter change, a relocation, or drift
+	uint64_t bar_phase;
+	uint64_t bar_frames;        // Frames per bar in 32.32, 0 without a valid tempo and meter
+	bool     bar_synced;        // The phase follows a host position since the transport started
  	
 	// Transport tempo/time signature
 	float    bpm;
 	float    beats_per_bar;
 	
+	// Freewheeling, the host renders offline as fast as it can: positions
+	// that only confirm the transport are skipped, diagnostics are batched
+	bool     freewheeling;
+	uint32_t max_block;         // Frames per run() from the buf-size options, 0 if unknown
+	
 	// Debug flag
 	bool     debug_logged;
 } Remus;
 
+static void process_mono(Remus* self, uint32_t offset, uint32_t n_samples);
+static void process_stereo(Remus* self, uint32_t offset, uint32_t n_samples);
+static void process_multi(Remus* self, uint32_t offset, uint32_t n_samples);
+static uint64_t bar_length(const Remus* self);
+
 static LV2_Handle
 instantiate(const LV2_Descriptor*     descriptor,
             double                    rate,
@@ -110,14 +576,25 @@ instantiate(const LV2_Descriptor*     descriptor,
 		return NULL;
 	}
 	
-	// Get URID map feature
+	// Get URID map, worker, log and options features
+	const LV2_Options_Option* options = NULL;
 	for (int i = 0; features[i]; i++) {
 		if (!strcmp(features[i]->URI, LV2_URID__map)) {
 			remus->map = (LV2_URID_Map*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+			remus->schedule = (LV2_Worker_Schedule*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_LOG__log)) {
+			remus->log_feature = (LV2_Log_Log*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_OPTIONS__options)) {
+			options = (const LV2_Options_Option*)features[i]->data;
 		}
 	}
 	
-	if (!remus->map) {
+	remus_log_init(&remus->log, remus->log_feature, remus->map, log_messages, N_LOG_MESSAGES);
+	
+	if (!remus->map || !remus->schedule) {
+		REMUS_ERROR(&remus->log, "REMUS: Missing required feature %s\n",
+		            remus->map ? LV2_WORKER__schedule : LV2_URID__map);
 		free(remus);
 		return NULL;
 	}
@@ -128,27 +605,105 @@ instantiate(const LV2_Descriptor*     descriptor,
 	remus->atom_Float = remus->map->map(remus->map->handle, LV2_ATOM__Float);
 	remus->atom_Long = remus->map->map(remus->map->handle, LV2_ATOM__Long);
 	remus->atom_Int = remus->map->map(remus->map->handle, LV2_ATOM__Int);
+	remus->atom_URID = remus->map->map(remus->map->handle, LV2_ATOM__URID);
+	remus->atom_Path = remus->map->map(remus->map->handle, LV2_ATOM__Path);
 	remus->time_Position = remus->map->map(remus->map->handle, LV2_TIME__Position);
+	remus->time_frame = remus->map->map(remus->map->handle, LV2_TIME__frame);
 	remus->time_barBeat = remus->map->map(remus->map->handle, LV2_TIME__barBeat);
 	remus->time_bar = remus->map->map(remus->map->handle, LV2_TIME__bar);
 	remus->time_speed = remus->map->map(remus->map->handle, LV2_TIME__speed);
 	remus->time_beatsPerMinute = remus->map->map(remus->map->handle, LV2_TIME__beatsPerMinute);
 	remus->time_beatsPerBar = remus->map->map(remus->map->handle, LV2_TIME__beatsPerBar);
+	remus->patch_Set = remus->map->map(remus->map->handle, LV2_PATCH__Set);
+	remus->patch_property = remus->map->map(remus->map->handle, LV2_PATCH__property);
+	remus->patch_value = remus->map->map(remus->map->handle, LV2_PATCH__value);
 	
 	// Map state URIDs
 	remus->remus_buffer = remus->map->map(remus->map->handle, REMUS_URI "#buffer");
 	remus->remus_loop_samples = remus->map->map(remus->map->handle, REMUS_URI "#loop_samples");
 	remus->remus_has_recorded = remus->map->map(remus->map->handle, REMUS_URI "#has_recorded");
+	remus->remus_slot = remus->map->map(remus->map->handle, REMUS_URI "#slot");
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		char key[64];
+		snprintf(key, sizeof(key), REMUS_URI "#slot%u", s);
+		remus->remus_slot_buffer[s] = remus->map->map(remus->map->handle, key);
+		snprintf(key, sizeof(key), REMUS_URI "#slot%uTempo", s);
+		remus->remus_slot_tempo[s] = remus->map->map(remus->map->handle, key);
+	}
+	remus->remus_tempo = remus->map->map(remus->map->handle, REMUS_URI "#tempo");
 	
-	remus->sample_rate = rate;
-	remus->buffer_size = MAX_BUFFER_SIZE;
-	remus->buffer = (float*)calloc(remus->buffer_size, sizeof(float));
+	// Map command URIDs
+	remus->remus_Command = remus->map->map(remus->map->handle, REMUS_URI "#Command");
+	remus->remus_action = remus->map->map(remus->map->handle, REMUS_URI "#action");
+	remus->remus_arm = remus->map->map(remus->map->handle, REMUS_URI "#arm");
+	remus->remus_stop = remus->map->map(remus->map->handle, REMUS_URI "#stop");
+	remus->remus_clear = remus->map->map(remus->map->handle, REMUS_URI "#clear");
+	remus->remus_overdub = remus->map->map(remus->map->handle, REMUS_URI "#overdub");
+	remus->remus_select = remus->map->map(remus->map->handle, REMUS_URI "#select");
+	remus->remus_undo = remus->map->map(remus->map->handle, REMUS_URI "#undo");
+	remus->remus_redo = remus->map->map(remus->map->handle, REMUS_URI "#redo");
+	
+	// Largest block the host will run, freewheeling hosts use very large ones
+	if (options) {
+		const LV2_URID max_block = remus->map->map(remus->map->handle, LV2_BUF_SIZE__maxBlockLength);
+		for (const LV2_Options_Option* o = options; o->key; o++) {
+			if (o->key == max_block && o->type == remus->atom_Int && o->size == sizeof(int32_t)
+			    && *(const int32_t*)o->value > 0) {
+				remus->max_block = (uint32_t)*(const int32_t*)o->value;
+			}
+		}
+	}
 	
-	if (!remus->buffer) {
+	// SIMD kernels, REMUS_KERNELS caps the instruction set (e.g. "sse2")
+	remus->kernels = remus_kernels_select(getenv("REMUS_KERNELS"));
+	REMUS_TRACE(&remus->log, "REMUS: Using %s kernels\n", remus->kernels->name);
+	
+	// Resampling filters for tempo following, built once for every instance
+	if (!remus_filters_ref(remus->filters)) {
+		REMUS_ERROR(&remus->log, "REMUS: Out of memory building resampling filters\n");
 		free(remus);
 		return NULL;
 	}
 	
+	remus->sample_rate = rate;
+	remus_stats_init(&remus->stats, remus->map, rate);
+	remus_peak_port_init(&remus->peak_port, remus->map);
+	remus->peaks_dirty = true;
+	
+	// Channel count of the variant
+	remus->n_channels = 1;
+	remus->process = process_mono;
+	if (!strcmp(descriptor->URI, REMUS_STEREO_URI)) {
+		remus->n_channels = 2;
+		remus->process = process_stereo;
+	} else if (!strcmp(descriptor->URI, REMUS_QUAD_URI)) {
+		remus->n_channels = 4;
+		remus->process = process_multi;
+	}
+	remus->tail_search = (remus->n_channels == 1) ? remus->tail_buffer[0] : remus->tail_mix;
+	
+	// The loop buffer starts empty, run() asks the worker to fit it to the loop
+	remus->pages = NULL;
+	remus->n_pages = 0;
+	remus->buffer_size = 0;
+	remus->recorded_samples = 0;
+	remus->resize_pending = false;
+	remus->resize_failed = 0;
+	remus->active_slot = 0;
+	remus->next_slot = 0;
+	remus->prev_slot = -1.0f;
+	remus->overdubbing = false;
+	remus->overdub_latched = false;
+	remus_disk_init(&remus->disk);
+	remus_files_init(&remus->files);
+	remus->disk_used = false;
+	remus->window_pending = false;
+	remus->window_dirty = false;
+	remus->n_window = 0;
+	remus->window_unlocked = false;
+	atomic_init(&remus->staged, NULL);
+	remus->retired = NULL;
+	
 	remus->write_pos = 0;
 	remus->read_pos = 0;
 	remus->recording = false;
@@ -163,14 +718,25 @@ instantiate(const LV2_Descriptor*     descriptor,
 	remus->tail_zero_crossings = 0;
 	remus->tail_min_distance = TAIL_BUFFER_SIZE;
 	remus->stitch_position = 0;
+	remus->stitch_pending = false;
+	remus->stitch_scheduled = false;
+	remus->stitch_window = 0;
+	remus->take = 0;
+	remus->take_bpm = 0.0f;
+	remus->read_step = 0;
+	remus->read_band = 0;
+	remus->read_frac = 0;
     remus->transport_frame = 0;
-    remus->bar_start_frame = 0;
 	remus->transport_rolling = false;
     remus->transport_just_stopped = false;
 	remus->bpm = 120.0f;
 	remus->beats_per_bar = 4.0f;
+	remus->bar_phase = 0;
+	remus->bar_frames = bar_length(remus);
+	remus->bar_synced = false;
 	remus->debug_logged = false;
 	
+	remus_pool_ref();
 	return (LV2_Handle)remus;
 }
 
@@ -183,10 +749,10 @@ connect_port(LV2_Handle instance,
 	
 	switch ((PortIndex)port) {
 	case REMUS_AUDIO_IN:
-		remus->audio_in = (const float*)data;
+		remus->audio_in[0] = (const float*)data;
 		break;
 	case REMUS_AUDIO_OUT:
-		remus->audio_out = (float*)data;
+		remus->audio_out[0] = (float*)data;
 		break;
 	case REMUS_TIME:
 		remus->time = (const LV2_Atom_Sequence*)data;
@@ -209,24 +775,70 @@ connect_port(LV2_Handle instance,
 	case REMUS_RECORDED_OUT:
 		remus->recorded_status = (float*)data;
 		break;
+	case REMUS_STITCH_SEARCH:
+		remus->stitch_search = (const float*)data;
+		break;
+	case REMUS_SLOT:
+		remus->slot = (const float*)data;
+		break;
+	case REMUS_OVERDUB:
+		remus->overdub = (const float*)data;
+		break;
+	case REMUS_LONG_LOOP:
+		remus->long_loop = (const float*)data;
+		break;
+	case REMUS_STORAGE:
+		remus->storage = (const float*)data;
+		break;
+	case REMUS_FOLLOW:
+		remus->follow = (const float*)data;
+		break;
+	case REMUS_CAPTURE_RING:
+		remus->capture_ring = (const float*)data;
+		break;
+	case REMUS_CAPTURE:
+		remus->capture = (const float*)data;
+		break;
+	case REMUS_STATS:
+		remus->stats_port = (LV2_Atom_Sequence*)data;
+		break;
+	case REMUS_FREEWHEEL:
+		remus->freewheel = (const float*)data;
+		break;
+	case REMUS_PEAKS:
+		remus->peaks_port = (LV2_Atom_Sequence*)data;
+		break;
+	default:
+		// Audio ports of the other channels
+		if (port >= REMUS_EXTRA_AUDIO) {
+			const uint32_t channel = 1 + (port - REMUS_EXTRA_AUDIO) / 2;
+			if (channel < remus->n_channels) {
+				if ((port - REMUS_EXTRA_AUDIO) % 2) {
+					remus->audio_out[channel] = (float*)data;
+				} else {
+					remus->audio_in[channel] = (const float*)data;
+				}
+			}
+		}
+		break;
 	}
 }static void
 activate(LV2_Handle instance)
 {
 	Remus* remus = (Remus*)instance;
 	
-	fprintf(stderr, "REMUS: activate() called - has_recorded=%d before clear\n", remus->has_recorded);
+	REMUS_TRACE(&remus->log, "REMUS: activate() called - has_recorded=%d before clear\n", remus->has_recorded);
 	
-	// Don't clear buffer if we have restored data
+	// Keep restored data, pages are zero-filled when they come from the pool
 	// Only reset the playback position and state flags
 	if (!remus->has_recorded) {
-		// Only clear buffer if no data was restored
-		memset(remus->buffer, 0, remus->buffer_size * sizeof(float));
 		remus->loop_samples = 0;
+		remus->recorded_samples = 0;
 	}
 	
 	remus->write_pos = 0;
 	remus->read_pos = 0;
+	remus->read_frac = 0;
 	remus->recording = false;
 	remus->waiting_for_bar = false;
 	remus->playing = false;
@@ -238,474 +850,2584 @@ activate(LV2_Handle instance)
 	remus->tail_zero_crossings = 0;
 	remus->tail_min_distance = TAIL_BUFFER_SIZE;
 	remus->stitch_position = 0;
+	remus->stitch_pending = false;
+	remus->overdubbing = false;
+	remus->overdub_latched = false;
+	remus->take++;  // A stitch or capture still in flight is stale
+	remus->edits++;
+	remus->ring_valid = remus->ring_pos;
     remus->transport_frame = 0;
-    remus->bar_start_frame = 0;
 	remus->transport_rolling = false;
     remus->transport_just_stopped = false;
 	remus->bpm = 120.0f;
 	remus->beats_per_bar = 4.0f;
+	remus->bar_phase = 0;
+	remus->bar_frames = bar_length(remus);
+	remus->bar_synced = false;
 }
 
-/* Calculate frames per beat */
-static inline double
-frames_per_beat(Remus* self)
+/* Page p of channel c in the loop buffer */
+static inline float*
+loop_page(const Remus* self, uint32_t c, uint32_t p)
 {
-    return (self->sample_rate * 60.0) / self->bpm;
+	return self->pages[p * self->n_channels + c];
 }
 
-/* Update transport information from position */
+/* Copy n samples into channel c of a page table starting at pos */
 static void
-update_transport(Remus* self, const LV2_Atom_Object* obj, int64_t frame_offset)
+table_write(float* const* table, uint32_t n_channels, uint32_t c, uint32_t pos,
+            const float* src, uint32_t n)
 {
-    LV2_Atom* bar = NULL;
-    LV2_Atom* barBeat = NULL;
-    LV2_Atom* bpm_atom = NULL;
-    LV2_Atom* bpb = NULL;
-    LV2_Atom* speed = NULL;
-    LV2_Atom* frame_atom = NULL;
-    
-    /* Get frame position */
-    LV2_URID frame_urid = self->map->map(self->map->handle, LV2_TIME__frame);
-    
-    lv2_atom_object_get(obj,
-                       frame_urid, &frame_atom,
-                       self->time_bar, &bar,
-                       self->time_barBeat, &barBeat,
-                       self->time_beatsPerMinute, &bpm_atom,
-                       self->time_beatsPerBar, &bpb,
-                       self->time_speed, &speed,
-                       NULL);
-    
-    /* Update frame position */
-    if (frame_atom && frame_atom->type == self->atom_Long) {
-        self->transport_frame = ((LV2_Atom_Long*)frame_atom)->body + frame_offset;
-    }
-    
-    /* If we get bar/barBeat, calculate the frame position of the bar start */
-    if (bar && bar->type == self->atom_Long &&
-        barBeat && barBeat->type == self->atom_Float) {
-        
-        double beat_in_bar = (double)((LV2_Atom_Float*)barBeat)->body;
-        double frames_per_beat_val = frames_per_beat(self);
-        int64_t frames_from_bar_start = (int64_t)(beat_in_bar * frames_per_beat_val);
-        self->bar_start_frame = self->transport_frame - frames_from_bar_start;
-    }
-    
-    if (bpm_atom && bpm_atom->type == self->atom_Float) {
-        self->bpm = (double)((LV2_Atom_Float*)bpm_atom)->body;
-    }
-    
-    if (bpb && bpb->type == self->atom_Float) {
-        self->beats_per_bar = (double)((LV2_Atom_Float*)bpb)->body;
-    }
-    
-    if (speed && speed->type == self->atom_Float) {
-        float speed_val = ((LV2_Atom_Float*)speed)->body;
-        bool was_rolling = self->transport_rolling;
-        self->transport_rolling = (speed_val > 0.0f);
-        
-        /* Detect transport stop */
-        if (was_rolling && !self->transport_rolling) {
-            self->transport_just_stopped = true;
-            /* If we were playing, go back to IDLE */
-            if (self->playing) {
-                fprintf(stderr, "Romulus: Transport stopped, PLAYING -> IDLE\n");
-                self->playing = false;
-            }
-        }
-        
-        /* Detect transport start - schedule playing */
-        if (!was_rolling && self->transport_rolling) {
-            fprintf(stderr, "Romulus: Transport started -> IDLE\n");
-            self->playing = false;
-        }
-    }
-    
+	while (n > 0) {
+		const uint32_t offset = pos & REMUS_PAGE_MASK;
+		const uint32_t chunk = (n < REMUS_PAGE_FRAMES - offset) ? n : REMUS_PAGE_FRAMES - offset;
+		remus_copy(table[(pos >> REMUS_PAGE_SHIFT) * n_channels + c] + offset, src, chunk);
+		pos += chunk;
+		src += chunk;
+		n -= chunk;
+	}
 }
 
-/* Check if we're at the start of a bar based on frame position */
-static bool
-is_bar_start(Remus* self, int64_t current_frame)
+/* Copy n samples out of channel c of a page table starting at pos */
+static void
+table_read(float* const* table, uint32_t n_channels, uint32_t c, uint32_t pos,
+           float* dst, uint32_t n)
 {
-    /* Calculate frames per bar */
-    double frames_per_beat_val = frames_per_beat(self);
-    int64_t frames_per_bar = (int64_t)(frames_per_beat_val * self->beats_per_bar);
-    
-    /* Calculate position within the current bar */
-    int64_t frames_since_bar_start = current_frame - self->bar_start_frame;
-    int64_t position_in_bar = frames_since_bar_start % frames_per_bar;
-    
-    /* We're at bar start if position is within first 256 frames (about 5ms at 48kHz) */
-    return position_in_bar < 256;
+	while (n > 0) {
+		const uint32_t offset = pos & REMUS_PAGE_MASK;
+		const uint32_t chunk = (n < REMUS_PAGE_FRAMES - offset) ? n : REMUS_PAGE_FRAMES - offset;
+		remus_copy(dst, table[(pos >> REMUS_PAGE_SHIFT) * n_channels + c] + offset, chunk);
+		pos += chunk;
+		dst += chunk;
+		n -= chunk;
+	}
 }
 
+/* Unpack n samples out of channel c of a packed table starting at pos */
 static void
-run(LV2_Handle instance, uint32_t n_samples)
+pack_table_read(const RemusPack* pack, const RemusKernels* kernels, uint32_t n_channels, uint32_t c,
+                uint32_t pos, float* dst, uint32_t n)
 {
-	Remus* remus = (Remus*)instance;
-	
-	// One-time debug log after restore
-	if (!remus->debug_logged && remus->has_recorded) {
-		fprintf(stderr, "REMUS: In run() - has_recorded=%d, loop_samples=%u, recording=%d, waiting_for_bar=%d\n",
-		        remus->has_recorded, remus->loop_samples, remus->recording, remus->waiting_for_bar);
-		remus->debug_logged = true;
-	}
-	
-	const float* const audio_in   = remus->audio_in;
-	float* const       audio_out  = remus->audio_out;
-	const float        rec_enable = *remus->record_enable;
-	const float        loop_len   = *remus->loop_length;
-	
-	LV2_ATOM_SEQUENCE_FOREACH(remus->time, ev) {
-		if (ev->body.type == remus->atom_Blank || ev->body.type == remus->atom_Object) {
-			const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
-			if (obj->body.otype == remus->time_Position) {
-				update_transport(remus, (const LV2_Atom_Object*)&ev->body, ev->time.frames);
-			}
-		}
+	while (n > 0) {
+		const uint32_t offset = pos & REMUS_PAGE_MASK;
+		const uint32_t chunk = (n < REMUS_PAGE_FRAMES - offset) ? n : REMUS_PAGE_FRAMES - offset;
+		remus_pack_read(pack, kernels, (pos >> REMUS_PAGE_SHIFT) * n_channels + c, offset, dst, chunk);
+		pos += chunk;
+		dst += chunk;
+		n -= chunk;
 	}
-	
-	// Calculate loop length in samples using transport tempo
-	// beats_per_bar * bars * 60 / bpm * sample_rate
-	const uint32_t loop_beats = (uint32_t)(remus->beats_per_bar * loop_len);
-	const uint32_t new_loop_samples = (uint32_t)((loop_beats * 60.0 * remus->sample_rate) / remus->bpm);
-	
-	// Detect record enable edge (on to off transition)
-	const bool rec_start = (rec_enable <= 0.5f) && (remus->prev_record_enable > 0.5f);
+}
 
-	remus->prev_record_enable = rec_enable;
-	
-	// Stop recording on manual restart
-	if (remus->recording && rec_start) {
-		if (remus->recording) {
-			remus->recording = false;
-		}
-		if (remus->recording_tail) {
-			remus->recording_tail = false;
-			remus->has_recorded = true;
-			remus->tail_pos = 0;
-			fprintf(stderr, "REMUS: Tail recording stopped manually\n");
-		}
+/* Copy n samples into channel c of the loop buffer starting at pos */
+static inline void
+loop_write(Remus* self, uint32_t c, uint32_t pos, const float* src, uint32_t n)
+{
+	table_write(self->pages, self->n_channels, c, pos, src, n);
+}
+
+/* Copy n samples out of channel c of the loop buffer starting at pos */
+static inline void
+loop_read(const Remus* self, uint32_t c, uint32_t pos, float* dst, uint32_t n)
+{
+	if (self->packed) {
+		pack_table_read(self->packed, self->kernels, self->n_channels, c, pos, dst, n);
+	} else {
+		table_read(self->pages, self->n_channels, c, pos, dst, n);
 	}
+}
 
-	// On record start, wait for next bar boundary
-	if (rec_start) {
-		remus->waiting_for_bar = true;
-		remus->loop_samples = new_loop_samples;
-		
-		// Clamp to buffer size
-		if (remus->loop_samples > remus->buffer_size) {
-			remus->loop_samples = remus->buffer_size;
+/* Copy n samples out of channel c of the loop starting at pos, wrapping at its end */
+static void
+loop_read_wrapped(const Remus* self, uint32_t c, uint32_t pos, float* dst, uint32_t n)
+{
+	while (n > 0) {
+		const uint32_t chunk = (n < self->loop_samples - pos) ? n : self->loop_samples - pos;
+		loop_read(self, c, pos, dst, chunk);
+		pos += chunk;
+		if (pos >= self->loop_samples) {
+			pos = 0;
 		}
+		dst += chunk;
+		n -= chunk;
 	}
+}
 
-	// Check if we've crossed a bar boundary
-	if (remus->waiting_for_bar && is_bar_start(remus, remus->transport_frame)) {
-		// New bar started - begin recording
-		remus->recording = true;
-		remus->waiting_for_bar = false;
-		remus->write_pos = 0;
-		remus->read_pos = 0;
-		remus->has_recorded = false;
+/* Mix n samples into channel c of the loop buffer starting at pos */
+static void
+loop_mix(Remus* self, uint32_t c, uint32_t pos, const float* src, uint32_t n)
+{
+	while (n > 0) {
+		const uint32_t offset = pos & REMUS_PAGE_MASK;
+		const uint32_t chunk = (n < REMUS_PAGE_FRAMES - offset) ? n : REMUS_PAGE_FRAMES - offset;
+		self->kernels->add(loop_page(self, c, pos >> REMUS_PAGE_SHIFT) + offset, src, chunk);
+		pos += chunk;
+		src += chunk;
+		n -= chunk;
 	}
-	
-	// Handle playback alignment with transport
-	if (remus->has_recorded && remus->loop_samples > 0 && !remus->recording) {
-		if (!remus->transport_rolling) {
-			// Transport stopped - stop playing
-			remus->playing = false;
-			remus->waiting_to_play = false;
-		} else if (!remus->playing && !remus->waiting_to_play) {
-			// Transport started and we're not playing
-			// If we're at the very beginning (bar 0, beat 0), start immediately
-			if (is_bar_start(remus, remus->transport_frame)) {
-				remus->playing = true;
-				remus->waiting_to_play = false;
-				remus->read_pos = 0;
-			} else {
-				// Otherwise wait for next bar boundary
-				remus->waiting_to_play = true;
-			}
-		} else if (remus->waiting_to_play) {
-			// Check if we've crossed a bar boundary
-			if (is_bar_start(remus, remus->transport_frame)) {
-				// New bar started - begin playing
-				remus->playing = true;
-				remus->waiting_to_play = false;
-				remus->read_pos = 0;
-			}
-		}
+}
+
+/* Rescan the peaks of the n frames of the loop buffer written from pos, and send them */
+static void
+peaks_touch(Remus* self, uint32_t pos, uint32_t n)
+{
+	RemusPeaks* peaks = self->peaks;
+	if (!peaks || n == 0) {
+		return;
 	}
 	
-	// Update loop length if parameters changed and not currently recording
-	if (!remus->recording && !remus->waiting_for_bar && remus->has_recorded) {
-		if (new_loop_samples != remus->loop_samples) {
-			remus->loop_samples = new_loop_samples;
-			if (remus->loop_samples > remus->buffer_size) {
-				remus->loop_samples = remus->buffer_size;
-			}
-			// Ensure read position is within new loop bounds
-			if (remus->read_pos >= remus->loop_samples) {
-				remus->read_pos = 0;
-			}
+	// Bins do not cross pages, a page holds a whole number of them
+	const uint32_t first = pos >> REMUS_PEAK_SHIFT;
+	uint32_t       end = remus_peak_bins(pos + n, 0);
+	end = (end < peaks->n_bins[0]) ? end : peaks->n_bins[0];
+	for (uint32_t bin = first; bin < end; bin++) {
+		const uint32_t start = bin << REMUS_PEAK_SHIFT;
+		const uint32_t left = self->loop_samples - start;
+		const float*   channels[REMUS_MAX_CHANNELS];
+		for (uint32_t c = 0; c < self->n_channels; c++) {
+			channels[c] = loop_page(self, c, start >> REMUS_PAGE_SHIFT) + (start & REMUS_PAGE_MASK);
 		}
+		remus_peaks_scan(peaks, bin, channels, self->n_channels,
+		                 (left < REMUS_PEAK_FRAMES) ? left : REMUS_PEAK_FRAMES);
 	}
+	remus_peak_port_mark(&self->peak_port, first, end);
+}
+
+/* Copy n input samples of every channel from offset to the capture ring */
+static void
+ring_write(Remus* self, uint32_t offset, uint32_t n)
+{
+	const uint32_t capacity = self->ring_pages * REMUS_PAGE_FRAMES;
+	uint32_t       pos = (uint32_t)(self->ring_pos % capacity);
 	
-	for (uint32_t i = 0; i < n_samples; i++) {
-		if (remus->recording) {
-			// Record input to buffer
-			if (remus->write_pos < remus->loop_samples) {
-				remus->buffer[remus->write_pos] = audio_in[i];
-				remus->write_pos++;
-				
-				// If we've filled the loop, start tail recording
-				if (remus->write_pos >= remus->loop_samples) {
-					remus->recording = false;
-					remus->recording_tail = true;
-					remus->tail_pos = 0;
-					remus->tail_zero_crossings = 0;
-				remus->tail_min_distance = TAIL_BUFFER_SIZE;
-remus->stitch_position = 0;
-					fprintf(stderr, "REMUS: Loop filled (%u samples), starting tail recording\n", remus->loop_samples);
-				}
-			}
-			
-			// Silence output while recording
-			audio_out[i] = 0.0f;
-		} else if (remus->recording_tail) {
-			// Record into tail buffer and search for zero-crossings
-			
-			if (remus->tail_pos < TAIL_BUFFER_SIZE) {
-				remus->tail_buffer[remus->tail_pos] = audio_in[i];
-				remus->tail_pos++;
-				
-				// Start searching after we have at least 2 samples (need at least one crossing)
-				if (remus->tail_pos >= 2) {
-					// Check if we just crossed zero in the tail buffer
-					bool tail_crossing = false;
-					bool tail_positive = false;
-					uint32_t t = remus->tail_pos - 1;
-					
-					if ((remus->tail_buffer[t-1] < 0.0f && remus->tail_buffer[t] >= 0.0f)) {
-						tail_crossing = true;
-						tail_positive = true;
-					} else if ((remus->tail_buffer[t-1] > 0.0f && remus->tail_buffer[t] <= 0.0f)) {
-						tail_crossing = true;
-						tail_positive = false;
-					}
-					
-					if (tail_crossing) {
-						// Count this zero-crossing
-						remus->tail_zero_crossings++;
-						
-					// Search for matching zero-crossing in loop start
-					// Search relative to tail_pos, within ±ZERO_CROSSING_DISTANCE samples
-					uint32_t loop_search_start = (t > ZERO_CROSSING_DISTANCE) ? (t - ZERO_CROSSING_DISTANCE) : 1;
-					uint32_t loop_search_end = (t + ZERO_CROSSING_DISTANCE < remus->loop_samples) ? (t + ZERO_CROSSING_DISTANCE) : remus->loop_samples - 1;
-						for (uint32_t l = loop_search_start; l <= loop_search_end; l++) {
-							bool loop_crossing = false;
-							bool loop_positive = false;
-							
-							// Check for zero crossing in loop
-							if ((remus->buffer[l-1] < 0.0f && remus->buffer[l] >= 0.0f)) {
-								loop_crossing = true;
-								loop_positive = true;
-							} else if ((remus->buffer[l-1] > 0.0f && remus->buffer[l] <= 0.0f)) {
-								loop_crossing = true;
-								loop_positive = false;
-							}
-							
-							// Check if crossings match in direction
-							if (loop_crossing && (tail_positive == loop_positive)) {
-								int32_t distance = abs((int32_t)t - (int32_t)l);
-								
-								// Track minimum distance
-								if (distance < remus->tail_min_distance) {
-									remus->tail_min_distance = distance;
-								}
-
-								// Calculate midpoint
-								uint32_t midpoint = (t + l) / 2;
-
-								// Match found within threshold and crossfade is possible
-								if (distance <= ZERO_CROSSING_DISTANCE 
-									&& midpoint >= (CROSSFADE_SAMPLES / 2)
-									&& midpoint + 1 < (TAIL_BUFFER_SIZE - CROSSFADE_SAMPLES / 2)
-									&& remus->stitch_position == 0) {  // Only set once
-									// Set the stitch position to the midpoint between the two zero-crossings
-									remus->stitch_position = midpoint + 1;
-									
-									fprintf(stderr, "REMUS: Found zero-crossing match - tail[%u] and loop[%u], distance=%d samples, slope=%s, midpoint=%u\n",
-											t, l, distance,
-											tail_positive ? "positive" : "negative", midpoint);
-									fprintf(stderr, "REMUS: Continuing tail recording to collect crossfade samples (need %u more samples)\n",
-											remus->stitch_position + CROSSFADE_SAMPLES / 2 - remus->tail_pos);
-									break;
-								}
-							}
-						}
-					}
-				}
-				
-				// Check if we have enough samples for crossfade after finding a match
-				if (remus->stitch_position > 0) {
-					uint32_t samples_needed = remus->stitch_position + CROSSFADE_SAMPLES / 2;
-					if (remus->tail_pos >= samples_needed) {
-						fprintf(stderr, "REMUS: Collected enough samples for crossfade (%u samples)\n", remus->tail_pos);
-						remus->recording_tail = false;
-						remus->has_recorded = true;
-					}
-				}
-				
-				// Check if tail buffer is full without finding a match
-				if (remus->tail_pos >= TAIL_BUFFER_SIZE && remus->stitch_position == 0) {
-					// Choose closest position able to crossfade
-					remus->stitch_position = CROSSFADE_SAMPLES / 2;
-					fprintf(stderr, "REMUS: Tail buffer full - will use position %u (no zero-crossing match)\n", remus->stitch_position);
-					
-					remus->recording_tail = false;
-					remus->has_recorded = true;
-					if (remus->tail_min_distance < TAIL_BUFFER_SIZE) {
-						fprintf(stderr, "REMUS: Finishing without zero-crossing alignment. "
-						        "Considered %u zero-crossings, minimal distance found: %d samples\n",
-						        remus->tail_zero_crossings, remus->tail_min_distance);
-					} else {
-						fprintf(stderr, "REMUS: Finishing without zero-crossing alignment. "
-						        "Considered %u zero-crossings, no matching crossings found in loop\n",
-						        remus->tail_zero_crossings);
-					}
-				}
-			}
-			
-			// Silence output while recording tail
-			audio_out[i] = 0.0f;
-		}
-		
-		// Perform crossfade after tail recording is complete
-		if (!remus->recording_tail && remus->stitch_position > 0 && remus->tail_pos > 0) {
-			const uint32_t half_crossfade = CROSSFADE_SAMPLES / 2;
-			uint32_t crossfade_start = remus->stitch_position - half_crossfade;
-			
-			// Copy samples from tail buffer before the crossfade zone
-			if (crossfade_start > 0) {
-				memcpy(remus->buffer, remus->tail_buffer, crossfade_start * sizeof(float));
-				fprintf(stderr, "REMUS: Copied %u samples before crossfade zone\n", crossfade_start);
-			}
-			
-			// Apply crossfade centered around stitch_position
-			for (uint32_t cf = 0; cf < CROSSFADE_SAMPLES; cf++) {
-				// Position in both buffers
-				uint32_t pos = crossfade_start + cf;
-			
-				// Linear crossfade: fade out loop, fade in tail
-				float fade_in = (float)cf / (float)(CROSSFADE_SAMPLES - 1);
-				float fade_out = 1.0f - fade_in;
-				
-				remus->buffer[pos] = remus->tail_buffer[pos] * fade_out + remus->buffer[pos] * fade_in;
-			}
-			
-			fprintf(stderr, "REMUS: Applied %u-sample crossfade around position %u for click-free transition\n", CROSSFADE_SAMPLES, remus->stitch_position);
-			
-			// Reset for next time
-			remus->tail_pos = 0;
-			remus->stitch_position = 0;
+	self->ring_pos += n;
+	while (n > 0) {
+		const uint32_t chunk = (n < capacity - pos) ? n : capacity - pos;
+		for (uint32_t c = 0; c < self->n_channels; c++) {
+			table_write(self->ring, self->n_channels, c, pos, self->audio_in[c] + offset, chunk);
 		}
-		
-		if (remus->playing && remus->has_recorded && remus->loop_samples > 0 && !remus->waiting_for_bar) {
-			// Playback loop (only when playing)
-			audio_out[i] = remus->buffer[remus->read_pos];
-			
-			remus->read_pos++;
-			if (remus->read_pos >= remus->loop_samples) {
-				remus->read_pos = 0;
-			}
-		} else {
-			// No recording, pass through or silence
-			audio_out[i] = 0.0f;
-		}
-	}
-	
-	// Update recording status outputs
-	if (remus->recording_status) {
-		*remus->recording_status = (remus->recording || remus->recording_tail) ? 1.0f : 0.0f;
+		pos = (pos + chunk < capacity) ? pos + chunk : 0;
+		offset += chunk;
+		n -= chunk;
 	}
-	if (remus->armed_status) {
-		*remus->armed_status = remus->waiting_for_bar ? 1.0f : 0.0f;
+}
+
+/* Whether long loops are enabled: loops may then grow past MAX_BUFFER_SIZE, on disk */
+static inline bool
+long_loops(const Remus* self)
+{
+	return self->long_loop && *self->long_loop > 0.5f;
+}
+
+/* Longest loop the buffer may hold */
+static inline uint32_t
+max_loop_samples(const Remus* self)
+{
+	return long_loops(self) ? DISK_BUFFER_SIZE : MAX_BUFFER_SIZE;
+}
+
+/* Get a zero-filled page from the disk or the pool (not RT safe) */
+static float*
+page_acquire(Remus* self, bool disk)
+{
+	if (!disk) {
+		return remus_pool_acquire();
 	}
-	if (remus->recorded_status) {
-		*remus->recorded_status = remus->has_recorded ? 1.0f : 0.0f;
+	if (!remus_disk_open(&self->disk)) {
+		REMUS_ERROR(&self->log, "REMUS: Cannot create a file for long loops\n");
+		return NULL;
 	}
-	
-    /* Update frame position for next cycle */
-    remus->transport_frame += n_samples;
+	return remus_disk_acquire(&self->disk);
 }
 
+/* Return a page to the disk, loop file or pool it came from (not RT safe) */
 static void
-deactivate(LV2_Handle instance)
+page_release(Remus* self, float* page)
 {
-	// Nothing to do here
+	if (remus_disk_owns(&self->disk, page)) {
+		remus_disk_release(&self->disk, page);
+	} else if (!remus_files_release(&self->files, page)) {
+		remus_pool_release(page);
+	}
 }
 
+/*
+ * Release the pages of table from entry first, then the table itself (not RT
+ * safe). Tables hold n_pages entries per channel, callers pass entry counts.
+ */
 static void
-cleanup(LV2_Handle instance)
+table_release(Remus* self, float** table, uint32_t n_pages, uint32_t first)
 {
-	Remus* remus = (Remus*)instance;
-	free(remus->buffer);
+	if (!table) {
+		return;
+	}
+	for (uint32_t p = first; p < n_pages; p++) {
+		page_release(self, table[p]);
+	}
+	free(table);
+}
+
+/*
+ * Build a table of n_new pages sharing the first pages of table (not RT safe).
+ * With disk, new pages past the loop start come from disk.
+ * Returns NULL if memory runs out, leaving table untouched.
+ */
+static float**
+table_resize(Remus* self, float** table, uint32_t n_old, uint32_t n_new, bool disk)
+{
+	float** resized = (float**)calloc(n_new ? n_new : 1, sizeof(float*));
+	if (!resized) {
+		return NULL;
+	}
+	
+	const uint32_t n_shared = (n_old < n_new) ? n_old : n_new;
+	if (n_shared > 0) {
+		memcpy(resized, table, n_shared * sizeof(float*));
+	}
+	
+	for (uint32_t p = n_shared; p < n_new; p++) {
+		const bool on_disk = disk && p / self->n_channels >= DISK_HEAD_PAGES;
+		if (!(resized[p] = page_acquire(self, on_disk))) {
+			table_release(self, resized, p, n_shared);
+			return NULL;
+		}
+	}
+	return resized;
+}
+
+/* Unpack the first n_entries pages of pack to a new table (not RT safe), NULL if out of memory */
+static float**
+unpack_table(Remus* self, const RemusPack* pack, uint32_t n_entries)
+{
+	float** table = table_resize(self, NULL, 0, n_entries, false);
+	for (uint32_t e = 0; table && e < n_entries; e++) {
+		remus_pack_read(pack, self->kernels, e, 0, table[e], REMUS_PAGE_FRAMES);
+	}
+	return table;
+}
+
+/* Copy n samples of channel c out of a ring of capacity samples from pos, returns the position after */
+static uint32_t
+ring_read(const Remus* self, float* const* ring, uint32_t capacity, uint32_t c, uint32_t pos,
+          float* dst, uint32_t n)
+{
+	while (n > 0) {
+		const uint32_t chunk = (n < capacity - pos) ? n : capacity - pos;
+		table_read(ring, self->n_channels, c, pos, dst, chunk);
+		pos = (pos + chunk < capacity) ? pos + chunk : 0;
+		dst += chunk;
+		n -= chunk;
+	}
+	return pos;
+}
+
+/*
+ * Copy the frames of a capture job out of the ring to a new loop table (not
+ * RT safe), NULL if out of memory. run() keeps writing the ring meanwhile,
+ * past the capture margin. With a stitch position, the loop start fades in
+ * from the samples that followed the bars, so the loop wraps without a click.
+ */
+static float**
+capture_table(Remus* self, const RemusWork* job)
+{
+	const uint32_t n_pages = remus_pages_for(job->length);
+	const uint32_t capacity = job->n_pages * REMUS_PAGE_FRAMES;
+	float**        table = table_resize(self, NULL, 0, n_pages * self->n_channels, false);
+	
+	for (uint32_t c = 0; table && c < self->n_channels; c++) {
+		uint32_t pos = (uint32_t)(job->ring_start % capacity);
+		for (uint32_t p = 0; p < n_pages; p++) {
+			const uint32_t left = job->length - p * REMUS_PAGE_FRAMES;
+			pos = ring_read(self, job->table, capacity, c, pos, table[p * self->n_channels + c],
+			                (left < REMUS_PAGE_FRAMES) ? left : REMUS_PAGE_FRAMES);
+		}
+		if (job->stitch_position) {
+			float tail[CROSSFADE_SAMPLES];
+			ring_read(self, job->table, capacity, c, (uint32_t)((job->ring_start + job->length) % capacity),
+			          tail, CROSSFADE_SAMPLES);
+			self->kernels->crossfade(table[c], tail, CROSSFADE_SAMPLES, 0, CROSSFADE_SAMPLES);
+		}
+	}
+	return table;
+}
+
+/*
+ * Build the peaks of a job for n_pages of loop, scanning its first length
+ * frames from the table or the pack (not RT safe), NULL if out of memory.
+ */
+static RemusPeaks*
+build_peaks(const Remus* self, const RemusWork* job)
+{
+	RemusPeaks* peaks = remus_peaks_new(job->n_pages * REMUS_PAGE_FRAMES);
+	float       unpacked[REMUS_MAX_CHANNELS][REMUS_PEAK_FRAMES];
+	
+	for (uint32_t pos = 0; peaks && pos < job->length; pos += REMUS_PEAK_FRAMES) {
+		const uint32_t n = (job->length - pos < REMUS_PEAK_FRAMES) ? job->length - pos : REMUS_PEAK_FRAMES;
+		const float*   channels[REMUS_MAX_CHANNELS];
+		for (uint32_t c = 0; c < self->n_channels; c++) {
+			if (job->pack) {
+				pack_table_read(job->pack, self->kernels, self->n_channels, c, pos, unpacked[c], n);
+				channels[c] = unpacked[c];
+			} else {
+				channels[c] = job->table[(pos >> REMUS_PAGE_SHIFT) * self->n_channels + c]
+					+ (pos & REMUS_PAGE_MASK);
+			}
+		}
+		remus_peaks_scan(peaks, pos >> REMUS_PEAK_SHIFT, channels, self->n_channels, n);
+	}
+	return peaks;
+}
+
+/* Allocate an empty layer (not RT safe), NULL if out of memory */
+static RemusLayer*
+layer_new(const Remus* self)
+{
+	const size_t size = sizeof(RemusLayer) + (size_t)UNDO_MAX_PAGES * self->n_channels * sizeof(float*);
+	RemusLayer*  layer = (RemusLayer*)malloc(size);
+	if (layer) {
+		// Touched here, run() fills it without faulting
+		memset(layer, 0, size);
+	}
+	return layer;
+}
+
+/* Release a chain of layers and the pages they keep (not RT safe), NULL is ignored */
+static void
+layers_free(Remus* self, RemusLayer* layer)
+{
+	while (layer) {
+		RemusLayer* next = layer->next;
+		for (uint32_t i = 0; i < layer->n_replaced * self->n_channels; i++) {
+			page_release(self, layer->pages[i]);
+		}
+		free(layer);
+		layer = next;
+	}
+}
+
+/* Acquire up to n pool pages in reserve_fill (not RT safe), returns how many */
+static uint32_t
+fill_reserve(Remus* self, uint32_t n)
+{
+	uint32_t filled = 0;
+	while (filled < n && (self->reserve_fill[filled] = remus_pool_acquire())) {
+		filled++;
+	}
+	return filled;
+}
+
+/* Release the loops of a restore, then the restore itself (not RT safe), NULL is ignored */
+static void
+restore_free(Remus* self, RemusRestore* restored)
+{
+	if (!restored) {
+		return;
+	}
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		table_release(self, restored->slots[s].pages, restored->slots[s].n_pages * self->n_channels, 0);
+		remus_pack_free(restored->slots[s].packed);
+		layers_free(self, restored->slots[s].undo);
+		layers_free(self, restored->slots[s].redo);
+	}
+	free(restored);
+}
+
+/* Release what a FREE job retires (not RT safe) */
+static void
+release_retired(Remus* self, const RemusWork* job)
+{
+	table_release(self, job->table, job->n_pages * self->n_channels, job->first * self->n_channels);
+	for (uint32_t c = 0; c < REMUS_MAX_CHANNELS; c++) {
+		page_release(self, job->head[c]);
+	}
+	remus_pack_free(job->pack);
+	remus_peaks_free(job->peaks);
+	restore_free(self, job->restored);
+	layers_free(self, job->layer);
+}
+
+/* Release the FREE jobs held back, once no save is in progress (not RT safe) */
+static void
+release_deferred(Remus* self, bool wait)
+{
+	while (self->deferred && (wait || !atomic_load(&self->n_saving))) {
+		if (atomic_load(&self->n_saving)) {
+			sched_yield();
+			continue;
+		}
+		RemusDeferred* deferred = self->deferred;
+		self->deferred = deferred->next;
+		release_retired(self, &deferred->job);
+		free(deferred);
+	}
+}
+
+/*
+ * Release a FREE job, or hold it back while a save is in progress: the
+ * save may have copied the tables it retires. Without memory to hold it,
+ * wait for the save, which never waits for the worker.
+ */
+static void
+retire_work(Remus* self, const RemusWork* job)
+{
+	if (atomic_load(&self->n_saving)) {
+		RemusDeferred* deferred = (RemusDeferred*)malloc(sizeof(RemusDeferred));
+		if (deferred) {
+			deferred->job = *job;
+			deferred->next = self->deferred;
+			self->deferred = deferred;
+			return;
+		}
+		while (atomic_load(&self->n_saving)) {
+			sched_yield();
+		}
+	}
+	release_retired(self, job);
+}
+
+/* Loop pages per channel the layers of the active slot swap, the loop buffer keeps them */
+static uint32_t
+history_pages(const Remus* self)
+{
+	uint32_t end = 0;
+	for (const RemusLayer* layer = self->undo; layer; layer = layer->next) {
+		end = (layer->end > end) ? layer->end : end;
+	}
+	for (const RemusLayer* layer = self->redo; layer; layer = layer->next) {
+		end = (layer->end > end) ? layer->end : end;
+	}
+	return end;
+}
+
+/* Pages that must stay mapped for the take in progress, the recorded loop or its history */
+static uint32_t
+pinned_pages(const Remus* self)
+{
+	uint32_t frames = 0;
+	if (self->has_recorded || self->recording || self->recording_tail || self->stitch_pending
+	    || self->waiting_for_bar) {
+		frames = (self->loop_samples > self->recorded_samples)
+			? self->loop_samples : self->recorded_samples;
+	}
+	const uint32_t history = history_pages(self);
+	return (remus_pages_for(frames) > history) ? remus_pages_for(frames) : history;
+}
+
+/* Ask the worker to grow or shrink the loop buffer to n_pages */
+static void
+schedule_resize(Remus* self, uint32_t n_pages)
+{
+	const RemusWork job = {
+		.type = REMUS_WORK_RESIZE, .table = self->pages, .n_pages = n_pages, .first = self->n_pages,
+		.disk = long_loops(self)
+	};
+	
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->resize_pending = true;
+	}
+}
+
+/*
+ * Ask the worker to move the window of resident disk pages when the play or
+ * record position enters another page, or the table changed. Pages ahead are
+ * locked before run() reaches them.
+ */
+static void
+schedule_window(Remus* self)
+{
+	const uint32_t read_page = self->read_pos >> REMUS_PAGE_SHIFT;
+	const uint32_t write_page = self->recording ? self->write_pos >> REMUS_PAGE_SHIFT : read_page;
+	
+	if (self->window_pending || (!self->window_dirty && read_page == self->window_cursor[0]
+	                             && write_page == self->window_cursor[1])) {
+		return;
+	}
+	
+	// The window wraps around at the loop end, back to the first pages
+	uint32_t n_pages = self->n_pages;
+	if (self->loop_samples > 0 && remus_pages_for(self->loop_samples) < n_pages) {
+		n_pages = remus_pages_for(self->loop_samples);
+	}
+	const RemusWork job = {
+		.type = REMUS_WORK_WINDOW, .table = self->pages, .n_pages = n_pages,
+		.cursor = { read_page, write_page }
+	};
+	
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->window_pending = true;
+		self->window_dirty = false;
+		self->window_cursor[0] = read_page;
+		self->window_cursor[1] = write_page;
+	}
+}
+
+/* Format idle loops are packed to, from the storage port */
+static inline RemusPackFormat
+storage_format(const Remus* self)
+{
+	const float value = self->storage ? *self->storage : 0.0f;
+	return (value > 1.5f) ? REMUS_PACK_16 : (value > 0.5f) ? REMUS_PACK_24 : REMUS_PACK_FLOAT;
+}
+
+/* Whether the overdub port or a command asks for overdub */
+static bool
+overdub_requested(const Remus* self)
+{
+	return self->overdub_latched || (self->overdub && *self->overdub > 0.5f);
+}
+
+/* Whether the loop buffer holds a finished loop that nothing is about to change */
+static bool
+loop_idle(const Remus* self)
+{
+	return self->has_recorded && !self->recording && !self->recording_tail && !self->waiting_for_bar
+		&& !self->stitch_pending && !self->stitch_scheduled && !self->resize_pending
+		&& !self->resize_blocked && !self->overdubbing && !overdub_requested(self)
+		&& !self->capture_pending && !self->undo_steps;
+}
+
+/*
+ * Ask the worker to pack the loop buffer once it is idle, and to unpack it
+ * when it is about to change or the storage format does. Long loops are
+ * already out of memory and stay as they are.
+ */
+static void
+update_storage(Remus* self)
+{
+	const RemusPackFormat format = storage_format(self);
+	RemusWork             job = { .type = REMUS_WORK_PACK };
+	
+	if (self->pack_pending || self->unpack_pending || self->pack_failed) {
+		return;
+	} else if (self->packed && (!loop_idle(self) || format != self->packed->format)) {
+		job.type = REMUS_WORK_UNPACK;
+		job.pack = self->packed;
+		job.n_pages = self->n_pages;
+	} else if (!self->packed && self->pages && format != REMUS_PACK_FLOAT && loop_idle(self)
+	           && !self->disk_used) {
+		job.table = self->pages;
+		job.n_pages = self->n_pages;
+		job.take = self->edits;
+		job.format = format;
+	} else {
+		return;
+	}
+	
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->pack_pending = job.type == REMUS_WORK_PACK;
+		self->unpack_pending = job.type == REMUS_WORK_UNPACK;
+	}
+}
+
+/* Frames of the loop buffer shown on the peaks port, 0 without a loop or a take */
+static uint32_t
+shown_length(const Remus* self)
+{
+	return (self->has_recorded || self->recording || self->recording_tail || self->stitch_pending)
+		? self->loop_samples : 0;
+}
+
+/*
+ * Ask the worker to rebuild the peaks once the loop is idle after a change
+ * as a whole, and to make room ahead of a take longer than the pyramid. The
+ * take fills the new pyramid itself, the worker only allocates it.
+ */
+static void
+update_peaks(Remus* self)
+{
+	if (!self->peaks_port || self->peaks_pending || self->peaks_failed) {
+		return;
+	}
+	
+	const bool idle = self->has_recorded && !self->recording && !self->recording_tail
+		&& !self->stitch_pending && !self->overdubbing && !self->capture_pending
+		&& !self->resize_pending && self->loop_samples <= self->n_pages * REMUS_PAGE_FRAMES;
+	const bool rebuild = idle && (self->peaks_dirty || self->peaks_length != self->loop_samples);
+	const bool grow = (self->recording || self->waiting_for_bar)
+		&& (!self->peaks || self->peaks->capacity < self->loop_samples);
+	if (!rebuild && !grow) {
+		return;
+	}
+	
+	const RemusWork job = {
+		.type = REMUS_WORK_PEAKS, .table = self->pages, .pack = self->packed,
+		.n_pages = remus_pages_for(self->loop_samples), .length = rebuild ? self->loop_samples : 0,
+		.take = self->edits
+	};
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->peaks_pending = true;
+	}
+}
+
+/* Whether loops keep an undo history: not long loops, whose pages are on disk */
+static inline bool
+history_enabled(const Remus* self)
+{
+	return !long_loops(self) && !self->disk_used;
+}
+
+/* Queue a chain of layers for the worker to free */
+static void
+retire_layers(Remus* self, RemusLayer* chain)
+{
+	if (!chain) {
+		return;
+	}
+	RemusLayer* last = chain;
+	while (last->next) {
+		last = last->next;
+	}
+	last->next = self->retired_layers;
+	self->retired_layers = chain;
+}
+
+/* Forget the layers undone, a new edit replaces them */
+static void
+drop_redo(Remus* self)
+{
+	retire_layers(self, self->redo);
+	self->redo = NULL;
+	self->n_redo = 0;
+}
+
+/* Forget the history of the active slot, the loop stays as it is */
+static void
+drop_history(Remus* self)
+{
+	retire_layers(self, self->undo);
+	drop_redo(self);
+	self->undo = NULL;
+	self->layer = NULL;
+	self->n_undo = 0;
+	self->undo_steps = 0;
+}
+
+/*
+ * Push the spare layer for an edit about to start, with the loop as it is.
+ * Past UNDO_DEPTH the oldest layer is dropped. Without a spare the edit
+ * cannot be undone, nor can those before it, whose pages it may overwrite:
+ * the history is dropped. Returns the layer, NULL without one.
+ */
+static RemusLayer*
+push_layer(Remus* self, bool overdub)
+{
+	RemusLayer* layer = self->spare;
+	if (!layer) {
+		if (self->undo || self->redo) {
+			REMUS_RT_LOG(&self->log, LOG_HISTORY_LOST, self->active_slot, 0, 0, 0);
+		}
+		drop_history(self);
+		return NULL;
+	}
+	
+	self->spare = NULL;
+	layer->n_replaced = 0;
+	layer->end = 0;
+	layer->recorded_samples = self->recorded_samples;
+	layer->take_bpm = self->take_bpm;
+	layer->has_recorded = self->has_recorded;
+	layer->copy_on_write = self->has_recorded || self->undo;
+	layer->overdub = overdub;
+	layer->next = self->undo;
+	self->undo = layer;
+	if (++self->n_undo > UNDO_DEPTH) {
+		RemusLayer* last = layer;
+		while (last->next->next) {
+			last = last->next;
+		}
+		retire_layers(self, last->next);
+		last->next = NULL;
+		self->n_undo--;
+	}
+	memset(self->replaced, 0, sizeof(self->replaced));
+	return layer;
+}
+
+/* Take back the layer of an armed take that wrote no page, with the loop it kept */
+static void
+discard_layer(Remus* self)
+{
+	RemusLayer* layer = self->layer;
+	self->recorded_samples = layer->recorded_samples;
+	self->take_bpm = layer->take_bpm;
+	self->has_recorded = layer->has_recorded;
+	self->undo = layer->next;
+	self->n_undo--;
+	self->layer = NULL;
+	layer->next = NULL;
+	if (self->spare) {
+		retire_layers(self, layer);
+	} else {
+		self->spare = layer;
+	}
+}
+
+/* Swap the pages and the loop of a layer with those of the loop buffer */
+static void
+swap_layer(Remus* self, RemusLayer* layer)
+{
+	const uint32_t n_channels = self->n_channels;
+	for (uint32_t i = 0; i < layer->n_replaced; i++) {
+		float** entries = self->pages + layer->index[i] * n_channels;
+		float** kept = layer->pages + i * n_channels;
+		for (uint32_t c = 0; c < n_channels; c++) {
+			float* page = entries[c];
+			entries[c] = kept[c];
+			kept[c] = page;
+		}
+	}
+	
+	const uint32_t recorded_samples = self->recorded_samples;
+	const float    take_bpm = self->take_bpm;
+	const bool     has_recorded = self->has_recorded;
+	self->recorded_samples = layer->recorded_samples;
+	self->take_bpm = layer->take_bpm;
+	self->has_recorded = layer->has_recorded;
+	layer->recorded_samples = recorded_samples;
+	layer->take_bpm = take_bpm;
+	layer->has_recorded = has_recorded;
+}
+
+/*
+ * Before the open layer writes n frames of the loop buffer from pos, swap a
+ * page of the reserve in for each loop page it did not replace yet, with a
+ * copy of it to mix into, and keep the page replaced in the layer. When the
+ * reserve runs dry the rest of the edit is written in place, the history is
+ * dropped.
+ */
+static void
+layer_replace(Remus* self, uint32_t pos, uint32_t n, bool copy)
+{
+	RemusLayer*    layer = self->layer;
+	const uint32_t n_channels = self->n_channels;
+	const uint32_t last = (pos + n - 1) >> REMUS_PAGE_SHIFT;
+	
+	for (uint32_t p = pos >> REMUS_PAGE_SHIFT; p <= last; p++) {
+		const uint64_t bit = (uint64_t)1 << (p % 64);
+		if (p < UNDO_MAX_PAGES && (self->replaced[p / 64] & bit)) {
+			continue;
+		} else if (p >= UNDO_MAX_PAGES || self->n_reserve < n_channels) {
+			REMUS_RT_LOG(&self->log, LOG_HISTORY_LOST, self->active_slot, 0, 0, 0);
+			drop_history(self);
+			return;
+		}
+		
+		float** entries = self->pages + p * n_channels;
+		float** kept = layer->pages + layer->n_replaced * n_channels;
+		for (uint32_t c = 0; c < n_channels; c++) {
+			float* page = self->reserve[--self->n_reserve];
+			if (copy) {
+				remus_copy(page, entries[c], REMUS_PAGE_FRAMES);
+			}
+			kept[c] = entries[c];
+			entries[c] = page;
+		}
+		layer->index[layer->n_replaced++] = p;
+		layer->end = (p + 1 > layer->end) ? p + 1 : layer->end;
+		self->replaced[p / 64] |= bit;
+	}
+}
+
+/*
+ * Undo or redo the layers asked for, at a bar start where no edit is in
+ * progress and the loop buffer is unpacked and holds the pages of every
+ * layer. Each layer swapped costs a pointer swap per page it replaced.
+ */
+static void
+step_history(Remus* self)
+{
+	if (!self->undo_steps || self->layer || self->recording || self->recording_tail
+	    || self->waiting_for_bar || self->stitch_pending || self->stitch_scheduled
+	    || self->resize_pending || self->capture_pending || self->overdubbing || !self->pages
+	    || history_pages(self) > self->n_pages) {
+		return;
+	}
+	
+	for (; self->undo_steps < 0 && self->undo; self->undo_steps++) {
+		RemusLayer* layer = self->undo;
+		swap_layer(self, layer);
+		self->undo = layer->next;
+		self->n_undo--;
+		layer->next = self->redo;
+		self->redo = layer;
+		self->n_redo++;
+		REMUS_RT_LOG(&self->log, LOG_UNDONE, self->active_slot, layer->n_replaced, 0, 0);
+	}
+	for (; self->undo_steps > 0 && self->redo; self->undo_steps--) {
+		RemusLayer* layer = self->redo;
+		swap_layer(self, layer);
+		self->redo = layer->next;
+		self->n_redo--;
+		layer->next = self->undo;
+		self->undo = layer;
+		self->n_undo++;
+		REMUS_RT_LOG(&self->log, LOG_REDONE, self->active_slot, layer->n_replaced, 0, 0);
+	}
+	self->undo_steps = 0;
+	self->edits++;
+	self->peaks_dirty = true;
+	if (!self->has_recorded) {
+		self->playing = false;
+		self->waiting_to_play = false;
+	}
+}
+
+/*
+ * Hand the dropped layers to the worker, and ask it to fill the reserve
+ * while the loop or its history may be edited, and for a spare layer.
+ */
+static void
+update_history(Remus* self)
+{
+	if (!history_enabled(self) && (self->undo || self->redo)) {
+		drop_history(self);
+	}
+	if (self->retired_layers) {
+		const RemusWork retire = { .type = REMUS_WORK_FREE, .layer = self->retired_layers };
+		if (self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire)
+		    == LV2_WORKER_SUCCESS) {
+			self->retired_layers = NULL;
+		}
+	}
+	if (!history_enabled(self) || self->history_pending || self->history_failed) {
+		return;
+	}
+	
+	const uint32_t capacity = UNDO_RESERVE_PAGES * self->n_channels;
+	const uint32_t n_pages = (self->has_recorded || self->undo) ? capacity - self->n_reserve : 0;
+	if (n_pages == 0 && self->spare) {
+		return;
+	}
+	const RemusWork job = { .type = REMUS_WORK_HISTORY, .n_pages = n_pages, .spare = !self->spare };
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->history_pending = true;
+	}
+}
+
+/* Calculate frames per beat */
+static inline double
+frames_per_beat(const Remus* self)
+{
+    return (self->sample_rate * 60.0) / self->bpm;
+}
+
+/* Frames per bar in the 32.32 fixed point of the bar phase, 0 without a valid tempo and meter */
+static uint64_t
+bar_length(const Remus* self)
+{
+	if (self->bpm <= 0.0f || self->beats_per_bar <= 0.0f) {
+		return 0;
+	}
+	const double frames = frames_per_beat(self) * self->beats_per_bar;
+	return (frames >= 1.0 && frames < 4294967296.0) ? (uint64_t)(frames * 4294967296.0 + 0.5) : 0;
+}
+
+/*
+ * Read the transport fields of a time:Position in one pass over its
+ * properties, dispatching on the value type then the key. Keys and types
+ * are compared with the URIDs mapped at instantiate time.
+ */
+static void
+parse_position(const Remus* self, const LV2_Atom_Object* obj, RemusPosition* pos)
+{
+	memset(pos, 0, sizeof(RemusPosition));
+	
+	LV2_ATOM_OBJECT_FOREACH(obj, prop) {
+		const LV2_URID key = prop->key;
+		if (prop->value.type == self->atom_Float) {
+			const float value = ((const LV2_Atom_Float*)&prop->value)->body;
+			if (key == self->time_barBeat) {
+				pos->bar_beat = value;
+				pos->has_bar_beat = true;
+			} else if (key == self->time_beatsPerMinute) {
+				pos->bpm = value;
+				pos->has_bpm = true;
+			} else if (key == self->time_beatsPerBar) {
+				pos->beats_per_bar = value;
+				pos->has_beats_per_bar = true;
+			} else if (key == self->time_speed) {
+				pos->speed = value;
+				pos->has_speed = true;
+			}
+		} else if (prop->value.type == self->atom_Long) {
+			if (key == self->time_frame) {
+				pos->frame = ((const LV2_Atom_Long*)&prop->value)->body;
+				pos->has_frame = true;
+			} else if (key == self->time_bar) {
+				pos->has_bar = true;
+			}
+		}
+	}
+}
+
+/*
+ * Whether a position only confirms what run() predicted: the frame it
+ * reached, the same tempo, meter and direction, with the bar phase in sync.
+ * Freewheeling hosts send one with every block.
+ */
+static bool
+position_confirms(const Remus* self, const RemusPosition* pos)
+{
+	return pos->has_frame && pos->frame == self->transport_frame && self->bar_synced
+		&& (!pos->has_bpm || pos->bpm == self->bpm)
+		&& (!pos->has_beats_per_bar || pos->beats_per_bar == self->beats_per_bar)
+		&& (!pos->has_speed || (pos->speed > 0.0f) == self->transport_rolling);
+}
+
+/* Update transport information from a position received at the current frame */
+static void
+update_transport(Remus* self, const RemusPosition* pos)
+{
+    /* Update frame position */
+    if (pos->has_frame) {
+        self->transport_frame = pos->frame;
+    }
+    
+    /* Tempo first, the bar phase below depends on it */
+    const float old_bpm = self->bpm;
+    const float old_beats_per_bar = self->beats_per_bar;
+    if (pos->has_bpm) {
+        self->bpm = pos->bpm;
+    }
+    
+    if (pos->has_beats_per_bar) {
+        self->beats_per_bar = pos->beats_per_bar;
+    }
+    
+    /* Keep the position within the bar across tempo and meter changes */
+    const uint64_t old_bar_frames = self->bar_frames;
+    if (self->bpm != old_bpm || self->beats_per_bar != old_beats_per_bar) {
+        self->bar_frames = bar_length(self);
+    }
+    if (self->bar_frames != old_bar_frames) {
+        self->bar_phase = old_bar_frames
+            ? (uint64_t)((double)self->bar_phase / (double)old_bar_frames * (double)self->bar_frames) : 0;
+        if (self->bar_phase >= self->bar_frames) {
+            self->bar_phase = 0;
+        }
+    }
+    
+    if (pos->has_speed) {
+        bool was_rolling = self->transport_rolling;
+        self->transport_rolling = (pos->speed > 0.0f);
+        
+        /* Detect transport stop */
+        if (was_rolling && !self->transport_rolling) {
+            self->transport_just_stopped = true;
+            /* If we were playing, go back to IDLE */
+            if (self->playing) {
+                REMUS_RT_LOG(&self->log, LOG_TRANSPORT_STOPPED, 0, 0, 0, 0);
+                self->playing = false;
+            }
+        }
+        
+        /* Detect transport start - schedule playing */
+        if (!was_rolling && self->transport_rolling) {
+            REMUS_RT_LOG(&self->log, LOG_TRANSPORT_STARTED, 0, 0, 0, 0);
+            self->playing = false;
+            self->bar_synced = false;
+            self->ring_valid = self->ring_pos;  /* Bars before the stop do not lead here */
+        }
+    }
+    
+    /* Take the bar phase from bar/barBeat on a change or a relocation, and
+       correct drift within a bar only, where it can neither repeat nor skip
+       a bar start. Rounding in the host position is ignored */
+    if (pos->has_bar && pos->has_bar_beat && self->bar_frames) {
+        const double beat_in_bar = (double)pos->bar_beat;
+        uint64_t phase = (beat_in_bar > 0.0)
+            ? (uint64_t)(beat_in_bar * frames_per_beat(self) * 4294967296.0 + 0.5) : 0;
+        if (phase >= self->bar_frames) {
+            phase %= self->bar_frames;
+        }
+        
+        const uint64_t drift = (phase > self->bar_phase) ? phase - self->bar_phase : self->bar_phase - phase;
+        const uint64_t distance = (drift > self->bar_frames / 2) ? self->bar_frames - drift : drift;
+        if (!self->bar_synced || self->bar_frames != old_bar_frames || distance > PHASE_JUMP
+            || (drift > PHASE_DRIFT && drift <= PHASE_JUMP && phase >= PHASE_ONE && self->bar_phase >= PHASE_ONE)) {
+            self->bar_phase = phase;
+            self->bar_synced = true;
+        }
+    }
+}
+
+/*
+ * Frames from the sample ahead frames (0 or 1) past the current one to the
+ * next bar start, at most limit.
+ *
+ * A bar starts on the first sample at or after the exact (fractional) bar
+ * boundary, the only one with a bar phase below one frame, so 0 means the
+ * sample is that one.
+ */
+static uint32_t
+frames_to_bar(const Remus* self, uint32_t ahead, uint32_t limit)
+{
+	if (!self->bar_frames) {
+		return limit;
+	}
+	
+	// Bars are at least a frame long, so one wrap is enough
+	uint64_t phase = self->bar_phase + (uint64_t)ahead * PHASE_ONE;
+	if (phase >= self->bar_frames) {
+		phase -= self->bar_frames;
+	}
+	if (phase < PHASE_ONE) {
+		return 0;
+	}
+	
+	const uint64_t remaining = (self->bar_frames - phase + PHASE_ONE - 1) >> 32;
+	return (remaining < limit) ? (uint32_t)remaining : limit;
+}
+
+/* Advance the bar phase by n processed frames, while the transport rolls */
+static inline void
+advance_bar_phase(Remus* self, uint32_t n)
+{
+	if (self->bar_frames && self->transport_rolling) {
+		self->bar_phase += (uint64_t)n * PHASE_ONE;
+		if (self->bar_phase >= self->bar_frames) {
+			self->bar_phase %= self->bar_frames;
+		}
+	}
+}
+
+/* Calculate loop length in samples at a tempo */
+static uint32_t
+loop_length_samples(const Remus* self, float loop_len, float bpm)
+{
+	if (bpm <= 0.0f) {
+		return 0;
+	}
+	
+	// beats_per_bar * bars * 60 / bpm * sample_rate
+	const uint32_t loop_beats = (uint32_t)(self->beats_per_bar * loop_len);
+	return (uint32_t)((loop_beats * 60.0 * self->sample_rate) / bpm);
+}
+
+/* Resampling quality of tempo following, from the follow port */
+static inline RemusFollow
+follow_quality(const Remus* self)
+{
+	const float value = self->follow ? *self->follow : 0.0f;
+	return (value > 2.5f) ? REMUS_FOLLOW_BEST : (value > 1.5f) ? REMUS_FOLLOW_GOOD
+		: (value > 0.5f) ? REMUS_FOLLOW_FAST : REMUS_FOLLOW_OFF;
+}
+
+/* Tempo the loop length is measured at: the take tempo when following, or the transport tempo */
+static inline float
+loop_tempo(const Remus* self)
+{
+	return (follow_quality(self) != REMUS_FOLLOW_OFF && self->take_bpm > 0.0f) ? self->take_bpm : self->bpm;
+}
+
+/* Set the resampling step from the tempo ratio, 0 when the loop plays at its own tempo */
+static void
+update_read_step(Remus* self)
+{
+	uint64_t step = 0;
+	if (loop_tempo(self) != self->bpm && self->bpm > 0.0f) {
+		double ratio = (double)self->bpm / (double)self->take_bpm;
+		if (ratio > RESAMPLE_MAX_RATIO) {
+			ratio = RESAMPLE_MAX_RATIO;
+		} else if (ratio < 1.0 / RESAMPLE_MAX_RATIO) {
+			ratio = 1.0 / RESAMPLE_MAX_RATIO;
+		}
+		step = (uint64_t)(ratio * 4294967296.0 + 0.5);
+		self->read_band = remus_filter_band(ratio);
+	}
+	if (!step) {
+		self->read_frac = 0;
+		self->read_band = 0;
+	}
+	self->read_step = step;
+}
+
+/* Arm a take of loop_len bars for the next bar start, restarting one in progress */
+static void
+arm_take(Remus* remus, float loop_len)
+{
+	// A take has a layer from its arming on, kept when it is armed again or restarted
+	if (!remus->layer || remus->layer->overdub) {
+		remus->layer = push_layer(remus, false);
+	}
+	
+	// Stop recording on manual restart
+	if (remus->recording) {
+		remus->recording = false;
+		if (remus->recording_tail) {
+			remus->recording_tail = false;
+			remus->has_recorded = true;
+			remus->tail_pos = 0;
+			REMUS_RT_LOG(&remus->log, LOG_TAIL_STOPPED, 0, 0, 0, 0);
+		}
+	}
+
+	// Wait for next bar boundary
+	remus->waiting_for_bar = true;
+	remus->take_bpm = remus->bpm;
+	remus->loop_samples = loop_length_samples(remus, loop_len, remus->bpm);
+	
+	// Clamp to maximum buffer size
+	if (remus->loop_samples > max_loop_samples(remus)) {
+		remus->loop_samples = max_loop_samples(remus);
+	}
+}
+
+/* Handle the record enable control, once per block */
+static void
+update_record_enable(Remus* remus, float rec_enable, float loop_len)
+{
+	// Detect record enable edge (on to off transition)
+	const bool rec_start = (rec_enable <= 0.5f) && (remus->prev_record_enable > 0.5f);
+
+	remus->prev_record_enable = rec_enable;
+	if (rec_start) {
+		arm_take(remus, loop_len);
+	}
+}
+
+/*
+ * Fit the capture ring to the loop length and its margin at the transport
+ * tempo while the capture ring port is on, or release it. The ring only
+ * grows, or shrinks by half, so tempo automation does not keep restarting it.
+ */
+static void
+update_ring(Remus* self, float loop_len)
+{
+	uint32_t needed_pages = 0;
+	if (self->capture_ring && *self->capture_ring > 0.5f) {
+		// Plus a block, a bar start can come at the end of one as large as the margin
+		const uint64_t frames = (uint64_t)loop_length_samples(self, loop_len + CAPTURE_MARGIN_BARS, self->bpm)
+			+ self->max_block;
+		needed_pages = remus_pages_for((frames < MAX_BUFFER_SIZE) ? (uint32_t)frames : MAX_BUFFER_SIZE);
+	}
+	if (self->ring_pending || self->capture_pending) {
+		return;
+	}
+	
+	if (needed_pages == 0 && self->ring) {
+		const RemusWork retire = {
+			.type = REMUS_WORK_FREE, .table = self->ring, .n_pages = self->ring_pages
+		};
+		if (self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire)
+		    == LV2_WORKER_SUCCESS) {
+			self->ring = NULL;
+			self->ring_pages = 0;
+		}
+	} else if (needed_pages != self->ring_failed
+	           && (needed_pages > self->ring_pages || needed_pages * 2 < self->ring_pages)) {
+		const RemusWork job = {
+			.type = REMUS_WORK_RING, .table = self->ring, .n_pages = needed_pages,
+			.first = self->ring_pages
+		};
+		if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+		    == LV2_WORKER_SUCCESS) {
+			self->ring_pending = true;
+		}
+	}
+}
+
+/*
+ * Turn the bars before the last bar start into the loop, on a rising edge of
+ * the capture port, once per block. The loop length sets how many bars. The
+ * worker copies them out of the ring, and the loop plays from where the
+ * transport is in them once it replies.
+ */
+static void
+update_capture(Remus* self, float loop_len)
+{
+	const float value = self->capture ? *self->capture : 0.0f;
+	const bool  rising = value > 0.5f && self->prev_capture <= 0.5f;
+	
+	self->prev_capture = value;
+	if (!rising || !self->ring) {
+		return;
+	}
+	if (self->recording || self->recording_tail || self->waiting_for_bar || self->stitch_pending
+	    || self->stitch_scheduled || self->resize_pending || self->pack_pending || self->unpack_pending
+	    || self->ring_pending || self->capture_pending) {
+		REMUS_RT_LOG(&self->log, LOG_CAPTURE_BUSY, 0, 0, 0, 0);
+		return;
+	}
+	
+	// The bars must have been written since the ring started, and not overwritten since
+	const uint64_t capacity = (uint64_t)self->ring_pages * REMUS_PAGE_FRAMES;
+	const uint64_t oldest = (self->ring_pos > self->ring_valid + capacity)
+		? self->ring_pos - capacity : self->ring_valid;
+	const uint32_t length = loop_length_samples(self, loop_len, self->bpm);
+	const uint64_t held = (self->ring_bar > oldest) ? self->ring_bar - oldest : 0;
+	if (length == 0 || length > MAX_BUFFER_SIZE || held < length) {
+		REMUS_RT_LOG(&self->log, LOG_CAPTURE_MISSED, held, length, 0, 0);
+		return;
+	}
+	
+	// The crossfade needs the samples after the bars, once they are written
+	const bool crossfade = length >= CROSSFADE_SAMPLES && self->ring_pos - self->ring_bar >= CROSSFADE_SAMPLES;
+	const RemusWork job = {
+		.type = REMUS_WORK_CAPTURE, .table = self->ring, .n_pages = self->ring_pages,
+		.ring_start = self->ring_bar - length, .length = length, .tempo = self->bpm, .take = self->take,
+		.stitch_position = crossfade ? CROSSFADE_SAMPLES / 2 : 0
+	};
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->capture_pending = true;
+	}
+}
+
+/* Follow loop length and tempo changes, at the start of every segment */
+static void
+update_loop_length(Remus* remus, float loop_len)
+{
+	const uint32_t new_loop_samples = loop_length_samples(remus, loop_len, loop_tempo(remus));
+	const uint32_t max_samples = max_loop_samples(remus);
+	
+	// Fit the loop buffer to the loop length, never below what is in use
+	uint32_t needed_pages = remus_pages_for(
+		(new_loop_samples < max_samples) ? new_loop_samples : max_samples);
+	if (needed_pages < pinned_pages(remus)) {
+		needed_pages = pinned_pages(remus);
+	}
+	remus->resize_blocked = remus->packed && needed_pages > remus->n_pages;
+	if (needed_pages != remus->n_pages && needed_pages != remus->resize_failed
+	    && !remus->resize_pending && !remus->stitch_scheduled && !remus->packed
+	    && !remus->capture_pending) {
+		schedule_resize(remus, needed_pages);
+	}
+	update_ring(remus, loop_len);
+	
+	// Update loop length if parameters changed and not currently recording
+	if (!remus->recording && !remus->waiting_for_bar && remus->has_recorded) {
+		if (new_loop_samples != remus->loop_samples) {
+			remus->loop_samples = new_loop_samples;
+			if (remus->loop_samples > remus->buffer_size) {
+				remus->loop_samples = remus->buffer_size;
+			}
+			// Ensure read position is within new loop bounds
+			if (remus->read_pos >= remus->loop_samples) {
+				remus->read_pos = 0;
+				remus->read_frac = 0;
+			}
+		}
+	}
+	update_read_step(remus);
+	
+	// Handle playback alignment with transport, playback starts on a bar
+	if (remus->has_recorded && remus->loop_samples > 0 && !remus->recording) {
+		if (!remus->transport_rolling) {
+			// Transport stopped - stop playing
+			remus->playing = false;
+			remus->waiting_to_play = false;
+		} else if (!remus->playing) {
+			remus->waiting_to_play = true;
+		}
+	}
+}
+
+/* Ask for slot at the next bar start, out of range requests are ignored */
+static void
+request_slot(Remus* self, int64_t slot)
+{
+	if (slot >= 0 && slot < REMUS_MAX_SLOTS) {
+		self->next_slot = (uint32_t)slot;
+	}
+}
+
+/* Take a slot request from the slot port, when its value changes */
+static void
+update_slot(Remus* self)
+{
+	if (self->slot && *self->slot != self->prev_slot) {
+		self->prev_slot = *self->slot;
+		request_slot(self, (int64_t)*self->slot);
+	}
+}
+
+/* Ask for the slot of an Int, Long or Float atom */
+static void
+request_slot_value(Remus* self, const LV2_Atom* value)
+{
+	if (value->type == self->atom_Int) {
+		request_slot(self, ((const LV2_Atom_Int*)value)->body);
+	} else if (value->type == self->atom_Long) {
+		request_slot(self, ((const LV2_Atom_Long*)value)->body);
+	} else if (value->type == self->atom_Float) {
+		request_slot(self, (int64_t)((const LV2_Atom_Float*)value)->body);
+	}
+}
+
+/* Take a slot request from a patch:Set of the remus:slot property */
+static void
+update_patch(Remus* self, const LV2_Atom_Object* obj)
+{
+	const LV2_Atom* property = NULL;
+	const LV2_Atom* value = NULL;
+	
+	lv2_atom_object_get(obj,
+	                    self->patch_property, &property,
+	                    self->patch_value, &value,
+	                    NULL);
+	if (!property || property->type != self->atom_URID
+	    || ((const LV2_Atom_URID*)property)->body != self->remus_slot || !value) {
+		return;
+	}
+	
+	request_slot_value(self, value);
+}
+
+/*
+ * Drop the armed take or the take in progress, whose stitch becomes stale,
+ * and release the overdub of commands, which ends on the next bar start.
+ * With clear the loop is dropped too, it stays silent until the next take.
+ * Undo brings back the loop a take or a clear dropped.
+ */
+static void
+stop_take(Remus* self, bool clear)
+{
+	if (self->recording || (clear && (self->recording_tail || self->stitch_pending))) {
+		self->recording = false;
+		self->recording_tail = false;
+		self->stitch_pending = false;
+		self->stitch_position = 0;
+		self->tail_pos = 0;
+		self->take++;
+	}
+	
+	// The layer of a take ends with it, an armed take that wrote nothing leaves none
+	if (self->layer && !self->layer->overdub) {
+		if (self->layer->n_replaced == 0) {
+			discard_layer(self);
+		} else {
+			self->layer = NULL;
+		}
+	}
+	self->waiting_for_bar = false;
+	self->overdub_latched = false;
+	if (clear) {
+		// An overdub ends with the loop, the clear has a layer of its own
+		self->layer = NULL;
+		if (self->has_recorded && push_layer(self, false)) {
+			drop_redo(self);
+		}
+		self->has_recorded = false;
+		self->recorded_samples = 0;
+		self->overdubbing = false;
+		self->playing = false;
+		self->waiting_to_play = false;
+		self->take++;   // A capture in flight is dropped as well
+		self->edits++;
+		self->peaks_dirty = true;
+		REMUS_RT_LOG(&self->log, LOG_CLEARED, self->active_slot, 0, 0, 0);
+	}
+}
+
+/*
+ * Apply a remus:Command at its frame. Arm and overdub take effect on the
+ * next bar start like their ports, stop and clear at once, undo and redo on
+ * the next bar start without an edit in progress. Unknown actions,
+ * malformed commands and undo or redo past the history are ignored.
+ */
+static void
+apply_command(Remus* self, const LV2_Atom_Object* obj, float loop_len)
+{
+	const LV2_Atom* action = NULL;
+	const LV2_Atom* slot = NULL;
+	
+	lv2_atom_object_get(obj,
+	                    self->remus_action, &action,
+	                    self->remus_slot, &slot,
+	                    NULL);
+	if (!action || action->type != self->atom_URID) {
+		return;
+	}
+	
+	const LV2_URID name = ((const LV2_Atom_URID*)action)->body;
+	if (name == self->remus_arm) {
+		arm_take(self, loop_len);
+	} else if (name == self->remus_stop) {
+		stop_take(self, false);
+	} else if (name == self->remus_clear) {
+		stop_take(self, true);
+	} else if (name == self->remus_overdub) {
+		self->overdub_latched = !self->overdub_latched;
+	} else if (name == self->remus_select && slot) {
+		request_slot_value(self, slot);
+	} else if (name == self->remus_undo && self->undo_steps > -(int32_t)self->n_undo) {
+		self->undo_steps--;
+	} else if (name == self->remus_redo && self->undo_steps < (int32_t)self->n_redo) {
+		self->undo_steps++;
+	}
+}
+
+/* Whether no take, stitch or resize refers to the loop buffer, so it can be parked */
+static bool
+slot_switchable(const Remus* self)
+{
+	return !self->recording && !self->recording_tail && !self->stitch_pending
+		&& !self->stitch_scheduled && !self->resize_pending && !self->capture_pending;
+}
+
+/*
+ * Park the active loop and make slot the loop buffer. Only page tables are
+ * swapped: the next update_loop_length() fits the new table to the loop
+ * length through the worker, like after any loop length change.
+ */
+static void
+switch_slot(Remus* self, uint32_t slot, float loop_len)
+{
+	RemusSlot* parked = &self->slots[self->active_slot];
+	RemusSlot* next = &self->slots[slot];
+	
+	// Keep what was played or overdubbed past the take, an overdub goes on in a new layer
+	parked->pages = self->pages;
+	parked->packed = self->packed;
+	parked->n_pages = self->n_pages;
+	parked->recorded_samples = (self->has_recorded && self->loop_samples > self->recorded_samples)
+		? self->loop_samples : self->recorded_samples;
+	parked->has_recorded = self->has_recorded;
+	parked->take_bpm = self->take_bpm;
+	parked->undo = self->undo;
+	parked->redo = self->redo;
+	parked->n_undo = self->n_undo;
+	parked->n_redo = self->n_redo;
+	
+	self->pages = next->pages;
+	self->packed = next->packed;
+	self->n_pages = next->n_pages;
+	self->buffer_size = next->n_pages * REMUS_PAGE_FRAMES;
+	self->recorded_samples = next->recorded_samples;
+	self->has_recorded = next->has_recorded;
+	self->take_bpm = next->take_bpm;
+	self->undo = next->undo;
+	self->redo = next->redo;
+	self->n_undo = next->n_undo;
+	self->n_redo = next->n_redo;
+	self->layer = NULL;
+	self->undo_steps = 0;
+	self->resize_failed = 0;
+	memset(next, 0, sizeof(*next));
+	self->active_slot = slot;
+	self->window_dirty = true;
+	self->peaks_dirty = true;
+	self->edits++;
+	
+	// The new loop starts from its beginning on this bar
+	self->playing = false;
+	self->read_pos = 0;
+	self->read_frac = 0;
+	if (self->has_recorded) {
+		self->loop_samples = loop_length_samples(self, loop_len, loop_tempo(self));
+		if (self->loop_samples > self->buffer_size) {
+			self->loop_samples = self->buffer_size;
+		}
+	}
+	REMUS_RT_LOG(&self->log, LOG_SLOT_SWITCHED, slot, self->has_recorded ? self->recorded_samples : 0, 0, 0);
+}
+
+/*
+ * Make the loops of a restore the loops of every slot. The replaced loops
+ * are parked in restored, which becomes the retired restore.
+ */
+static void
+swap_restore(Remus* self, RemusRestore* restored)
+{
+	RemusSlot* parked = &self->slots[self->active_slot];
+	parked->pages = self->pages;
+	parked->packed = self->packed;
+	parked->n_pages = self->n_pages;
+	parked->undo = self->undo;
+	parked->redo = self->redo;
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		const RemusSlot slot = self->slots[s];
+		self->slots[s] = restored->slots[s];
+		restored->slots[s] = slot;
+	}
+	
+	RemusSlot* loop = &self->slots[restored->active_slot];
+	self->pages = loop->pages;
+	self->packed = loop->packed;
+	self->n_pages = loop->n_pages;
+	self->buffer_size = loop->n_pages * REMUS_PAGE_FRAMES;
+	self->loop_samples = loop->recorded_samples;
+	self->recorded_samples = loop->recorded_samples;
+	self->has_recorded = loop->has_recorded;
+	self->take_bpm = loop->take_bpm;
+	self->undo = NULL;
+	self->redo = NULL;
+	self->layer = NULL;
+	self->n_undo = 0;
+	self->n_redo = 0;
+	self->undo_steps = 0;
+	memset(loop, 0, sizeof(*loop));
+	self->active_slot = restored->active_slot;
+	self->next_slot = restored->active_slot;
+	self->disk_used |= restored->disk_used;
+	self->resize_failed = 0;
+	self->pack_failed = false;
+	self->window_dirty = true;
+	self->peaks_dirty = true;
+	self->retired = restored;
+	
+	// Takes and overdubs of the replaced loop end here, their stitches and
+	// packs still in flight are stale. The restored loop starts on a bar
+	self->recording = false;
+	self->recording_tail = false;
+	self->waiting_for_bar = false;
+	self->stitch_pending = false;
+	self->stitch_position = 0;
+	self->tail_pos = 0;
+	self->overdubbing = false;
+	self->take++;
+	self->edits++;
+	self->playing = false;
+	self->read_pos = 0;
+	self->read_frac = 0;
+	self->debug_logged = false;
+}
+
+/*
+ * Take the loops published by restore(), at the start of a block. A resize
+ * in flight would reply with pages of the replaced table: the restore waits
+ * for it. The replaced loops are handed to the worker, again at the next
+ * block if its queue is full.
+ */
+static void
+take_restore(Remus* self)
+{
+	if (!self->retired && !self->resize_pending
+	    && atomic_load_explicit(&self->staged, memory_order_relaxed)) {
+		swap_restore(self, atomic_exchange_explicit(&self->staged, NULL, memory_order_acquire));
+	}
+	if (self->retired) {
+		const RemusWork retire = { .type = REMUS_WORK_FREE, .restored = self->retired };
+		if (self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire)
+		    == LV2_WORKER_SUCCESS) {
+			self->retired = NULL;
+		}
+	}
+}
+
+/* The transport is on the first sample of a bar */
+static void
+bar_start(Remus* remus, float loop_len)
+{
+	// Captures end on the last bar start
+	remus->ring_bar = remus->ring_pos;
+	
+	// Switch loop slots between takes
+	if (remus->next_slot != remus->active_slot && slot_switchable(remus)) {
+		switch_slot(remus, remus->next_slot, loop_len);
+	}
+	
+	// Packing, unpacking, peaks or history that ran out of memory are retried once per bar
+	remus->pack_failed = false;
+	remus->peaks_failed = false;
+	remus->history_failed = false;
+	
+	// Begin armed recording, once the buffer is unpacked and can hold the take
+	if (remus->waiting_for_bar && remus->loop_samples <= remus->buffer_size && !remus->packed) {
+		remus->recording = true;
+		remus->edits++;
+		remus->waiting_for_bar = false;
+		remus->write_pos = 0;
+		remus->read_pos = 0;
+		remus->read_frac = 0;
+		remus->has_recorded = false;
+		remus->stitch_pending = false;
+		remus->take++;
+		drop_redo(remus);
+	}
+	
+	// Undo and redo between edits
+	step_history(remus);
+	
+	// Begin pending playback
+	if (remus->has_recorded && remus->loop_samples > 0 && !remus->recording
+	    && remus->transport_rolling && !remus->playing) {
+		remus->playing = true;
+		remus->waiting_to_play = false;
+		remus->read_pos = 0;
+		remus->read_frac = 0;
+	}
+	
+	// Overdub layers start and stop on bars, over a loop playing at its own tempo only
+	const bool overdub = overdub_requested(remus)
+		&& remus->playing && remus->has_recorded && !remus->recording && !remus->packed
+		&& !remus->read_step;
+	if (overdub != remus->overdubbing) {
+		remus->overdubbing = overdub;
+		remus->edits += overdub;
+		REMUS_RT_LOG(&remus->log, overdub ? LOG_OVERDUB_STARTED : LOG_OVERDUB_STOPPED,
+		             remus->active_slot, 0, 0, 0);
+	}
+	
+	// Each overdub has its layer, also when it goes on over another slot
+	if (overdub && !remus->layer) {
+		remus->layer = push_layer(remus, true);
+		drop_redo(remus);
+	} else if (!overdub && remus->layer && remus->layer->overdub) {
+		remus->layer = NULL;
+	}
+}
+
+/*
+ * Prepare the tail of a filled take: latch the stitch search mode and index
+ * the zero-crossings of the loop start, once, for the tail search.
+ */
+static void
+start_tail(Remus* remus)
+{
+	const uint32_t head = (remus->loop_samples < HEAD_INDEX_SIZE) ? remus->loop_samples : HEAD_INDEX_SIZE;
+	
+	// Channels are searched on their mix, like the tail
+	const float* signal = loop_page(remus, 0, 0);
+	if (remus->n_channels > 1) {
+		const float* heads[REMUS_MAX_CHANNELS];
+		for (uint32_t c = 0; c < remus->n_channels; c++) {
+			heads[c] = loop_page(remus, c, 0);
+		}
+		remus_mix_down(remus->head_mix, heads, remus->n_channels, head);
+		signal = remus->head_mix;
+	}
+	
+	memset(remus->head_rising, 0, sizeof(remus->head_rising));
+	memset(remus->head_falling, 0, sizeof(remus->head_falling));
+	remus->kernels->zero_crossings(signal, head, remus->head_rising, remus->head_falling);
+	
+	// The correlation windows must stay within the tail and the loop
+	uint32_t window = remus->stitch_search ? (uint32_t)fmaxf(*remus->stitch_search, 0.0f) : 0;
+	if (window > TAIL_CAPACITY - CROSSFADE_SAMPLES / 2) {
+		window = TAIL_CAPACITY - CROSSFADE_SAMPLES / 2;
+	}
+	if (window + CROSSFADE_SAMPLES / 2 > remus->loop_samples) {
+		window = 0;
+	}
+	remus->stitch_window = (window >= CROSSFADE_SAMPLES / 2) ? window : 0;
+}
+
+/*
+ * Record one tail sample, mixed down over channels, and look for a
+ * zero-crossing matching the loop start
+ */
+static void
+record_tail_sample(Remus* remus, float in)
+{
+	if (remus->stitch_window > 0) {
+		// Collect the search window, the worker picks the stitch point by correlation
+		remus->tail_search[remus->tail_pos++] = in;
+		if (remus->tail_pos >= remus->stitch_window + CROSSFADE_SAMPLES / 2) {
+			REMUS_RT_LOG(&remus->log, LOG_STITCH_COLLECTED, remus->tail_pos, 0, 0, 0);
+			remus->recording_tail = false;
+			remus->stitch_pending = true;
+		}
+		return;
+	}
+	
+	if (remus->tail_pos < TAIL_BUFFER_SIZE) {
+		remus->tail_search[remus->tail_pos] = in;
+		remus->tail_pos++;
+		
+		// Start searching after we have at least 2 samples (need at least one crossing)
+		if (remus->tail_pos >= 2) {
+			// Check if we just crossed zero in the tail buffer
+			bool tail_crossing = false;
+			bool tail_positive = false;
+			uint32_t t = remus->tail_pos - 1;
+			
+			if ((remus->tail_search[t-1] < 0.0f && remus->tail_search[t] >= 0.0f)) {
+				tail_crossing = true;
+				tail_positive = true;
+			} else if ((remus->tail_search[t-1] > 0.0f && remus->tail_search[t] <= 0.0f)) {
+				tail_crossing = true;
+				tail_positive = false;
+			}
+			
+			if (tail_crossing) {
+				// Count this zero-crossing
+				remus->tail_zero_crossings++;
+				
+				// Search for matching zero-crossing in loop start, from the index
+				// Search relative to tail_pos, within ±ZERO_CROSSING_DISTANCE samples
+				uint32_t loop_search_start = (t > ZERO_CROSSING_DISTANCE) ? (t - ZERO_CROSSING_DISTANCE) : 1;
+				uint32_t loop_search_end = (t + ZERO_CROSSING_DISTANCE < remus->loop_samples) ? (t + ZERO_CROSSING_DISTANCE) : remus->loop_samples - 1;
+				uint64_t matches = 0;
+				if (loop_search_end >= loop_search_start) {
+					matches = remus_mask_bits(tail_positive ? remus->head_rising : remus->head_falling,
+					                          loop_search_start, loop_search_end - loop_search_start + 1);
+				}
+				
+				// Crossings in the same direction, closest to the loop start first
+				for (; matches; matches &= matches - 1) {
+					const uint32_t l = loop_search_start + (uint32_t)__builtin_ctzll(matches);
+					int32_t distance = abs((int32_t)t - (int32_t)l);
+					
+					// Track minimum distance
+					if (distance < remus->tail_min_distance) {
+						remus->tail_min_distance = distance;
+					}
+
+					// Calculate midpoint
+					uint32_t midpoint = (t + l) / 2;
+
+					// Match found within threshold and crossfade is possible
+					if (distance <= ZERO_CROSSING_DISTANCE 
+						&& midpoint >= (CROSSFADE_SAMPLES / 2)
+						&& midpoint + 1 < (TAIL_BUFFER_SIZE - CROSSFADE_SAMPLES / 2)
+						&& remus->stitch_position == 0) {  // Only set once
+						// Set the stitch position to the midpoint between the two zero-crossings
+						remus->stitch_position = midpoint + 1;
+						remus_stats_tail(&remus->stats, distance, remus->tail_min_distance);
+						
+						REMUS_RT_LOG(&remus->log,
+						             tail_positive ? LOG_STITCH_MATCH_RISING : LOG_STITCH_MATCH_FALLING,
+						             t, l, distance, midpoint);
+						REMUS_RT_LOG(&remus->log, LOG_STITCH_COLLECTING,
+						             remus->stitch_position + CROSSFADE_SAMPLES / 2 - remus->tail_pos, 0, 0, 0);
+						break;
+					}
+				}
+			}
+		}
+		
+		// Check if we have enough samples for crossfade after finding a match
+		if (remus->stitch_position > 0) {
+			uint32_t samples_needed = remus->stitch_position + CROSSFADE_SAMPLES / 2;
+			if (remus->tail_pos >= samples_needed) {
+				REMUS_RT_LOG(&remus->log, LOG_STITCH_COLLECTED, remus->tail_pos, 0, 0, 0);
+				remus->recording_tail = false;
+				remus->stitch_pending = true;
+			}
+		}
+		
+		// Check if tail buffer is full without finding a match
+		if (remus->tail_pos >= TAIL_BUFFER_SIZE && remus->stitch_position == 0) {
+			// Choose closest position able to crossfade
+			remus->stitch_position = CROSSFADE_SAMPLES / 2;
+			REMUS_RT_LOG(&remus->log, LOG_TAIL_FULL, remus->stitch_position, 0, 0, 0);
+			
+			remus->recording_tail = false;
+			remus->stitch_pending = true;
+			remus_stats_tail(&remus->stats, -1,
+			                 (remus->tail_min_distance < TAIL_BUFFER_SIZE) ? remus->tail_min_distance : -1);
+			if (remus->tail_min_distance < TAIL_BUFFER_SIZE) {
+				REMUS_RT_LOG(&remus->log, LOG_UNALIGNED_DISTANCE,
+				             remus->tail_zero_crossings, remus->tail_min_distance, 0, 0);
+			} else {
+				REMUS_RT_LOG(&remus->log, LOG_UNALIGNED, remus->tail_zero_crossings, 0, 0, 0);
+			}
+		}
+	}
+}
+
+/* Hand the completed tail to the worker, which stitches it into the loop start */
+static void
+schedule_stitch(Remus* self)
+{
+	RemusWork job = {
+		.type = REMUS_WORK_STITCH, .tail = self->tail_buffer[0], .search = self->tail_search,
+		.stitch_position = self->stitch_position, .window = self->stitch_window, .take = self->take
+	};
+	for (uint32_t c = 0; c < self->n_channels; c++) {
+		job.head[c] = loop_page(self, c, 0);
+	}
+	
+	if (self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job)
+	    == LV2_WORKER_SUCCESS) {
+		self->stitch_scheduled = true;
+	}
+}
+
+/*
+ * Output n samples of the loop resampled to the transport tempo, wrapping at
+ * its end. Each chunk reads the taps it needs from the loop, packed or not,
+ * then filters them: the cost per sample is bounded by the tempo ratio and
+ * the filter length.
+ */
+static inline __attribute__((always_inline)) void
+play_resampled(Remus* remus, uint32_t offset, uint32_t n_samples, const uint32_t n_channels)
+{
+	const RemusFilter* filter = remus->filters[follow_quality(remus)][remus->read_band];
+	const uint32_t     lead = (filter->n_taps / 2 - 1) % remus->loop_samples;  // Taps before read_pos
+	
+	while (n_samples > 0) {
+		const uint32_t chunk = (n_samples < RESAMPLE_CHUNK) ? n_samples : RESAMPLE_CHUNK;
+		const uint64_t last = remus->read_frac + (uint64_t)(chunk - 1) * remus->read_step;
+		const uint32_t n_src = (uint32_t)(last >> 32) + filter->n_taps;
+		const uint32_t first = (uint32_t)(((uint64_t)remus->read_pos + remus->loop_samples - lead)
+		                                  % remus->loop_samples);
+		for (uint32_t c = 0; c < n_channels; c++) {
+			loop_read_wrapped(remus, c, first, remus->resample_in, n_src);
+			remus->kernels->resample(filter, remus->resample_in, remus->read_frac, remus->read_step,
+			                         remus->audio_out[c] + offset, chunk);
+		}
+		
+		const uint64_t end = remus->read_frac + (uint64_t)chunk * remus->read_step;
+		remus->read_pos = (uint32_t)(((uint64_t)remus->read_pos + (end >> 32)) % remus->loop_samples);
+		remus->read_frac = (uint32_t)end;
+		offset += chunk;
+		n_samples -= chunk;
+	}
+}
+
+/*
+ * Output n samples of the loop, wrapping at its end, or silence when not
+ * playing. An overdub mixes the input into the loop after it is read.
+ */
+static inline __attribute__((always_inline)) void
+play_span(Remus* remus, uint32_t offset, uint32_t n_samples, const uint32_t n_channels)
+{
+	if (!remus->playing || !remus->has_recorded || remus->loop_samples == 0 || remus->waiting_for_bar) {
+		for (uint32_t c = 0; c < n_channels; c++) {
+			remus_zero(remus->audio_out[c] + offset, n_samples);
+		}
+		return;
+	} else if (remus->read_step && !remus->overdubbing) {
+		play_resampled(remus, offset, n_samples, n_channels);
+		return;
+	}
+	
+	while (n_samples > 0) {
+		uint32_t chunk = remus->loop_samples - remus->read_pos;
+		if (chunk > n_samples) {
+			chunk = n_samples;
+		}
+		if (remus->overdubbing && remus->layer && remus->layer->copy_on_write) {
+			layer_replace(remus, remus->read_pos, chunk, true);
+		}
+		for (uint32_t c = 0; c < n_channels; c++) {
+			loop_read(remus, c, remus->read_pos, remus->audio_out[c] + offset, chunk);
+			if (remus->overdubbing) {
+				loop_mix(remus, c, remus->read_pos, remus->audio_in[c] + offset, chunk);
+			}
+		}
+		if (remus->overdubbing) {
+			peaks_touch(remus, remus->read_pos, chunk);
+		}
+		
+		remus->read_pos += chunk;
+		if (remus->read_pos >= remus->loop_samples) {
+			remus->read_pos = 0;
+		}
+		offset += chunk;
+		n_samples -= chunk;
+	}
+}
+
+/*
+ * Process samples that do not contain a bar start, except maybe the first.
+ *
+ * The samples are cut in spans where the state does not change: a take is
+ * copied to the loop in bulk, the tail is searched sample by sample, and the
+ * output of each span is a bulk copy of the loop or silence. Stitching the
+ * tail into the loop is left to the worker.
+ *
+ * Inlined with a constant n_channels by the process_* variants below.
+ */
+static inline __attribute__((always_inline)) void
+process_samples(Remus* remus, uint32_t offset, uint32_t n_samples, const uint32_t n_channels)
+{
+	while (n_samples > 0) {
+		uint32_t span = n_samples;
+		
+		if (remus->recording) {
+			// Record input to buffer, up to the end of the loop
+			if (remus->write_pos < remus->loop_samples) {
+				if (span > remus->loop_samples - remus->write_pos) {
+					span = remus->loop_samples - remus->write_pos;
+				}
+				if (remus->layer && remus->layer->copy_on_write) {
+					layer_replace(remus, remus->write_pos, span, false);
+				}
+				for (uint32_t c = 0; c < n_channels; c++) {
+					loop_write(remus, c, remus->write_pos, remus->audio_in[c] + offset, span);
+				}
+				peaks_touch(remus, remus->write_pos, span);
+				remus->write_pos += span;
+			}
+			
+			// If we've filled the loop, start tail recording
+			if (remus->loop_samples > 0 && remus->write_pos >= remus->loop_samples) {
+				remus->recording = false;
+				remus->recording_tail = true;
+				remus->recorded_samples = remus->loop_samples;
+				remus->layer = NULL;
+				remus->tail_pos = 0;
+				remus->tail_zero_crossings = 0;
+				remus->tail_min_distance = TAIL_BUFFER_SIZE;
+				remus->stitch_position = 0;
+				start_tail(remus);
+				REMUS_RT_LOG(&remus->log, LOG_LOOP_FILLED, remus->loop_samples, 0, 0, 0);
+			}
+		} else if (remus->recording_tail) {
+			// Record into tail buffer until a stitch point is collected
+			for (span = 0; span < n_samples && remus->recording_tail; span++) {
+				const uint32_t i = offset + span;
+				float mix = remus->audio_in[0][i];
+				if (n_channels > 1) {
+					remus->tail_buffer[0][remus->tail_pos] = mix;
+					for (uint32_t c = 1; c < n_channels; c++) {
+						remus->tail_buffer[c][remus->tail_pos] = remus->audio_in[c][i];
+						mix += remus->audio_in[c][i];
+					}
+					mix *= 1.0f / (float)n_channels;
+				}
+				record_tail_sample(remus, mix);
+			}
+		}
+		
+		play_span(remus, offset, span, n_channels);
+		
+		offset += span;
+		n_samples -= span;
+	}
+}
+
+static void
+process_mono(Remus* self, uint32_t offset, uint32_t n_samples)
+{
+	process_samples(self, offset, n_samples, 1);
+}
+
+static void
+process_stereo(Remus* self, uint32_t offset, uint32_t n_samples)
+{
+	process_samples(self, offset, n_samples, 2);
+}
+
+static void
+process_multi(Remus* self, uint32_t offset, uint32_t n_samples)
+{
+	process_samples(self, offset, n_samples, self->n_channels);
+}
+
+/*
+ * Process a segment of the block between two transport events, splitting it
+ * at every bar start so that recording and playback begin on that sample.
+ */
+static void
+run_segment(Remus* remus, uint32_t offset, uint32_t n_samples, float loop_len)
+{
+	update_loop_length(remus, loop_len);
+	
+	while (n_samples > 0) {
+		uint32_t chunk = frames_to_bar(remus, 0, n_samples);
+		if (chunk == 0) {
+			bar_start(remus, loop_len);
+			chunk = 1 + frames_to_bar(remus, 1, n_samples - 1);
+		}
+		
+		// The ring takes the input before the output may overwrite it in place
+		if (remus->ring && remus->transport_rolling) {
+			ring_write(remus, offset, chunk);
+		}
+		remus->process(remus, offset, chunk);
+		
+		remus->transport_frame += chunk;
+		advance_bar_phase(remus, chunk);
+		offset += chunk;
+		n_samples -= chunk;
+	}
+}
+
+/*
+ * Process a block with events in segments, applying each event at its frame.
+ * Controls are read before the first segment, after the events at frame 0.
+ */
+static void
+run_events(Remus* remus, uint32_t n_samples, float rec_enable, float loop_len)
+{
+	uint32_t offset = 0;
+	bool     controls_done = false;
+	LV2_ATOM_SEQUENCE_FOREACH(remus->time, ev) {
+		uint32_t frame = (ev->time.frames < 0) ? 0 : (uint32_t)ev->time.frames;
+		if (frame < offset) {
+			frame = offset;
+		} else if (frame > n_samples) {
+			frame = n_samples;
+		}
+		
+		if (frame > offset) {
+			if (!controls_done) {
+				update_record_enable(remus, rec_enable, loop_len);
+				update_slot(remus);
+				update_capture(remus, loop_len);
+				controls_done = true;
+			}
+			run_segment(remus, offset, frame - offset, loop_len);
+			offset = frame;
+		}
+		
+		if (ev->body.type == remus->atom_Blank || ev->body.type == remus->atom_Object) {
+			const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+			if (obj->body.otype == remus->time_Position) {
+				RemusPosition pos;
+				parse_position(remus, obj, &pos);
+				if (!remus->freewheeling || !position_confirms(remus, &pos)) {
+					update_transport(remus, &pos);
+				}
+			} else if (obj->body.otype == remus->patch_Set) {
+				update_patch(remus, obj);
+			} else if (obj->body.otype == remus->remus_Command) {
+				apply_command(remus, obj, loop_len);
+			}
+		}
+	}
+	
+	if (!controls_done) {
+		update_record_enable(remus, rec_enable, loop_len);
+		update_slot(remus);
+		update_capture(remus, loop_len);
+	}
+	if (offset < n_samples) {
+		run_segment(remus, offset, n_samples - offset, loop_len);
+	}
+}
+
+/* State of the block just processed, for the stats */
+static RemusBlockState
+block_state(const Remus* self)
+{
+	if (self->recording || self->recording_tail) {
+		return REMUS_BLOCK_RECORDING;
+	} else if (self->overdubbing) {
+		return REMUS_BLOCK_OVERDUBBING;
+	} else if (self->waiting_for_bar) {
+		return REMUS_BLOCK_ARMED;
+	}
+	return self->playing ? REMUS_BLOCK_PLAYING : REMUS_BLOCK_IDLE;
+}
+
+/*
+ * Add the bytes of a loop in memory and on disk. Only pages past the loop
+ * start can be on disk, a table has them if its first such page is.
+ */
+static void
+table_bytes(const Remus* self, float* const* table, uint32_t n_pages, const RemusPack* packed,
+            uint64_t* memory_bytes, uint64_t* disk_bytes)
+{
+	const uint64_t page_bytes = (uint64_t)REMUS_PAGE_FRAMES * sizeof(float) * self->n_channels;
+	if (packed) {
+		*memory_bytes += (uint64_t)packed->n_entries * packed->page_bytes;
+		return;
+	}
+	
+	// Disk pages exist once a table holding them was swapped in, with the disk open
+	uint32_t n_memory = n_pages;
+	if (table && self->disk_used && n_pages > DISK_HEAD_PAGES
+	    && remus_disk_owns(&self->disk, table[DISK_HEAD_PAGES * self->n_channels])) {
+		n_memory = DISK_HEAD_PAGES;
+	}
+	*memory_bytes += n_memory * page_bytes;
+	*disk_bytes += (n_pages - n_memory) * page_bytes;
+}
+
+/* Pages kept by a chain of layers */
+static uint64_t
+layer_pages(const Remus* self, const RemusLayer* layer)
+{
+	uint64_t n = 0;
+	for (; layer; layer = layer->next) {
+		n += (uint64_t)layer->n_replaced * self->n_channels;
+	}
+	return n;
+}
+
+/* Bytes of the loops of every slot, their history and the capture ring, in memory and on disk */
+static void
+loop_bytes(const Remus* self, uint64_t* memory_bytes, uint64_t* disk_bytes)
+{
+	uint64_t n_pages = self->ring_pages * self->n_channels + self->n_reserve
+		+ layer_pages(self, self->undo) + layer_pages(self, self->redo);
+	table_bytes(self, self->pages, self->n_pages, self->packed, memory_bytes, disk_bytes);
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		table_bytes(self, self->slots[s].pages, self->slots[s].n_pages, self->slots[s].packed,
+		            memory_bytes, disk_bytes);
+		n_pages += layer_pages(self, self->slots[s].undo) + layer_pages(self, self->slots[s].redo);
+	}
+	*memory_bytes += n_pages * REMUS_PAGE_FRAMES * sizeof(float);
+}
+
+static void
+run(LV2_Handle instance, uint32_t n_samples)
+{
+	Remus* remus = (Remus*)instance;
+	atomic_fetch_add(&remus->audio_gen, 1);
+	
+	// Blocks rendered offline are neither timed nor counted in the stats
+	remus->freewheeling = remus->freewheel && *remus->freewheel > 0.5f;
+	const uint64_t start = (remus->stats_port && !remus->freewheeling) ? remus_stats_clock() : 0;
+	
+	take_restore(remus);
+	
+	// One-time debug log after restore
+	if (!remus->debug_logged && remus->has_recorded) {
+		REMUS_RT_LOG(&remus->log, LOG_RUN_RESTORED, remus->has_recorded,
+		             remus->loop_samples, remus->recording, remus->waiting_for_bar);
+		remus->debug_logged = true;
+	}
+	
+	const float rec_enable = *remus->record_enable;
+	const float loop_len   = *remus->loop_length;
+	
+	// Hosts sending a position only when it changes leave most sequences
+	// empty: the bar phase carries on and the block is a single segment
+	if (remus->time->atom.size <= sizeof(LV2_Atom_Sequence_Body)) {
+		update_record_enable(remus, rec_enable, loop_len);
+		update_slot(remus);
+		update_capture(remus, loop_len);
+		run_segment(remus, 0, n_samples, loop_len);
+	} else {
+		run_events(remus, n_samples, rec_enable, loop_len);
+	}
+	
+	// Stitch a completed take, the loop pages must not change under a resize
+	if (remus->stitch_pending && !remus->stitch_scheduled && !remus->resize_pending) {
+		schedule_stitch(remus);
+	}
+	
+	// Keep the disk pages of long loops in memory ahead of the positions
+	if (remus->disk_used) {
+		schedule_window(remus);
+	}
+	
+	// Pack the loop while it is idle
+	update_storage(remus);
+	update_peaks(remus);
+	update_history(remus);
+	
+	// Update recording status outputs
+	if (remus->recording_status) {
+		*remus->recording_status = (remus->recording || remus->recording_tail) ? 1.0f : 0.0f;
+	}
+	if (remus->armed_status) {
+		*remus->armed_status = remus->waiting_for_bar ? 1.0f : 0.0f;
+	}
+	if (remus->recorded_status) {
+		*remus->recorded_status = remus->has_recorded ? 1.0f : 0.0f;
+	}
+	
+#if REMUS_DIAGNOSTICS
+	// Hand queued diagnostics to the worker for formatting, while freewheeling
+	// only once half the ring is used, the rest waits for real time
+	if ((!remus->freewheeling || remus_log_backlog(&remus->log) >= REMUS_LOG_RING_SIZE / 2)
+	    && remus_log_begin_drain(&remus->log)) {
+		const RemusWork job = { .type = REMUS_WORK_LOG };
+		if (remus->schedule->schedule_work(remus->schedule->handle, sizeof(job), &job)
+		    != LV2_WORKER_SUCCESS) {
+			remus_log_cancel_drain(&remus->log);
+		}
+	}
+#endif
+	
+	// Count the block, its stats are reported once per interval
+	if (remus->stats_port) {
+		uint64_t memory_bytes = 0;
+		uint64_t disk_bytes = 0;
+		if (!remus->freewheeling) {
+			remus_stats_block(&remus->stats, n_samples, remus_stats_clock() - start, block_state(remus));
+		}
+		if (remus_stats_due(&remus->stats)) {
+			loop_bytes(remus, &memory_bytes, &disk_bytes);
+		}
+		remus_stats_write(&remus->stats, remus->stats_port, memory_bytes, disk_bytes);
+	}
+	
+	// Send the waveform bins written or rebuilt since the last block
+	if (remus->peaks_port) {
+		remus_peak_port_write(&remus->peak_port, remus->peaks_port, remus->peaks, shown_length(remus));
+	}
+	atomic_fetch_add(&remus->audio_gen, 1);
+}
+
+static void
+deactivate(LV2_Handle instance)
+{
+	// Nothing to do here
+}
+
+static void
+cleanup(LV2_Handle instance)
+{
+	Remus* remus = (Remus*)instance;
+	release_deferred(remus, true);
+	table_release(remus, remus->pages, remus->n_pages * remus->n_channels, 0);
+	remus_pack_free(remus->packed);
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		table_release(remus, remus->slots[s].pages, remus->slots[s].n_pages * remus->n_channels, 0);
+		remus_pack_free(remus->slots[s].packed);
+		layers_free(remus, remus->slots[s].undo);
+		layers_free(remus, remus->slots[s].redo);
+	}
+	layers_free(remus, remus->undo);
+	layers_free(remus, remus->redo);
+	layers_free(remus, remus->spare);
+	layers_free(remus, remus->retired_layers);
+	for (uint32_t i = 0; i < remus->n_reserve; i++) {
+		page_release(remus, remus->reserve[i]);
+	}
+	table_release(remus, remus->ring, remus->ring_pages * remus->n_channels, 0);
+	remus_peaks_free(remus->peaks);
+	restore_free(remus, atomic_load(&remus->staged));
+	restore_free(remus, remus->retired);
+	remus_filters_unref();
+	remus_disk_close(&remus->disk);
+	remus_files_close(&remus->files);
 	free(remus);
+	remus_pool_unref();
+}
+
+/* Host features for loop files, NULL if the host does not provide them */
+typedef struct {
+	const LV2_State_Make_Path* make;
+	const LV2_State_Map_Path*  map;
+	const LV2_State_Free_Path* free;
+} RemusPaths;
+
+static RemusPaths
+state_paths(const LV2_Feature* const* features)
+{
+	RemusPaths paths = { NULL, NULL, NULL };
+	
+	for (int i = 0; features && features[i]; i++) {
+		if (!strcmp(features[i]->URI, LV2_STATE__makePath)) {
+			paths.make = (const LV2_State_Make_Path*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_STATE__mapPath)) {
+			paths.map = (const LV2_State_Map_Path*)features[i]->data;
+		} else if (!strcmp(features[i]->URI, LV2_STATE__freePath)) {
+			paths.free = (const LV2_State_Free_Path*)features[i]->data;
+		}
+	}
+	return paths;
+}
+
+/* Free a path returned by the host */
+static void
+free_path(const RemusPaths* paths, char* path)
+{
+	if (paths->free) {
+		paths->free->free_path(paths->free->handle, path);
+	} else {
+		free(path);
+	}
+}
+
+/*
+ * Save the loop to the loop file name in the state directory and store its
+ * path under key. Returns false if the host cannot make paths or the file
+ * cannot be written.
+ */
+static bool
+store_loop_file(Remus*                   remus,
+                LV2_State_Store_Function store,
+                LV2_State_Handle         handle,
+                const RemusPaths*        paths,
+                LV2_URID                 key,
+                const char*              name,
+                float* const*            table,
+                uint32_t                 n_samples)
+{
+	if (!paths->make || !paths->map) {
+		return false;
+	}
+	
+	char* path = paths->make->path(paths->make->handle, name);
+	if (!path) {
+		return false;
+	}
+	bool stored = false;
+	if (remus_file_write(path, table, remus->n_channels, n_samples)) {
+		char* abstract = paths->map->abstract_path(paths->map->handle, path);
+		if (abstract) {
+			stored = store(handle, key, abstract, strlen(abstract) + 1, remus->atom_Path,
+			               LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE) == LV2_STATE_SUCCESS;
+			free_path(paths, abstract);
+		}
+	} else {
+		REMUS_ERROR(&remus->log, "REMUS: Cannot write loop file %s, saving it inline\n", path);
+	}
+	free_path(paths, path);
+	return stored;
 }
 
+/* Store the loop under key as a vector of floats, one channel after the other, returns the status of store() */
 static LV2_State_Status
-save(LV2_Handle                instance,
-     LV2_State_Store_Function  store,
-     LV2_State_Handle          handle,
-     uint32_t                  flags,
-     const LV2_Feature* const* features)
+store_loop_inline(Remus*                   remus,
+                  LV2_State_Store_Function store,
+                  LV2_State_Handle         handle,
+                  LV2_URID                 key,
+                  float* const*            table,
+                  uint32_t                 n_samples)
 {
-	Remus* remus = (Remus*)instance;
+	// Gather the loop pages into one contiguous block
+	const size_t n_floats = (size_t)n_samples * remus->n_channels;
+	float* samples = (float*)malloc(n_floats * sizeof(float));
+	if (!samples) {
+		REMUS_ERROR(&remus->log, "REMUS: Out of memory saving %u samples\n", n_samples);
+		return LV2_STATE_ERR_NO_SPACE;
+	}
+	for (uint32_t c = 0; c < remus->n_channels; c++) {
+		table_read(table, remus->n_channels, c, 0, samples + (size_t)c * n_samples, n_samples);
+	}
 	
-	fprintf(stderr, "REMUS: save() called - persist_enable=%f, has_recorded=%d, loop_samples=%u\n",
-	        *remus->persist_enable, remus->has_recorded, remus->loop_samples);
+	// Save the loop buffer as a vector of floats, the host may refuse it
+	const LV2_State_Status st = store(handle, key,
+	                                  samples,
+	                                  n_floats * sizeof(float),
+	                                  remus->atom_Float,
+	                                  LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+	if (st != LV2_STATE_SUCCESS) {
+		REMUS_ERROR(&remus->log, "REMUS: Host refused to store %u samples\n", n_samples);
+	}
+	free(samples);
+	return st;
+}
+
+/*
+ * Store the first n_samples of every channel of a loop under key: in a loop
+ * file if the host can make paths, otherwise inline. Packed loops are
+ * unpacked first, they are saved as floats.
+ */
+static LV2_State_Status
+store_loop(Remus*                   remus,
+           LV2_State_Store_Function store,
+           LV2_State_Handle         handle,
+           const RemusPaths*        paths,
+           LV2_URID                 key,
+           const char*              name,
+           float* const*            table,
+           const RemusPack*         packed,
+           uint32_t                 n_samples)
+{
+	const uint32_t n_entries = remus_pages_for(n_samples) * remus->n_channels;
+	float**        unpacked = NULL;
+	if (packed && !(table = unpacked = unpack_table(remus, packed, n_entries))) {
+		REMUS_ERROR(&remus->log, "REMUS: Out of memory saving %u samples\n", n_samples);
+		return LV2_STATE_ERR_NO_SPACE;
+	}
 	
-	// Check if persistence is enabled
-	if (*remus->persist_enable < 0.5f) {
-		fprintf(stderr, "REMUS: Persistence disabled, not saving\n");
-		return LV2_STATE_SUCCESS;  // Don't save if disabled
+	LV2_State_Status st = LV2_STATE_SUCCESS;
+	if (!store_loop_file(remus, store, handle, paths, key, name, table, n_samples)) {
+		st = store_loop_inline(remus, store, handle, key, table, n_samples);
+	}
+	table_release(remus, unpacked, n_entries, 0);
+	return st;
+}
+
+/*
+ * Copy the loops of the instance at a point where the audio thread is out of
+ * run() and work_response(), the only places that swap their tables. Blocks
+ * leave it most of the time, so this rarely waits.
+ */
+static void
+snapshot_loops(Remus* self, RemusSaved* saved)
+{
+	for (;;) {
+		const unsigned gen = atomic_load(&self->audio_gen);
+		if (!(gen & 1)) {
+			saved->active_slot = self->active_slot;
+			saved->active = (RemusSavedLoop){
+				self->pages, self->packed, self->has_recorded ? self->loop_samples : 0, self->take_bpm
+			};
+			for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+				const RemusSlot* slot = &self->slots[s];
+				saved->slots[s] = (RemusSavedLoop){
+					slot->pages, slot->packed, slot->has_recorded ? slot->recorded_samples : 0, slot->take_bpm
+				};
+			}
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load(&self->audio_gen) == gen) {
+				return;
+			}
+		}
+		sched_yield();
+	}
+}
+
+/* Store the loops of a snapshot */
+static LV2_State_Status
+save_loops(Remus*                   remus,
+           LV2_State_Store_Function store,
+           LV2_State_Handle         handle,
+           const RemusPaths*        paths,
+           const RemusSaved*        saved)
+{
+	// Save the active slot and the loops of the parked ones
+	const int32_t active_slot = (int32_t)saved->active_slot;
+	store(handle, remus->remus_slot,
+	      &active_slot,
+	      sizeof(int32_t),
+	      remus->atom_Int,
+	      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		const RemusSavedLoop* slot = &saved->slots[s];
+		if (s != saved->active_slot && slot->n_samples > 0) {
+			char name[16];
+			snprintf(name, sizeof(name), "slot%u.f32", s);
+			const LV2_State_Status st = store_loop(remus, store, handle, paths, remus->remus_slot_buffer[s],
+			                                       name, slot->pages, slot->packed, slot->n_samples);
+			if (st != LV2_STATE_SUCCESS) {
+				return st;
+			}
+			if (slot->take_bpm > 0.0f) {
+				store(handle, remus->remus_slot_tempo[s],
+				      &slot->take_bpm,
+				      sizeof(float),
+				      remus->atom_Float,
+				      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+			}
+		}
 	}
 	
 	// Only save if we have recorded data
-	if (!remus->has_recorded || remus->loop_samples == 0) {
-		fprintf(stderr, "REMUS: No recorded data to save\n");
+	const RemusSavedLoop* loop = &saved->active;
+	if (loop->n_samples == 0) {
+		REMUS_TRACE(&remus->log, "REMUS: No recorded data to save\n");
 		return LV2_STATE_SUCCESS;
 	}
 	
-	fprintf(stderr, "REMUS: Saving %u samples\n", remus->loop_samples);
+	REMUS_TRACE(&remus->log, "REMUS: Saving %u samples\n", loop->n_samples);
 	
-	// Save the loop buffer as a vector of floats
-	store(handle, remus->remus_buffer,
-	      remus->buffer,
-	      remus->loop_samples * sizeof(float),
-	      remus->atom_Float,
-	      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+	// Save the loop buffer, one channel after the other
+	const LV2_State_Status st = store_loop(remus, store, handle, paths, remus->remus_buffer,
+	                                       "loop.f32", loop->pages, loop->packed, loop->n_samples);
+	if (st != LV2_STATE_SUCCESS) {
+		return st;
+	}
 	
 	// Save loop length
 	store(handle, remus->remus_loop_samples,
-	      &remus->loop_samples,
+	      &loop->n_samples,
 	      sizeof(uint32_t),
 	      remus->atom_Long,
 	      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
 	
 	// Save has_recorded flag
-	uint32_t has_rec = remus->has_recorded ? 1 : 0;
+	uint32_t has_rec = 1;
 	store(handle, remus->remus_has_recorded,
 	      &has_rec,
 	      sizeof(uint32_t),
 	      remus->atom_Long,
 	      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
 	
-	fprintf(stderr, "REMUS: State saved successfully\n");
+	// Save the tempo of the take, for tempo following
+	if (loop->take_bpm > 0.0f) {
+		store(handle, remus->remus_tempo,
+		      &loop->take_bpm,
+		      sizeof(float),
+		      remus->atom_Float,
+		      LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+	}
+	
+	REMUS_TRACE(&remus->log, "REMUS: State saved successfully\n");
 	return LV2_STATE_SUCCESS;
 }
 
+/*
+ * Save the loops. The host may call this while run() plays and the worker
+ * works: the loops are read from a snapshot, and the worker keeps what the
+ * snapshot points to until the save is over. Samples a take or an overdub
+ * writes meanwhile may or may not be saved.
+ */
+static LV2_State_Status
+save(LV2_Handle                instance,
+     LV2_State_Store_Function  store,
+     LV2_State_Handle          handle,
+     uint32_t                  flags,
+     const LV2_Feature* const* features)
+{
+	Remus* remus = (Remus*)instance;
+	
+	// Check if persistence is enabled
+	if (*remus->persist_enable < 0.5f) {
+		REMUS_TRACE(&remus->log, "REMUS: Persistence disabled, not saving\n");
+		return LV2_STATE_SUCCESS;  // Don't save if disabled
+	}
+	
+	const RemusPaths paths = state_paths(features);
+	RemusSaved       saved;
+	atomic_fetch_add(&remus->n_saving, 1);
+	snapshot_loops(remus, &saved);
+	REMUS_TRACE(&remus->log, "REMUS: save() called - active slot %u, loop_samples=%u\n",
+	            saved.active_slot, saved.active.n_samples);
+	
+	const LV2_State_Status st = save_loops(remus, store, handle, &paths, &saved);
+	atomic_fetch_sub(&remus->n_saving, 1);
+	return st;
+}
+
+/*
+ * Map a loop file saved by store_loop(). Loops that fit in memory use the
+ * mapped pages in place, longer ones are copied to disk pages.
+ */
+static float**
+load_loop_file(Remus* remus, const RemusPaths* paths, const char* abstract, uint32_t* n_samples)
+{
+	char* path = paths->map ? paths->map->absolute_path(paths->map->handle, abstract) : NULL;
+	bool    locked;
+	float** mapped = remus_file_map(&remus->files, path ? path : abstract, remus->n_channels,
+	                                n_samples, MAX_BUFFER_SIZE, &locked);
+	if (!mapped) {
+		REMUS_ERROR(&remus->log, "REMUS: Cannot map loop file %s\n", path ? path : abstract);
+	} else if (*n_samples <= MAX_BUFFER_SIZE && !locked) {
+		REMUS_ERROR(&remus->log, "REMUS: Cannot lock loop file %s in memory, raise the memlock limit\n",
+		            path ? path : abstract);
+	}
+	if (path) {
+		free_path(paths, path);
+	}
+	if (!mapped || *n_samples <= MAX_BUFFER_SIZE) {
+		return mapped;
+	}
+	
+	const uint32_t n_entries = remus_pages_for(*n_samples) * remus->n_channels;
+	float** pages = (*n_samples <= DISK_BUFFER_SIZE)
+		? table_resize(remus, NULL, 0, n_entries, true) : NULL;
+	for (uint32_t e = 0; pages && e < n_entries; e++) {
+		remus_copy(pages[e], mapped[e], REMUS_PAGE_FRAMES);
+	}
+	table_release(remus, mapped, n_entries, 0);
+	return pages;
+}
+
+/*
+ * Build a table holding a loop saved by store_loop(), of
+ * remus_pages_for(*n_samples) pages per channel (not RT safe). Returns NULL
+ * if the loop cannot be loaded.
+ */
+static float**
+load_loop(Remus* remus, const RemusPaths* paths, const void* data, size_t size, uint32_t type,
+          uint32_t* n_samples)
+{
+	if (type == remus->atom_Path) {
+		return load_loop_file(remus, paths, (const char*)data, n_samples);
+	} else if (type != remus->atom_Float) {
+		return NULL;
+	}
+	
+	const size_t n_saved = size / (sizeof(float) * remus->n_channels);
+	*n_samples = (n_saved > DISK_BUFFER_SIZE) ? DISK_BUFFER_SIZE : (uint32_t)n_saved;
+	
+	// Loops too long for memory were recorded on disk, they go back there
+	const bool disk = *n_samples > MAX_BUFFER_SIZE;
+	float** pages = table_resize(remus, NULL, 0, remus_pages_for(*n_samples) * remus->n_channels, disk);
+	if (!pages) {
+		REMUS_ERROR(&remus->log, "REMUS: Out of memory restoring %u samples\n", *n_samples);
+		return NULL;
+	}
+	for (uint32_t c = 0; c < remus->n_channels; c++) {
+		table_write(pages, remus->n_channels, c, 0, (const float*)data + (size_t)c * *n_samples, *n_samples);
+	}
+	return pages;
+}
+
+/*
+ * Read the loops of a state into a restore staged for run(). The host may
+ * call this while run() plays (state:threadSafeRestore): nothing run() reads
+ * is touched here, the loops are swapped in by run() at its next block.
+ */
 static LV2_State_Status
 restore(LV2_Handle                  instance,
         LV2_State_Retrieve_Function retrieve,
@@ -715,67 +3437,126 @@ restore(LV2_Handle                  instance,
 {
 	Remus* remus = (Remus*)instance;
 	
-	fprintf(stderr, "REMUS: restore() called\n");
+	REMUS_TRACE(&remus->log, "REMUS: restore() called\n");
+	
+	const RemusPaths paths = state_paths(features);
+	RemusRestore*    staged = (RemusRestore*)calloc(1, sizeof(RemusRestore));
+	if (!staged) {
+		return LV2_STATE_ERR_NO_SPACE;
+	}
 	
 	// Retrieve loop_samples
 	size_t size;
 	uint32_t type;
 	uint32_t rflags;
+	uint32_t loop_samples = 0;
 	
 	const void* loop_samples_data = retrieve(
 		handle, remus->remus_loop_samples, &size, &type, &rflags);
 	
 	if (loop_samples_data && type == remus->atom_Long) {
-		remus->loop_samples = *(const uint32_t*)loop_samples_data;
-		fprintf(stderr, "REMUS: Restored loop_samples=%u\n", remus->loop_samples);
+		loop_samples = *(const uint32_t*)loop_samples_data;
+		REMUS_TRACE(&remus->log, "REMUS: Restored loop_samples=%u\n", loop_samples);
 		
-		// Clamp to buffer size
-		if (remus->loop_samples > remus->buffer_size) {
-			remus->loop_samples = remus->buffer_size;
+		// Clamp to maximum buffer size, loops longer than memory allows are on disk
+		if (loop_samples > DISK_BUFFER_SIZE) {
+			loop_samples = DISK_BUFFER_SIZE;
 		}
 	} else {
-		fprintf(stderr, "REMUS: Failed to restore loop_samples (data=%p, type=%u, expected=%u)\n",
+		REMUS_TRACE(&remus->log, "REMUS: Failed to restore loop_samples (data=%p, type=%u, expected=%u)\n",
 		        loop_samples_data, type, remus->atom_Long);
 	}
 	
 	// Retrieve has_recorded flag
+	bool has_recorded = false;
 	const void* has_rec_data = retrieve(
 		handle, remus->remus_has_recorded, &size, &type, &rflags);
 	
 	if (has_rec_data && type == remus->atom_Long) {
-		remus->has_recorded = (*(const uint32_t*)has_rec_data != 0);
-		fprintf(stderr, "REMUS: Restored has_recorded=%d\n", remus->has_recorded);
+		has_recorded = (*(const uint32_t*)has_rec_data != 0);
+		REMUS_TRACE(&remus->log, "REMUS: Restored has_recorded=%d\n", has_recorded);
 	} else {
-		fprintf(stderr, "REMUS: Failed to restore has_recorded\n");
+		REMUS_TRACE(&remus->log, "REMUS: Failed to restore has_recorded\n");
+	}
+	
+	// Retrieve the active slot, parked slots are restored below
+	const void* slot_data = retrieve(
+		handle, remus->remus_slot, &size, &type, &rflags);
+	
+	if (slot_data && type == remus->atom_Int
+	    && *(const int32_t*)slot_data >= 0 && *(const int32_t*)slot_data < REMUS_MAX_SLOTS) {
+		staged->active_slot = (uint32_t)*(const int32_t*)slot_data;
 	}
+	RemusSlot* loop = &staged->slots[staged->active_slot];
+	
+	// Retrieve the tempo of the take, unknown in older sessions
+	const void* tempo_data = retrieve(
+		handle, remus->remus_tempo, &size, &type, &rflags);
+	
+	loop->take_bpm = (tempo_data && type == remus->atom_Float) ? *(const float*)tempo_data : 0.0f;
 	
-	// Retrieve buffer data
+	// Retrieve buffer data, inline or the path of its loop file
 	const void* buffer_data = retrieve(
 		handle, remus->remus_buffer, &size, &type, &rflags);
 	
-	if (buffer_data && remus->loop_samples > 0) {
-		// Calculate expected size
-		size_t expected_size = remus->loop_samples * sizeof(float);
-		size_t copy_size = (size < expected_size) ? size : expected_size;
+	uint32_t n_saved = 0;
+	float**  loaded = (buffer_data && loop_samples > 0)
+		? load_loop(remus, &paths, buffer_data, size, type, &n_saved) : NULL;
+	if (loaded) {
+		REMUS_TRACE(&remus->log, "REMUS: Restoring %u samples (expected %u)\n", n_saved, loop_samples);
 		
-		fprintf(stderr, "REMUS: Restoring %zu bytes of buffer data (expected %zu)\n", copy_size, expected_size);
-		
-		// Copy buffer data
-		memcpy(remus->buffer, buffer_data, copy_size);
-		
-		// Reset playback position
-		remus->read_pos = 0;
-		remus->recording = false;
-		remus->waiting_for_bar = false;
+		// A shorter saved loop is completed with silence
+		uint32_t n_pages = remus_pages_for(n_saved);
+		if (remus_pages_for(loop_samples) > n_pages) {
+			const uint32_t n_grown = remus_pages_for(loop_samples);
+			float** grown = table_resize(remus, loaded, n_pages * remus->n_channels,
+			                             n_grown * remus->n_channels, loop_samples > MAX_BUFFER_SIZE);
+			if (!grown) {
+				// The loops playing are kept
+				table_release(remus, loaded, n_pages * remus->n_channels, 0);
+				restore_free(remus, staged);
+				REMUS_ERROR(&remus->log, "REMUS: Out of memory restoring %u samples\n", loop_samples);
+				return LV2_STATE_ERR_NO_SPACE;
+			}
+			free(loaded);
+			loaded = grown;
+			n_pages = n_grown;
+		}
 		
-		fprintf(stderr, "REMUS: After restore - recording=%d, has_recorded=%d, loop_samples=%u, read_pos=%u\n",
-		        remus->recording, remus->has_recorded, remus->loop_samples, remus->read_pos);
+		// The restored table becomes the loop buffer
+		loop->pages = loaded;
+		loop->n_pages = n_pages;
+		loop->recorded_samples = loop_samples;
+		loop->has_recorded = has_recorded;
+		staged->disk_used |= loop_samples > MAX_BUFFER_SIZE;
 	} else {
-		fprintf(stderr, "REMUS: No buffer data to restore (data=%p, loop_samples=%u)\n",
-		        buffer_data, remus->loop_samples);
+		REMUS_TRACE(&remus->log, "REMUS: No buffer data to restore (data=%p, loop_samples=%u)\n",
+		        buffer_data, loop_samples);
+		loop->take_bpm = 0.0f;
+	}
+	
+	for (uint32_t s = 0; s < REMUS_MAX_SLOTS; s++) {
+		const void* data = retrieve(handle, remus->remus_slot_buffer[s], &size, &type, &rflags);
+		if (s == staged->active_slot || !data) {
+			continue;
+		}
+		RemusSlot* slot = &staged->slots[s];
+		slot->pages = load_loop(remus, &paths, data, size, type, &slot->recorded_samples);
+		if (slot->pages) {
+			slot->n_pages = remus_pages_for(slot->recorded_samples);
+			slot->has_recorded = slot->recorded_samples > 0;
+			staged->disk_used |= slot->recorded_samples > MAX_BUFFER_SIZE;
+			const void* slot_tempo = retrieve(handle, remus->remus_slot_tempo[s], &size, &type, &rflags);
+			slot->take_bpm = (slot_tempo && type == remus->atom_Float) ? *(const float*)slot_tempo : 0.0f;
+		} else {
+			memset(slot, 0, sizeof(RemusSlot));
+		}
 	}
 	
-	fprintf(stderr, "REMUS: State restored successfully\n");
+	// Publish, a restore that run() has not taken yet is replaced
+	restore_free(remus, atomic_exchange_explicit(&remus->staged, staged, memory_order_acq_rel));
+	
+	REMUS_TRACE(&remus->log, "REMUS: State restored successfully\n");
 	return LV2_STATE_SUCCESS;
 }
 
@@ -784,29 +3565,584 @@ static const LV2_State_Interface state_interface = {
 	restore
 };
 
+/*
+ * Find the stitch position in [CROSSFADE_SAMPLES / 2, window] where the tail
+ * best matches the loop start (not RT safe).
+ *
+ * The tail continues the take, so tail[i] should line up with loop[i]: the
+ * loop length is fixed by the tempo and the search has no lag to scan. Each
+ * candidate is scored by the normalized correlation of both signals over the
+ * crossfade window around it, with running sums so the whole search is
+ * linear in the window.
+ */
+static uint32_t
+stitch_search(const float* loop, const float* tail, uint32_t window)
+{
+	const uint32_t half = CROSSFADE_SAMPLES / 2;
+	double xy = 0.0;
+	double xx = 0.0;
+	double yy = 0.0;
+	
+	for (uint32_t i = 0; i < CROSSFADE_SAMPLES; i++) {
+		xy += (double)tail[i] * loop[i];
+		xx += (double)tail[i] * tail[i];
+		yy += (double)loop[i] * loop[i];
+	}
+	
+	uint32_t best = half;
+	double   best_score = -2.0;
+	for (uint32_t p = half;; p++) {
+		const double energy = xx * yy;
+		const double score = (energy > 1e-20) ? xy / sqrt(energy) : 0.0;
+		if (score > best_score) {
+			best_score = score;
+			best = p;
+		}
+		if (p >= window) {
+			break;
+		}
+		
+		// Slide the window [p - half, p + half) by one sample
+		const uint32_t out = p - half;
+		const uint32_t in = p + half;
+		xy += (double)tail[in] * loop[in] - (double)tail[out] * loop[out];
+		xx += (double)tail[in] * tail[in] - (double)tail[out] * tail[out];
+		yy += (double)loop[in] * loop[in] - (double)loop[out] * loop[out];
+	}
+	return best;
+}
+
+/*
+ * Build the stitched first loop page into page (not RT safe): a copy of
+ * loop_page whose start is replaced by the tail, crossfaded back into the
+ * loop around stitch_position.
+ */
+static void
+stitch_page(const RemusKernels* kernels, float* page, const float* loop_page, const float* tail,
+            uint32_t stitch_position)
+{
+	const uint32_t crossfade_start = stitch_position - CROSSFADE_SAMPLES / 2;
+	
+	remus_copy(page, loop_page, REMUS_PAGE_FRAMES);
+	
+	// Copy samples from tail buffer before the crossfade zone
+	remus_copy(page, tail, crossfade_start);
+	
+	// Apply crossfade centered around stitch_position: fade out tail, fade in loop
+	kernels->crossfade(page + crossfade_start, tail + crossfade_start, CROSSFADE_SAMPLES, 0, CROSSFADE_SAMPLES);
+}
+
+/*
+ * Stitch the tail of every channel into a copy of its first loop page, all
+ * at the same position (not RT safe). On success the copies replace
+ * job->head, otherwise job->head is cleared.
+ */
+static bool
+stitch_heads(const Remus* self, RemusWork* job)
+{
+	float* stitched[REMUS_MAX_CHANNELS] = { NULL };
+	
+	for (uint32_t c = 0; c < self->n_channels; c++) {
+		if (!(stitched[c] = remus_pool_acquire())) {
+			for (uint32_t i = 0; i < c; i++) {
+				remus_pool_release(stitched[i]);
+			}
+			memset(job->head, 0, sizeof(job->head));
+			return false;
+		}
+		stitch_page(self->kernels, stitched[c], job->head[c], job->tail + c * TAIL_CAPACITY, job->stitch_position);
+	}
+	memcpy(job->head, stitched, sizeof(job->head));
+	return true;
+}
+
+/* Swap the stitched pages in at a block boundary and publish the loop */
+static LV2_Worker_Status
+stitch_response(Remus* self, const RemusWork* reply)
+{
+	self->stitch_scheduled = false;
+	
+	// Stitched pages of a stale take are released as they came
+	RemusWork retire = { .type = REMUS_WORK_FREE };
+	memcpy(retire.head, reply->head, sizeof(retire.head));
+	if (reply->take == self->take && self->stitch_pending) {
+		if (reply->head[0]) {
+			// Page 0 of channel c is entry c of the table
+			for (uint32_t c = 0; c < self->n_channels; c++) {
+				retire.head[c] = self->pages[c];
+				self->pages[c] = reply->head[c];
+			}
+			REMUS_RT_LOG(&self->log, LOG_CROSSFADE_APPLIED, CROSSFADE_SAMPLES, reply->stitch_position, 0, 0);
+			self->stats.n_stitches++;
+		} else {
+			REMUS_RT_LOG(&self->log, LOG_STITCH_FAILED, 0, 0, 0, 0);
+		}
+		self->stitch_pending = false;
+		self->has_recorded = true;
+		self->tail_pos = 0;
+		self->stitch_position = 0;
+		self->peaks_dirty = true;
+	}
+	
+	if (retire.head[0]) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/* Swap in a resized capture ring, which starts over empty */
+static LV2_Worker_Status
+ring_response(Remus* self, const RemusWork* reply)
+{
+	self->ring_pending = false;
+	if (!reply->table) {
+		self->ring_failed = reply->n_pages;
+		REMUS_RT_LOG(&self->log, LOG_RING_FAILED, reply->n_pages, 0, 0, 0);
+		return LV2_WORKER_SUCCESS;
+	}
+	
+	const RemusWork retire = {
+		.type = REMUS_WORK_FREE, .table = self->ring, .n_pages = self->ring_pages,
+		.first = (reply->first < reply->n_pages) ? reply->first : reply->n_pages
+	};
+	self->ring = reply->table;
+	self->ring_pages = reply->n_pages;
+	self->ring_failed = 0;
+	self->ring_valid = self->ring_pos;
+	if (retire.table) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/*
+ * Make a captured loop the loop buffer, unless a take or restore replaced the
+ * loop since the request, or run() overwrote the bars before the worker read
+ * them. The loop plays on at once, from where the transport is in it.
+ */
+static LV2_Worker_Status
+capture_response(Remus* self, const RemusWork* reply)
+{
+	const uint32_t n_pages = remus_pages_for(reply->length);
+	RemusWork      retire = { .type = REMUS_WORK_FREE, .table = reply->table, .n_pages = n_pages };
+	
+	self->capture_pending = false;
+	if (!reply->table) {
+		REMUS_RT_LOG(&self->log, LOG_CAPTURE_FAILED, reply->length, 0, 0, 0);
+	} else if (self->ring_pos > reply->ring_start + (uint64_t)reply->n_pages * REMUS_PAGE_FRAMES) {
+		REMUS_RT_LOG(&self->log, LOG_CAPTURE_LATE, 0, 0, 0, 0);
+	} else if (reply->take == self->take) {
+		retire.table = self->pages;
+		retire.n_pages = self->n_pages;
+		retire.pack = self->packed;
+		drop_history(self);
+		self->pages = reply->table;
+		self->packed = NULL;
+		self->n_pages = n_pages;
+		self->buffer_size = n_pages * REMUS_PAGE_FRAMES;
+		self->loop_samples = reply->length;
+		self->recorded_samples = reply->length;
+		self->has_recorded = true;
+		self->take_bpm = reply->tempo;
+		self->resize_failed = 0;
+		self->pack_failed = false;
+		self->window_dirty = true;
+		self->peaks_dirty = true;
+		self->overdubbing = false;
+		self->take++;
+		self->edits++;
+		
+		// The loop ends on the bar start the ring_pos - end frames ago
+		const uint64_t end = reply->ring_start + reply->length;
+		self->playing = self->transport_rolling;
+		self->waiting_to_play = false;
+		self->read_pos = (uint32_t)((self->ring_pos - end) % reply->length);
+		self->read_frac = 0;
+		update_read_step(self);
+		REMUS_RT_LOG(&self->log, LOG_CAPTURED, reply->length, self->active_slot, 0, 0);
+	}
+	
+	if (retire.table || retire.pack) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/*
+ * Swap in peaks from the worker: a rebuild if the loop was not edited since
+ * the request, room for a take if it is large enough, whose frames written
+ * meanwhile are scanned here. Every bin is sent again.
+ */
+static LV2_Worker_Status
+peaks_response(Remus* self, const RemusWork* reply)
+{
+	RemusWork retire = { .type = REMUS_WORK_FREE, .peaks = reply->peaks };
+	
+	self->peaks_pending = false;
+	if (!reply->peaks) {
+		self->peaks_failed = true;
+		REMUS_RT_LOG(&self->log, LOG_PEAKS_FAILED, reply->n_pages, 0, 0, 0);
+	} else if (reply->length ? reply->take == self->edits && reply->length == self->loop_samples
+	                         : reply->peaks->capacity >= self->loop_samples) {
+		retire.peaks = self->peaks;
+		self->peaks = reply->peaks;
+		if (reply->length) {
+			self->peaks_dirty = false;
+			self->peaks_length = reply->length;
+		} else {
+			self->peaks_dirty = true;
+			peaks_touch(self, 0, self->recording ? self->write_pos : 0);
+		}
+		remus_peak_port_mark(&self->peak_port, 0, remus_peak_bins(self->loop_samples, 0));
+	}
+	
+	if (retire.peaks) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/* Add the pages of the worker to the reserve, and take the spare layer if one was asked */
+static LV2_Worker_Status
+history_response(Remus* self, const RemusWork* reply)
+{
+	self->history_pending = false;
+	memcpy(self->reserve + self->n_reserve, self->reserve_fill, reply->first * sizeof(float*));
+	self->n_reserve += reply->first;
+	if (reply->spare) {
+		self->spare = reply->layer;
+	}
+	if (reply->first < reply->n_pages || (reply->spare && !reply->layer)) {
+		self->history_failed = true;
+		REMUS_RT_LOG(&self->log, LOG_HISTORY_FAILED, 0, 0, 0, 0);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/* Whether page is one of the n pages of window */
+static bool
+window_holds(float* const* window, uint32_t n, const float* page)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		if (window[i] == page) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Lock the disk pages of job->table from both cursors on, then unlock the
+ * pages of the previous window left behind (not RT safe). Pages the window
+ * held may have been released since, unlocking them does nothing.
+ */
+static void
+move_window(Remus* self, const RemusWork* job)
+{
+	float*   window[2 * DISK_AHEAD_PAGES * REMUS_MAX_CHANNELS];
+	uint32_t n_window = 0;
+	
+	for (uint32_t k = 0; k < 2 && job->n_pages > 0; k++) {
+		for (uint32_t i = 0; i < DISK_AHEAD_PAGES; i++) {
+			// The first pages are in memory, only read entries past them
+			const uint32_t p = (job->cursor[k] + i) % job->n_pages;
+			if (p < DISK_HEAD_PAGES) {
+				continue;
+			}
+			for (uint32_t c = 0; c < self->n_channels; c++) {
+				float* page = job->table[p * self->n_channels + c];
+				if (!remus_disk_owns(&self->disk, page) || window_holds(window, n_window, page)) {
+					continue;
+				}
+				if (!remus_disk_lock(&self->disk, page) && !self->window_unlocked) {
+					self->window_unlocked = true;
+					REMUS_ERROR(&self->log, "REMUS: Cannot lock long loop pages in memory, raise the memlock limit\n");
+				}
+				window[n_window++] = page;
+			}
+		}
+	}
+	
+	for (uint32_t i = 0; i < self->n_window; i++) {
+		if (!window_holds(window, n_window, self->window[i])) {
+			remus_disk_unlock(&self->disk, self->window[i]);
+		}
+	}
+	memcpy(self->window, window, n_window * sizeof(float*));
+	self->n_window = n_window;
+}
+
+/*
+ * Swap a packed or unpacked loop in, if the loop buffer is still the one
+ * the worker started from, and retire what it replaces.
+ */
+static LV2_Worker_Status
+pack_response(Remus* self, const RemusWork* reply)
+{
+	RemusWork retire = { .type = REMUS_WORK_FREE };
+	
+	if (reply->type == REMUS_WORK_PACK) {
+		self->pack_pending = false;
+		retire.pack = reply->pack;
+		if (reply->pack && reply->table == self->pages && reply->take == self->edits
+		    && loop_idle(self)) {
+			retire.pack = NULL;
+			retire.table = self->pages;
+			retire.n_pages = self->n_pages;
+			self->packed = reply->pack;
+			self->pages = NULL;
+			REMUS_RT_LOG(&self->log, LOG_PACKED, self->active_slot,
+			             reply->format == REMUS_PACK_24 ? 24 : 16, 0, 0);
+		}
+	} else {
+		self->unpack_pending = false;
+		retire.table = reply->table;
+		retire.n_pages = reply->n_pages;
+		if (reply->table && reply->pack == self->packed) {
+			retire.table = NULL;
+			retire.pack = self->packed;
+			self->pages = reply->table;
+			self->packed = NULL;
+			REMUS_RT_LOG(&self->log, LOG_UNPACKED, self->active_slot, 0, 0, 0);
+		}
+	}
+	
+	if ((reply->type == REMUS_WORK_PACK) ? !reply->pack : !reply->table) {
+		self->pack_failed = true;
+		REMUS_RT_LOG(&self->log, LOG_PACK_FAILED, self->active_slot, 0, 0, 0);
+	}
+	if (retire.table || retire.pack) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+work(LV2_Handle                  instance,
+     LV2_Worker_Respond_Function respond,
+     LV2_Worker_Respond_Handle   handle,
+     uint32_t                    size,
+     const void*                 data)
+{
+	Remus* remus = (Remus*)instance;
+	
+	if (size != sizeof(RemusWork)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	
+	// Jobs held back for a save that is over
+	release_deferred(remus, false);
+	
+	const RemusWork* job = (const RemusWork*)data;
+	switch (job->type) {
+	case REMUS_WORK_RESIZE:
+	case REMUS_WORK_RING: {
+		// Reply with the new table, or NULL if it could not be allocated
+		RemusWork reply = *job;
+		reply.table = table_resize(remus, job->table, job->first * remus->n_channels,
+		                           job->n_pages * remus->n_channels, job->disk);
+		reply.disk = job->disk && job->n_pages > DISK_HEAD_PAGES;
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_CAPTURE: {
+		// Reply with the captured loop, or NULL if it could not be allocated
+		RemusWork reply = *job;
+		reply.table = capture_table(remus, job);
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_PEAKS: {
+		// Reply with the peaks, or NULL if they could not be allocated
+		RemusWork reply = *job;
+		reply.peaks = build_peaks(remus, job);
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_FREE:
+		retire_work(remus, job);
+		break;
+	case REMUS_WORK_PACK: {
+		// Reply with the packed loop, or NULL if it could not be allocated
+		RemusWork reply = *job;
+		reply.pack = remus_pack(job->table, job->n_pages * remus->n_channels, job->format);
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_UNPACK: {
+		// Reply with a float table, or NULL if it could not be allocated
+		RemusWork reply = *job;
+		reply.table = unpack_table(remus, job->pack, job->n_pages * remus->n_channels);
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_STITCH: {
+		// Reply with the stitched copies, or NULL if they could not be allocated
+		RemusWork reply = *job;
+		if (job->window) {
+			// Search on the mix of the channels, like the zero-crossings
+			float        head_mix[TAIL_CAPACITY];
+			const float* head = job->head[0];
+			if (remus->n_channels > 1) {
+				remus_mix_down(head_mix, (const float* const*)job->head, remus->n_channels,
+				               job->window + CROSSFADE_SAMPLES / 2);
+				head = head_mix;
+			}
+			reply.stitch_position = stitch_search(head, job->search, job->window);
+			REMUS_TRACE(&remus->log, "REMUS: Correlation search over %u samples, stitching at %u\n",
+			            job->window, reply.stitch_position);
+		}
+		stitch_heads(remus, &reply);
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_HISTORY: {
+		// Reply with the pages acquired in first, and the spare layer or NULL
+		RemusWork reply = *job;
+		reply.first = fill_reserve(remus, job->n_pages);
+		reply.layer = job->spare ? layer_new(remus) : NULL;
+		respond(handle, sizeof(reply), &reply);
+		break;
+	}
+	case REMUS_WORK_WINDOW:
+		move_window(remus, job);
+		respond(handle, sizeof(*job), job);
+		break;
+	case REMUS_WORK_LOG:
+		remus_log_drain(&remus->log);
+		break;
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+/* Apply a worker reply, in the audio thread */
+static LV2_Worker_Status
+apply_response(Remus* remus, const RemusWork* reply)
+{
+	if (reply->type == REMUS_WORK_STITCH) {
+		return stitch_response(remus, reply);
+	} else if (reply->type == REMUS_WORK_PACK || reply->type == REMUS_WORK_UNPACK) {
+		return pack_response(remus, reply);
+	} else if (reply->type == REMUS_WORK_WINDOW) {
+		remus->window_pending = false;
+		return LV2_WORKER_SUCCESS;
+	} else if (reply->type == REMUS_WORK_RING) {
+		return ring_response(remus, reply);
+	} else if (reply->type == REMUS_WORK_CAPTURE) {
+		return capture_response(remus, reply);
+	} else if (reply->type == REMUS_WORK_PEAKS) {
+		return peaks_response(remus, reply);
+	} else if (reply->type == REMUS_WORK_HISTORY) {
+		return history_response(remus, reply);
+	} else if (reply->type != REMUS_WORK_RESIZE) {
+		return LV2_WORKER_SUCCESS;
+	}
+	
+	remus->resize_pending = false;
+	if (!reply->table) {
+		remus->resize_failed = reply->n_pages;
+		REMUS_RT_LOG(&remus->log, LOG_RESIZE_FAILED, reply->n_pages, 0, 0, 0);
+		return LV2_WORKER_SUCCESS;
+	}
+	remus->resize_failed = 0;
+	
+	// A take may have started since the request, drop tables that became too small
+	const uint32_t n_shared = (reply->first < reply->n_pages) ? reply->first : reply->n_pages;
+	RemusWork retire = {
+		.type = REMUS_WORK_FREE, .table = reply->table, .n_pages = reply->n_pages, .first = n_shared
+	};
+	if (reply->n_pages >= pinned_pages(remus)) {
+		// Pages an edit replaced since the request are taken over from the table
+		if (n_shared > 0) {
+			memcpy(reply->table, remus->pages, n_shared * remus->n_channels * sizeof(float*));
+		}
+		retire.table = remus->pages;
+		retire.n_pages = remus->n_pages;
+		remus->pages = reply->table;
+		remus->n_pages = reply->n_pages;
+		remus->buffer_size = reply->n_pages * REMUS_PAGE_FRAMES;
+		remus->disk_used |= reply->disk;
+		remus->window_dirty = true;
+	}
+	
+	if (retire.table) {
+		remus->schedule->schedule_work(remus->schedule->handle, sizeof(retire), &retire);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+work_response(LV2_Handle  instance,
+              uint32_t    size,
+              const void* body)
+{
+	Remus* remus = (Remus*)instance;
+	
+	if (size != sizeof(RemusWork)) {
+		return LV2_WORKER_ERR_UNKNOWN;
+	}
+	
+	// Responses swap loop tables like run(), save() waits for them too
+	atomic_fetch_add(&remus->audio_gen, 1);
+	const LV2_Worker_Status st = apply_response(remus, (const RemusWork*)body);
+	atomic_fetch_add(&remus->audio_gen, 1);
+	return st;
+}
+
+static const LV2_Worker_Interface worker_interface = {
+	work,
+	work_response,
+	NULL
+};
+
 static const void*
 extension_data(const char* uri)
 {
 	if (!strcmp(uri, LV2_STATE__interface)) {
 		return &state_interface;
+	} else if (!strcmp(uri, LV2_WORKER__interface)) {
+		return &worker_interface;
 	}
 	return NULL;
 }
 
-static const LV2_Descriptor descriptor = {
-	REMUS_URI,
-	instantiate,
-	connect_port,
-	activate,
-	run,
-	deactivate,
-	cleanup,
-	extension_data
+// One plugin per channel count, instantiate() tells them apart by URI
+static const LV2_Descriptor descriptors[] = {
+	{
+		REMUS_URI,
+		instantiate,
+		connect_port,
+		activate,
+		run,
+		deactivate,
+		cleanup,
+		extension_data
+	},
+	{
+		REMUS_STEREO_URI,
+		instantiate,
+		connect_port,
+		activate,
+		run,
+		deactivate,
+		cleanup,
+		extension_data
+	},
+	{
+		REMUS_QUAD_URI,
+		instantiate,
+		connect_port,
+		activate,
+		run,
+		deactivate,
+		cleanup,
+		extension_data
+	}
 };
 
 LV2_SYMBOL_EXPORT
 const LV2_Descriptor*
 lv2_descriptor(uint32_t index)
 {
-	return index == 0 ? &descriptor : NULL;
+	return index < sizeof(descriptors) / sizeof(descriptors[0]) ? &descriptors[index] : NULL;
 }
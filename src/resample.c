@@ -0,0 +1,139 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resample.h"
+
+#define FILTER_ALIGNMENT 64  // Cache line, also enough for any SIMD load
+
+/* Taps, cutoff relative to Nyquist and Kaiser window beta of each quality */
+static const struct {
+	uint32_t n_taps;
+	double   cutoff;
+	double   beta;
+} qualities[REMUS_FOLLOW_QUALITIES] = {
+	[REMUS_FOLLOW_OFF]  = { 0, 0.0, 0.0 },
+	[REMUS_FOLLOW_FAST] = { 8, 0.75, 5.0 },
+	[REMUS_FOLLOW_GOOD] = { 16, 0.80, 6.5 },
+	[REMUS_FOLLOW_BEST] = { 32, 0.86, 8.5 },
+};
+
+static pthread_mutex_t filters_lock = PTHREAD_MUTEX_INITIALIZER;
+static RemusFilter     filters[REMUS_FOLLOW_QUALITIES][REMUS_RESAMPLE_BANDS];
+static uint32_t        filters_n_users = 0;
+
+/* Modified Bessel function of the first kind, order 0 */
+static double
+bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+		term *= (x * x) / (4.0 * k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+/* Coefficients of the phase where the output is frac samples past tap n_taps / 2 - 1 */
+static void
+design_phase(float* row, uint32_t n_taps, double cutoff, double beta, double frac)
+{
+	const double half = (double)(n_taps / 2);
+	double       sum = 0.0;
+	double       h[REMUS_RESAMPLE_MAX_TAPS];
+
+	for (uint32_t k = 0; k < n_taps; k++) {
+		const double x = (double)k - (half - 1.0) - frac;
+		const double r = x / half;
+		const double window = (r * r < 1.0) ? bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta) : 0.0;
+		const double sinc = (x == 0.0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+		h[k] = cutoff * sinc * window;
+		sum += h[k];
+	}
+
+	// Unity gain at DC for every phase, so a constant stays constant
+	for (uint32_t k = 0; k < n_taps; k++) {
+		row[k] = (float)(h[k] / sum);
+	}
+}
+
+/* Build the table of a quality and band, returns false if out of memory */
+static bool
+filter_init(RemusFilter* self, RemusFollow quality, uint32_t band)
+{
+	memset(self, 0, sizeof(RemusFilter));
+	if (quality == REMUS_FOLLOW_OFF || quality >= REMUS_FOLLOW_QUALITIES || band >= REMUS_RESAMPLE_BANDS) {
+		return true;
+	}
+
+	const uint32_t n_taps = qualities[quality].n_taps;
+	const double   cutoff = qualities[quality].cutoff * exp2(-(double)band / REMUS_RESAMPLE_BAND_STEPS);
+	const size_t   n_bytes = (size_t)REMUS_RESAMPLE_PHASES * 2 * n_taps * sizeof(float);
+	if (posix_memalign((void**)&self->coefs, FILTER_ALIGNMENT, n_bytes)) {
+		self->coefs = NULL;
+		return false;
+	}
+	self->n_taps = n_taps;
+
+	// Each phase is followed by its difference to the next, the last to frac 1
+	float next[REMUS_RESAMPLE_MAX_TAPS];
+	design_phase(next, n_taps, cutoff, qualities[quality].beta, 0.0);
+	for (uint32_t p = 0; p < REMUS_RESAMPLE_PHASES; p++) {
+		float* row = self->coefs + (size_t)p * 2 * n_taps;
+		memcpy(row, next, n_taps * sizeof(float));
+		design_phase(next, n_taps, cutoff, qualities[quality].beta, (double)(p + 1) / REMUS_RESAMPLE_PHASES);
+		for (uint32_t k = 0; k < n_taps; k++) {
+			row[n_taps + k] = next[k] - row[k];
+		}
+	}
+	return true;
+}
+
+/* Free the table of every quality and band, those not built are empty (filters_lock held) */
+static void
+filters_free(void)
+{
+	for (uint32_t q = 0; q < REMUS_FOLLOW_QUALITIES; q++) {
+		for (uint32_t b = 0; b < REMUS_RESAMPLE_BANDS; b++) {
+			free(filters[q][b].coefs);
+			memset(&filters[q][b], 0, sizeof(RemusFilter));
+		}
+	}
+}
+
+bool
+remus_filters_ref(const RemusFilter* shared[REMUS_FOLLOW_QUALITIES][REMUS_RESAMPLE_BANDS])
+{
+	bool ok = true;
+
+	pthread_mutex_lock(&filters_lock);
+	for (uint32_t q = 0; q < REMUS_FOLLOW_QUALITIES && filters_n_users == 0 && ok; q++) {
+		for (uint32_t b = 0; b < REMUS_RESAMPLE_BANDS && ok; b++) {
+			ok = filter_init(&filters[q][b], (RemusFollow)q, b);
+		}
+	}
+	if (ok) {
+		filters_n_users++;
+	} else {
+		filters_free();
+	}
+	pthread_mutex_unlock(&filters_lock);
+
+	for (uint32_t q = 0; q < REMUS_FOLLOW_QUALITIES; q++) {
+		for (uint32_t b = 0; b < REMUS_RESAMPLE_BANDS; b++) {
+			shared[q][b] = ok ? &filters[q][b] : NULL;
+		}
+	}
+	return ok;
+}
+
+void
+remus_filters_unref(void)
+{
+	pthread_mutex_lock(&filters_lock);
+	if (filters_n_users > 0 && --filters_n_users == 0) {
+		filters_free();
+	}
+	pthread_mutex_unlock(&filters_lock);
+}
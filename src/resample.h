@@ -0,0 +1,94 @@
+#ifndef REMUS_RESAMPLE_H
+#define REMUS_RESAMPLE_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "dsp.h"
+
+#define REMUS_RESAMPLE_PHASE_BITS 8   // Filter phases per sample, interpolated in between
+#define REMUS_RESAMPLE_PHASES     (1 << REMUS_RESAMPLE_PHASE_BITS)
+#define REMUS_RESAMPLE_MAX_TAPS   32
+#define REMUS_RESAMPLE_BAND_STEPS 4   // Cutoff bands per octave of the tempo ratio above 1
+#define REMUS_RESAMPLE_BANDS      9   // Bands of a quality, for ratios up to 4
+
+/* Resampling qualities, the values of the tempo follow port */
+typedef enum {
+	REMUS_FOLLOW_OFF  = 0,  // The tempo changes the loop length, not its samples
+	REMUS_FOLLOW_FAST = 1,  // 8 taps
+	REMUS_FOLLOW_GOOD = 2,  // 16 taps
+	REMUS_FOLLOW_BEST = 3,  // 32 taps
+	REMUS_FOLLOW_QUALITIES
+} RemusFollow;
+
+/*
+ * Polyphase windowed-sinc interpolation filter.
+ *
+ * The table holds REMUS_RESAMPLE_PHASES phases of a Kaiser-windowed sinc,
+ * each with its n_taps coefficients followed by their differences to the next
+ * phase, so run() interpolates between two phases with one multiply-add per
+ * tap. Every output sample costs the same 2 * n_taps multiply-adds whatever
+ * the ratio. The tables are built by the first instance and shared, read
+ * only, by every instance of the process.
+ *
+ * Reading the loop faster than it was recorded decimates it, so each quality
+ * has a table per band of ratios: band b serves ratios up to 2^(b/4), with
+ * the cutoff of the quality scaled by 2^(-b/4) to keep the loop content
+ * below the output Nyquist frequency. Band 0 serves ratios up to 1.
+ */
+typedef struct {
+	uint32_t n_taps;  // 0 for REMUS_FOLLOW_OFF
+	float*   coefs;
+} RemusFilter;
+
+/*
+ * Take a reference to the shared filters, from instantiate(), and point
+ * filters at the filter of each quality and band. The first reference builds
+ * them. Returns false without a reference if out of memory (not RT safe).
+ */
+bool
+remus_filters_ref(const RemusFilter* filters[REMUS_FOLLOW_QUALITIES][REMUS_RESAMPLE_BANDS]);
+
+/* Drop a reference, the last one frees the filters */
+void
+remus_filters_unref(void);
+
+/* Band of the filters for ratio, the loop samples read per output sample (RT safe) */
+static inline uint32_t
+remus_filter_band(double ratio)
+{
+	if (ratio <= 1.0) {
+		return 0;
+	}
+	const double band = ceil(log2(ratio) * REMUS_RESAMPLE_BAND_STEPS - 1e-9);
+	return (band < REMUS_RESAMPLE_BANDS - 1) ? (uint32_t)band : REMUS_RESAMPLE_BANDS - 1;
+}
+
+/*
+ * Resample src to n samples of dst (RT safe).
+ *
+ * phase is the position of the first output in src, in 32.32 fixed point,
+ * counted from the center of the taps: output i is interpolated from src[k]
+ * to src[k + n_taps - 1] where k is the integer part of phase + i * step,
+ * the output falling between src[k + n_taps / 2 - 1] and src[k + n_taps / 2].
+ * step is the source samples per output sample. Returns the phase of the
+ * sample after the last one.
+ */
+static inline uint64_t
+remus_resample(const RemusFilter* filter, const float* src, uint64_t phase, uint64_t step,
+               float* dst, uint32_t n)
+{
+	const uint32_t n_taps = filter->n_taps;
+
+	for (uint32_t i = 0; i < n; i++) {
+		const uint32_t frac = (uint32_t)phase;
+		const float*   row = filter->coefs + (frac >> (32 - REMUS_RESAMPLE_PHASE_BITS)) * 2 * n_taps;
+		const uint32_t between = frac & (0xffffffffu >> REMUS_RESAMPLE_PHASE_BITS);
+		dst[i] = remus_fir(src + (phase >> 32), row, row + n_taps,
+		                   (float)between * (float)REMUS_RESAMPLE_PHASES * 0x1p-32f, n_taps);
+		phase += step;
+	}
+	return phase;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <string.h>
+#include "stats.h"
+
+void
+remus_stats_init(RemusStats* self, LV2_URID_Map* map, double sample_rate)
+{
+	memset(self, 0, sizeof(RemusStats));
+	lv2_atom_forge_init(&self->forge, map);
+	self->Stats = map->map(map->handle, REMUS_STATS_URI "Stats");
+	self->frames = map->map(map->handle, REMUS_STATS_URI "frames");
+	self->blocks = map->map(map->handle, REMUS_STATS_URI "blocks");
+	self->block_time = map->map(map->handle, REMUS_STATS_URI "blockTime");
+	self->max_block_time = map->map(map->handle, REMUS_STATS_URI "maxBlockTime");
+	self->load = map->map(map->handle, REMUS_STATS_URI "load");
+	self->state_blocks[REMUS_BLOCK_IDLE] = map->map(map->handle, REMUS_STATS_URI "idleBlocks");
+	self->state_blocks[REMUS_BLOCK_ARMED] = map->map(map->handle, REMUS_STATS_URI "armedBlocks");
+	self->state_blocks[REMUS_BLOCK_RECORDING] = map->map(map->handle, REMUS_STATS_URI "recordingBlocks");
+	self->state_blocks[REMUS_BLOCK_PLAYING] = map->map(map->handle, REMUS_STATS_URI "playingBlocks");
+	self->state_blocks[REMUS_BLOCK_OVERDUBBING] = map->map(map->handle, REMUS_STATS_URI "overdubBlocks");
+	self->stitches = map->map(map->handle, REMUS_STATS_URI "stitches");
+	self->stitch_fallbacks = map->map(map->handle, REMUS_STATS_URI "stitchFallbacks");
+	self->stitch_distance = map->map(map->handle, REMUS_STATS_URI "stitchDistance");
+	self->stitch_min_distance = map->map(map->handle, REMUS_STATS_URI "stitchMinDistance");
+	self->memory_bytes = map->map(map->handle, REMUS_STATS_URI "memoryBytes");
+	self->disk_bytes = map->map(map->handle, REMUS_STATS_URI "diskBytes");
+
+	self->sample_rate = sample_rate;
+	self->period = (uint32_t)(sample_rate * REMUS_STATS_INTERVAL);
+	self->last_distance = -1;
+	self->last_min_distance = -1;
+}
+
+static void
+write_long(LV2_Atom_Forge* forge, LV2_URID key, uint64_t value)
+{
+	lv2_atom_forge_key(forge, key);
+	lv2_atom_forge_long(forge, (int64_t)value);
+}
+
+/* Append the report of the period to the sequence being forged, then clear the period */
+static void
+write_report(RemusStats* self, uint64_t memory_bytes, uint64_t disk_bytes)
+{
+	LV2_Atom_Forge* forge = &self->forge;
+
+	// Time spent in run() relative to the duration of the audio processed
+	const double audio_ns = (double)self->n_frames * 1e9 / self->sample_rate;
+
+	// Reports that do not fit are dropped, the sequence stays valid
+	LV2_Atom_Forge_Frame object;
+	if (lv2_atom_forge_frame_time(forge, 0) && lv2_atom_forge_object(forge, &object, 0, self->Stats)) {
+		write_long(forge, self->frames, self->n_frames);
+		write_long(forge, self->blocks, self->n_blocks);
+		write_long(forge, self->block_time, self->total_ns / self->n_blocks);
+		write_long(forge, self->max_block_time, self->max_ns);
+		lv2_atom_forge_key(forge, self->load);
+		lv2_atom_forge_float(forge, (float)((double)self->total_ns / audio_ns));
+		for (uint32_t s = 0; s < REMUS_BLOCK_STATES; s++) {
+			write_long(forge, self->state_blocks[s], self->n_state_blocks[s]);
+		}
+		write_long(forge, self->stitches, self->n_stitches);
+		write_long(forge, self->stitch_fallbacks, self->n_fallbacks);
+		lv2_atom_forge_key(forge, self->stitch_distance);
+		lv2_atom_forge_int(forge, self->last_distance);
+		lv2_atom_forge_key(forge, self->stitch_min_distance);
+		lv2_atom_forge_int(forge, self->last_min_distance);
+		write_long(forge, self->memory_bytes, memory_bytes);
+		write_long(forge, self->disk_bytes, disk_bytes);
+		lv2_atom_forge_pop(forge, &object);
+	}
+
+	self->n_frames = 0;
+	self->n_blocks = 0;
+	memset(self->n_state_blocks, 0, sizeof(self->n_state_blocks));
+	self->total_ns = 0;
+	self->max_ns = 0;
+}
+
+void
+remus_stats_write(RemusStats*        self,
+                  LV2_Atom_Sequence* port,
+                  uint64_t           memory_bytes,
+                  uint64_t           disk_bytes)
+{
+	LV2_Atom_Forge_Frame sequence;
+	lv2_atom_forge_set_buffer(&self->forge, (uint8_t*)port, port->atom.size);
+	lv2_atom_forge_sequence_head(&self->forge, &sequence, 0);
+	if (remus_stats_due(self)) {
+		write_report(self, memory_bytes, disk_bytes);
+	}
+	lv2_atom_forge_pop(&self->forge, &sequence);
+}
@@ -0,0 +1,118 @@
+#ifndef REMUS_STATS_H
+#define REMUS_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "lv2/atom/atom.h"
+#include "lv2/atom/forge.h"
+#include "lv2/urid/urid.h"
+
+#define REMUS_STATS_URI      "http://github.com/lbovet/remus#"
+#define REMUS_STATS_INTERVAL 1.0  // Seconds of audio between reports
+
+/* States a block is counted in, the state at the end of the block */
+typedef enum {
+	REMUS_BLOCK_IDLE,
+	REMUS_BLOCK_ARMED,
+	REMUS_BLOCK_RECORDING,  // Take or tail
+	REMUS_BLOCK_PLAYING,
+	REMUS_BLOCK_OVERDUBBING,
+	REMUS_BLOCK_STATES
+} RemusBlockState;
+
+/*
+ * Performance counters of an instance.
+ *
+ * run() times each block with the monotonic clock and counts it here. Once
+ * per REMUS_STATS_INTERVAL of audio the counters of the period are written
+ * as a remus:Stats object to the stats output port, then cleared. Stitch
+ * counters cover the life of the instance. Nothing here allocates or locks:
+ * everything but remus_stats_init() is RT safe.
+ */
+typedef struct {
+	LV2_Atom_Forge forge;
+	LV2_URID       Stats;
+	LV2_URID       frames;
+	LV2_URID       blocks;
+	LV2_URID       block_time;
+	LV2_URID       max_block_time;
+	LV2_URID       load;
+	LV2_URID       state_blocks[REMUS_BLOCK_STATES];
+	LV2_URID       stitches;
+	LV2_URID       stitch_fallbacks;
+	LV2_URID       stitch_distance;
+	LV2_URID       stitch_min_distance;
+	LV2_URID       memory_bytes;
+	LV2_URID       disk_bytes;
+
+	// Period counters
+	double         sample_rate;
+	uint32_t       period;            // Frames between reports
+	uint64_t       n_frames;
+	uint64_t       n_blocks;
+	uint64_t       n_state_blocks[REMUS_BLOCK_STATES];
+	uint64_t       total_ns;
+	uint64_t       max_ns;
+
+	// Stitch counters
+	uint64_t       n_stitches;        // Stitches applied
+	uint64_t       n_fallbacks;       // Tails without a matching zero-crossing
+	int32_t        last_distance;     // Crossing distance of the last stitch, -1 if it fell back
+	int32_t        last_min_distance; // Closest crossings seen by the last tail, -1 if none
+} RemusStats;
+
+void
+remus_stats_init(RemusStats* self, LV2_URID_Map* map, double sample_rate);
+
+/* Monotonic time in nanoseconds */
+static inline uint64_t
+remus_stats_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Count a block of n_frames that took ns */
+static inline void
+remus_stats_block(RemusStats* self, uint32_t n_frames, uint64_t ns, RemusBlockState state)
+{
+	self->n_frames += n_frames;
+	self->n_blocks++;
+	self->n_state_blocks[state]++;
+	self->total_ns += ns;
+	if (ns > self->max_ns) {
+		self->max_ns = ns;
+	}
+}
+
+/* Count the end of a tail: distance of the matching crossings, -1 for a fallback */
+static inline void
+remus_stats_tail(RemusStats* self, int32_t distance, int32_t min_distance)
+{
+	self->n_fallbacks += distance < 0;
+	self->last_distance = distance;
+	self->last_min_distance = min_distance;
+}
+
+/* Whether the period is over, the next remus_stats_write() reports it */
+static inline bool
+remus_stats_due(const RemusStats* self)
+{
+	return self->n_frames >= self->period;
+}
+
+/*
+ * Start the sequence of the stats port for this block, then append the
+ * report if the period is over. The port capacity is its atom size, set by
+ * the host. memory_bytes and disk_bytes, the loop sizes, are only reported
+ * when remus_stats_due().
+ */
+void
+remus_stats_write(RemusStats*        self,
+                  LV2_Atom_Sequence* port,
+                  uint64_t           memory_bytes,
+                  uint64_t           disk_bytes);
+
+#endif
@@ -0,0 +1,952 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "lv2/atom/util.h"
+#include "lv2/state/state.h"
+
+#define SAMPLE_RATE   48000.0
+#define WINDOW        4096      // Output frames per fingerprint line
+#define MAX_WINDOWS   1024
+#define MAX_STATE     16        // State properties kept by the check host
+#define RMS_TOLERANCE 1e-4      // Relative to the RMS, above an absolute floor of 1e-5
+#define ONSET_LEVEL   1e-4f     // Output level counted as sound
+#define PERF_BARS     8         // Bars timed by each performance check
+#define PERF_REPEATS  5         // Best of, to keep scheduling noise out
+#define PEAK_LEVELS   3
+#define PEAK_SHIFT    6         // Frames per finest bin, then 8 times more per level
+#define MAX_PEAK_BINS 16384     // Finest bins kept from the peaks port
+#define KEPT_LOOPS    3
+
+/* Actions of a scenario script */
+typedef enum {
+	STEP_RUN,       // Run value bars at the current tempo and meter
+	STEP_ARM,       // Toggle record enable, the take starts at the next bar
+	STEP_BPM,       // Set the transport tempo
+	STEP_METER,     // Set the beats per bar
+	STEP_ROLL,      // Start (1) or stop (0) the transport
+	STEP_LOCATE,    // Move the transport by value bars, a relocation
+	STEP_LENGTH,    // Set the loop length in bars
+	STEP_FOLLOW,    // Set the tempo follow quality
+	STEP_OVERDUB,   // Turn overdub on (1) or off (0)
+	STEP_SLOT,      // Select a loop slot
+	STEP_RESTORE,   // Save the state, then restore it into a new instance
+	STEP_RING,      // Turn the capture ring on (1) or off (0)
+	STEP_CAPTURE,   // Capture the last loop length bars from the ring
+	STEP_FREEWHEEL, // Render offline (1) or in real time (0)
+	STEP_CMD_ARM,   // Send a command at frame value of the next block
+	STEP_CMD_STOP,
+	STEP_CMD_CLEAR,
+	STEP_CMD_OVERDUB,
+	STEP_WAVEFORM,  // Connect the peaks port
+	STEP_PEAKS,     // Compare the peaks received with those of the saved loop
+	STEP_CMD_UNDO,
+	STEP_CMD_REDO,
+	STEP_KEEP,      // Keep the saved loop as loop value
+	STEP_SAME,      // Compare the saved loop with loop value
+	STEP_TONE,      // Replace the input with a tone of value Hz, the default input for 0
+	STEP_QUIET,     // Check that the RMS of the last window stays under value
+	STEP_SAVE_BUSY, // Compare loop 0 with the loop saved while value bars run
+	STEP_END
+} StepType;
+
+typedef struct {
+	StepType type;
+	double   value;
+} Step;
+
+typedef struct {
+	const char* name;
+	uint32_t    n_channels;
+	uint32_t    block_size;
+	const Step* steps;
+} Scenario;
+
+/*
+ * Output fingerprint: per window, the first frame above ONSET_LEVEL (-1 if
+ * none), the status outputs at its end, and for each channel its RMS and its
+ * projection on a fixed pseudo-random sign sequence. The RMS follows the
+ * level, the projection changes with any sample, a crossfade or a shift.
+ */
+typedef struct {
+	uint32_t n_windows;
+	int32_t  onset[MAX_WINDOWS];
+	char     status[MAX_WINDOWS][4];
+	double   rms[MAX_WINDOWS][HOST_MAX_CHANNELS];
+	double   proj[MAX_WINDOWS][HOST_MAX_CHANNELS];
+	double   sum[HOST_MAX_CHANNELS];
+	double   dot[HOST_MAX_CHANNELS];
+	uint32_t pos;
+} Print;
+
+/* Waveform received from the peaks port, bins not received yet have min > max */
+typedef struct {
+	int64_t  length;
+	int8_t   bins[PEAK_LEVELS][MAX_PEAK_BINS][2];
+	uint32_t n_wrong;  // Bins that differed from the loop
+} Waveform;
+
+typedef struct {
+	RemusHost* host;
+	Print      print;
+	Waveform   waveform;
+	float*     kept[KEPT_LOOPS];  // Loops saved to compare with after undo and redo
+	size_t     kept_size[KEPT_LOOPS];
+	uint32_t   n_changed;         // Loops that differed from the one kept
+	uint32_t   n_loud;            // Windows above the level of a STEP_QUIET
+	double     tone;              // Hz of the input tone, 0 for the default input
+	uint32_t   block_size;        // Of the scenario playing
+	uint64_t   input_pos;
+} Check;
+
+static const Step basic_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 4.0 }, { STEP_END, 0 }
+};
+
+static const Step tempo_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 },
+	{ STEP_BPM, 90.0 }, { STEP_RUN, 3.0 }, { STEP_BPM, 140.0 }, { STEP_RUN, 3.0 }, { STEP_END, 0 }
+};
+
+static const Step follow_steps[] = {
+	{ STEP_FOLLOW, 2 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 },
+	{ STEP_BPM, 100.0 }, { STEP_RUN, 3.0 }, { STEP_BPM, 133.0 }, { STEP_RUN, 3.0 }, { STEP_END, 0 }
+};
+
+/* A tone above the output Nyquist frequency once the loop plays twice as fast */
+static const Step follow_alias_steps[] = {
+	{ STEP_TONE, 19200.0 }, { STEP_FOLLOW, 2 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 },
+	{ STEP_BPM, 240.0 }, { STEP_RUN, 2.0 }, { STEP_QUIET, 1e-3 }, { STEP_RUN, 1.5 }, { STEP_QUIET, 1e-3 },
+	{ STEP_END, 0 }
+};
+
+static const Step meter_steps[] = {
+	{ STEP_LENGTH, 2 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 5.0 },
+	{ STEP_METER, 3.0 }, { STEP_RUN, 4.0 }, { STEP_METER, 7.0 }, { STEP_RUN, 4.0 }, { STEP_END, 0 }
+};
+
+static const Step stop_start_steps[] = {
+	{ STEP_ROLL, 0 }, { STEP_RUN, 0.5 }, { STEP_ROLL, 1 }, { STEP_RUN, 0.25 }, { STEP_ARM, 0 },
+	{ STEP_RUN, 3.0 }, { STEP_ROLL, 0 }, { STEP_RUN, 1.0 }, { STEP_ROLL, 1 }, { STEP_RUN, 3.0 },
+	{ STEP_END, 0 }
+};
+
+static const Step relocate_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_LOCATE, 1.5 }, { STEP_RUN, 2.0 },
+	{ STEP_LOCATE, -2.25 }, { STEP_RUN, 3.0 }, { STEP_END, 0 }
+};
+
+static const Step rerecord_steps[] = {
+	{ STEP_LENGTH, 2 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 1.25 }, { STEP_ARM, 0 },
+	{ STEP_RUN, 5.0 }, { STEP_END, 0 }
+};
+
+static const Step overdub_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_OVERDUB, 1 }, { STEP_RUN, 1.5 },
+	{ STEP_OVERDUB, 0 }, { STEP_RUN, 3.0 }, { STEP_END, 0 }
+};
+
+static const Step slots_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_SLOT, 1 }, { STEP_RUN, 1.5 },
+	{ STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_SLOT, 0 }, { STEP_RUN, 2.0 }, { STEP_END, 0 }
+};
+
+static const Step capture_steps[] = {
+	{ STEP_LENGTH, 2 }, { STEP_RING, 1 }, { STEP_RUN, 3.6 }, { STEP_CAPTURE, 0 }, { STEP_RUN, 4.5 },
+	{ STEP_CAPTURE, 0 }, { STEP_RUN, 3.0 }, { STEP_RING, 0 }, { STEP_RUN, 1.0 }, { STEP_END, 0 }
+};
+
+static const Step freewheel_steps[] = {
+	{ STEP_FREEWHEEL, 1 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_BPM, 90.0 },
+	{ STEP_RUN, 3.0 }, { STEP_LOCATE, 1.5 }, { STEP_RUN, 2.0 }, { STEP_FREEWHEEL, 0 }, { STEP_RUN, 2.0 },
+	{ STEP_END, 0 }
+};
+
+static const Step commands_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_CMD_ARM, 10 }, { STEP_CMD_STOP, 100 }, { STEP_RUN, 1.0 },
+	{ STEP_CMD_ARM, 100 }, { STEP_RUN, 3.0 }, { STEP_CMD_OVERDUB, 0 }, { STEP_RUN, 1.5 },
+	{ STEP_CMD_OVERDUB, 0 }, { STEP_RUN, 2.0 }, { STEP_CMD_CLEAR, 50 }, { STEP_RUN, 1.0 },
+	{ STEP_CMD_ARM, 200 }, { STEP_CMD_ARM, 210 }, { STEP_RUN, 3.0 }, { STEP_END, 0 }
+};
+
+static const Step peaks_steps[] = {
+	{ STEP_WAVEFORM, 0 }, { STEP_LENGTH, 2 }, { STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.5 },
+	{ STEP_PEAKS, 0 }, { STEP_OVERDUB, 1 }, { STEP_RUN, 1.5 }, { STEP_OVERDUB, 0 }, { STEP_RUN, 2.5 },
+	{ STEP_PEAKS, 0 }, { STEP_RESTORE, 0 }, { STEP_WAVEFORM, 0 }, { STEP_RUN, 1.0 }, { STEP_PEAKS, 0 },
+	{ STEP_END, 0 }
+};
+
+static const Step undo_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_KEEP, 0 }, { STEP_OVERDUB, 1 },
+	{ STEP_RUN, 1.5 }, { STEP_OVERDUB, 0 }, { STEP_RUN, 1.5 }, { STEP_KEEP, 1 }, { STEP_CMD_UNDO, 10 },
+	{ STEP_RUN, 1.0 }, { STEP_SAME, 0 }, { STEP_CMD_REDO, 20 }, { STEP_RUN, 1.0 }, { STEP_SAME, 1 },
+	{ STEP_CMD_CLEAR, 30 }, { STEP_RUN, 1.0 }, { STEP_CMD_UNDO, 40 }, { STEP_RUN, 1.0 }, { STEP_SAME, 1 },
+	{ STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_KEEP, 2 }, { STEP_CMD_UNDO, 50 }, { STEP_RUN, 1.0 },
+	{ STEP_SAME, 1 }, { STEP_CMD_UNDO, 60 }, { STEP_RUN, 1.0 }, { STEP_SAME, 0 }, { STEP_CMD_REDO, 70 },
+	{ STEP_CMD_REDO, 80 }, { STEP_RUN, 2.0 }, { STEP_SAME, 2 }, { STEP_END, 0 }
+};
+
+/* A save that runs while the loop grows, its table is replaced under the save */
+static const Step save_busy_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_KEEP, 0 }, { STEP_LENGTH, 2 },
+	{ STEP_SAVE_BUSY, 1.5 }, { STEP_RUN, 2.0 }, { STEP_END, 0 }
+};
+
+static const Step restore_steps[] = {
+	{ STEP_RUN, 0.5 }, { STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_SLOT, 2 }, { STEP_RUN, 1.0 },
+	{ STEP_ARM, 0 }, { STEP_RUN, 3.0 }, { STEP_RESTORE, 0 }, { STEP_RUN, 3.0 }, { STEP_SLOT, 0 },
+	{ STEP_RUN, 2.0 }, { STEP_END, 0 }
+};
+
+static const Scenario scenarios[] = {
+	{ "basic", 1, 256, basic_steps },
+	{ "basic-stereo", 2, 256, basic_steps },
+	{ "basic-quad-odd-block", 4, 100, basic_steps },
+	{ "tempo", 1, 256, tempo_steps },
+	{ "follow", 2, 256, follow_steps },
+	{ "follow-alias", 1, 256, follow_alias_steps },
+	{ "meter", 1, 256, meter_steps },
+	{ "stop-start", 1, 256, stop_start_steps },
+	{ "relocate", 1, 256, relocate_steps },
+	{ "rerecord", 1, 256, rerecord_steps },
+	{ "overdub", 1, 256, overdub_steps },
+	{ "slots", 2, 256, slots_steps },
+	{ "restore", 2, 256, restore_steps },
+	{ "save-busy", 2, 256, save_busy_steps },
+	{ "capture", 2, 256, capture_steps },
+	{ "freewheel", 2, 4096, freewheel_steps },
+	{ "commands", 1, 256, commands_steps },
+	{ "peaks", 2, 256, peaks_steps },
+	{ "undo", 2, 256, undo_steps },
+};
+
+#define N_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* Deterministic input: a partial per channel and a little noise, or the tone alone */
+static float
+input_sample(const Check* check, uint32_t c, uint64_t t)
+{
+	if (check->tone > 0.0) {
+		return (float)(0.4 * sin(2.0 * M_PI * check->tone * (double)t / SAMPLE_RATE));
+	}
+	uint32_t seed = (uint32_t)(t * 2654435761u) ^ (c * 0x9e3779b9u);
+	seed = seed * 1664525u + 1013904223u;
+	const double noise = ((double)(seed >> 8) / 16777216.0 - 0.5) * 0.02;
+	return (float)(0.4 * sin(2.0 * M_PI * (220.0 + 55.0 * c) * (double)t / SAMPLE_RATE) + noise);
+}
+
+static void
+print_block(Print* print, const RemusHost* host, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		const uint32_t w = print->n_windows;
+		if (w >= MAX_WINDOWS) {
+			return;
+		}
+		if (print->pos == 0) {
+			print->onset[w] = -1;
+		}
+		// Sign of this frame in the projection, the same for every window
+		const uint32_t hash = (print->pos + 1) * 2654435761u;
+		const double   sign = (hash & 0x80000000u) ? -1.0 : 1.0;
+		for (uint32_t c = 0; c < host->n_channels; c++) {
+			const float x = host->audio_out[c][i];
+			print->sum[c] += (double)x * x;
+			print->dot[c] += sign * x;
+			if (print->onset[w] < 0 && fabsf(x) > ONSET_LEVEL) {
+				print->onset[w] = (int32_t)print->pos;
+			}
+		}
+		if (++print->pos == WINDOW) {
+			for (uint32_t c = 0; c < host->n_channels; c++) {
+				print->rms[w][c] = sqrt(print->sum[c] / WINDOW);
+				print->proj[w][c] = print->dot[c] / sqrt(WINDOW);
+				print->sum[c] = 0.0;
+				print->dot[c] = 0.0;
+			}
+			snprintf(print->status[w], sizeof(print->status[w]), "%c%c%c",
+			         host->armed > 0.5f ? 'A' : '-', host->recording > 0.5f ? 'R' : '-',
+			         host->recorded > 0.5f ? 'L' : '-');
+			print->pos = 0;
+			print->n_windows++;
+		}
+	}
+}
+
+static LV2_URID
+map(RemusHost* host, const char* uri)
+{
+	return host->map.map(host->map.handle, uri);
+}
+
+/* Take the waveform objects of the peaks port */
+static void
+read_peaks(Waveform* waveform, RemusHost* host)
+{
+	const LV2_URID Waveform_ = map(host, "http://github.com/lbovet/remus#Waveform");
+	const LV2_URID Peaks = map(host, "http://github.com/lbovet/remus#Peaks");
+	const LV2_URID length = map(host, "http://github.com/lbovet/remus#length");
+	const LV2_URID level = map(host, "http://github.com/lbovet/remus#level");
+	const LV2_URID first = map(host, "http://github.com/lbovet/remus#first");
+	const LV2_URID data = map(host, "http://github.com/lbovet/remus#data");
+
+	const LV2_Atom_Sequence* seq = (const LV2_Atom_Sequence*)(const void*)host->peaks_buf;
+	LV2_ATOM_SEQUENCE_FOREACH(seq, ev) {
+		const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+		const LV2_Atom*        a = NULL;
+		const LV2_Atom*        b = NULL;
+		const LV2_Atom*        c = NULL;
+		if (obj->body.otype == Waveform_) {
+			lv2_atom_object_get(obj, length, &a, NULL);
+			waveform->length = a ? ((const LV2_Atom_Long*)a)->body : 0;
+			memset(waveform->bins, 127, sizeof(waveform->bins));
+		} else if (obj->body.otype == Peaks) {
+			lv2_atom_object_get(obj, level, &a, first, &b, data, &c, NULL);
+			const int32_t l = a ? ((const LV2_Atom_Int*)a)->body : -1;
+			const int32_t f = b ? ((const LV2_Atom_Int*)b)->body : -1;
+			if (l >= 0 && l < PEAK_LEVELS && f >= 0 && c && f + c->size / 2 <= MAX_PEAK_BINS) {
+				memcpy(waveform->bins[l][f], c + 1, c->size);
+			}
+		}
+	}
+}
+
+/* A sample in 1/127 of full scale, rounded away from the other bound */
+static int
+quantize(float value, bool up)
+{
+	const float scaled = value * 127.0f;
+	const float rounded = up ? ceilf(scaled) : floorf(scaled);
+	return (rounded > 127.0f) ? 127 : (rounded < -127.0f) ? -127 : (int)rounded;
+}
+
+/* Count the bins received that differ from those of the loop, saved inline as n_channels runs */
+static void
+compare_peaks(Waveform* waveform, const float* loop, uint32_t n_frames, uint32_t n_channels)
+{
+	if (waveform->length != n_frames) {
+		waveform->n_wrong++;
+		return;
+	}
+	for (uint32_t l = 0; l < PEAK_LEVELS; l++) {
+		const uint32_t shift = PEAK_SHIFT + 3 * l;
+		const uint32_t n_bins = (n_frames + (1u << shift) - 1) >> shift;
+		for (uint32_t bin = 0; bin < n_bins && bin < MAX_PEAK_BINS; bin++) {
+			const uint32_t start = bin << shift;
+			const uint32_t end = (start + (1u << shift) < n_frames) ? start + (1u << shift) : n_frames;
+			float lo = loop[start];
+			float hi = lo;
+			for (uint32_t c = 0; c < n_channels; c++) {
+				for (uint32_t i = start; i < end; i++) {
+					const float x = loop[(size_t)c * n_frames + i];
+					lo = (x < lo) ? x : lo;
+					hi = (x > hi) ? x : hi;
+				}
+			}
+			if (waveform->bins[l][bin][0] != quantize(lo, false) || waveform->bins[l][bin][1] != quantize(hi, true)) {
+				waveform->n_wrong++;
+			}
+		}
+	}
+}
+
+static void
+run_block(Check* check, uint32_t n)
+{
+	RemusHost* host = check->host;
+	for (uint32_t i = 0; i < n; i++) {
+		for (uint32_t c = 0; c < host->n_channels; c++) {
+			host->audio_in[c][i] = input_sample(check, c, check->input_pos + i);
+		}
+	}
+	check->input_pos += n;
+	remus_host_run(host, n);
+	print_block(&check->print, host, n);
+	if (host->peaks_connected) {
+		read_peaks(&check->waveform, host);
+	}
+}
+
+static double
+bar_frames(const RemusHost* host)
+{
+	return host->beats_per_bar * 60.0 * host->sample_rate / host->bpm;
+}
+
+static void
+run_bars(Check* check, uint32_t block_size, double bars)
+{
+	const uint64_t frames = (uint64_t)llround(bars * bar_frames(check->host));
+	for (uint64_t done = 0; done < frames; done += block_size) {
+		run_block(check, (frames - done < block_size) ? (uint32_t)(frames - done) : block_size);
+	}
+}
+
+/* In-memory state, loops are stored inline */
+typedef struct {
+	uint32_t key;
+	uint32_t type;
+	size_t   size;
+	void*    value;
+} Property;
+
+typedef struct {
+	Property properties[MAX_STATE];
+	uint32_t n_properties;
+	bool     failed;  // A property could not be stored
+	Check*   check;   // Runs busy bars in the middle of the save, at its first store
+	double   busy;
+} State;
+
+static LV2_State_Status
+state_store(LV2_State_Handle handle, uint32_t key, const void* value, size_t size,
+            uint32_t type, uint32_t flags)
+{
+	(void)flags;
+	State* state = (State*)handle;
+	if (state->check && state->busy > 0.0) {
+		// The plugin and its worker carry on while the save reads its loops
+		run_bars(state->check, state->check->block_size, state->busy);
+		state->busy = 0.0;
+	}
+	void*  copy = (state->n_properties < MAX_STATE) ? malloc(size ? size : 1) : NULL;
+	if (!copy) {
+		state->failed = true;
+		return LV2_STATE_ERR_NO_SPACE;
+	}
+	memcpy(copy, value, size);
+	Property* property = &state->properties[state->n_properties++];
+	property->key = key;
+	property->type = type;
+	property->size = size;
+	property->value = copy;
+	return LV2_STATE_SUCCESS;
+}
+
+static const void*
+state_retrieve(LV2_State_Handle handle, uint32_t key, size_t* size, uint32_t* type, uint32_t* flags)
+{
+	const State* state = (const State*)handle;
+	for (uint32_t i = 0; i < state->n_properties; i++) {
+		if (state->properties[i].key == key) {
+			*size = state->properties[i].size;
+			*type = state->properties[i].type;
+			*flags = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+			return state->properties[i].value;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Save the active loop, inline as n_channels runs, NULL without a loop. busy
+ * bars run in the middle of the save. The caller frees it.
+ */
+static float*
+save_loop(Check* check, double busy, size_t* size)
+{
+	static const LV2_Feature* const no_features[] = { NULL };
+	RemusHost* host = check->host;
+	State      state = { .n_properties = 0, .check = check, .busy = busy };
+
+	const LV2_State_Interface* iface = (const LV2_State_Interface*)
+		host->descriptor->extension_data(LV2_STATE__interface);
+	const float persist = host->persist_enable;
+	host->persist_enable = 1.0f;
+	iface->save(host->instance, state_store, &state, 0, no_features);
+	host->persist_enable = persist;
+
+	const LV2_URID buffer = map(host, "http://github.com/lbovet/remus#buffer");
+	float*         loop = NULL;
+	*size = 0;
+	for (uint32_t i = 0; i < state.n_properties; i++) {
+		if (state.properties[i].key == buffer && !loop) {
+			loop = (float*)state.properties[i].value;
+			*size = state.properties[i].size;
+		} else {
+			free(state.properties[i].value);
+		}
+	}
+	return loop;
+}
+
+/* Save the loop, then compare the peaks received with it */
+static void
+check_peaks(Check* check)
+{
+	RemusHost* host = check->host;
+	size_t     size;
+	float*     loop = save_loop(check, 0.0, &size);
+	if (loop) {
+		compare_peaks(&check->waveform, loop, (uint32_t)(size / sizeof(float) / host->n_channels),
+		              host->n_channels);
+	} else {
+		check->waveform.n_wrong++;
+	}
+	free(loop);
+}
+
+/* Keep the saved loop, or compare the loop saved while busy bars run with the one kept */
+static void
+keep_loop(Check* check, uint32_t k, bool compare, double busy)
+{
+	size_t size;
+	float* loop = save_loop(check, busy, &size);
+	if (!compare) {
+		free(check->kept[k]);
+		check->kept[k] = loop;
+		check->kept_size[k] = size;
+		return;
+	}
+	if (!loop || !check->kept[k] || size != check->kept_size[k] || memcmp(loop, check->kept[k], size)) {
+		check->n_changed++;
+	}
+	free(loop);
+}
+
+/*
+ * Save the instance and restore it into a new one, which carries on with
+ * the same controls and transport. URIDs match: both hosts map in the same
+ * order.
+ */
+static int
+swap_restored(Check* check)
+{
+	static const LV2_Feature* const no_features[] = { NULL };
+	RemusHost* old = check->host;
+	RemusHost* host = (RemusHost*)calloc(1, sizeof(RemusHost));
+	State      state = { .n_properties = 0 };
+
+	if (!host || remus_host_init(host, old->sample_rate, old->n_channels)) {
+		free(host);
+		return 1;
+	}
+	const LV2_State_Interface* iface = (const LV2_State_Interface*)
+		old->descriptor->extension_data(LV2_STATE__interface);
+	old->persist_enable = 1.0f;
+	iface->save(old->instance, state_store, &state, 0, no_features);
+	if (!state.failed) {
+		iface->restore(host->instance, state_retrieve, &state, 0, no_features);
+	}
+	for (uint32_t i = 0; i < state.n_properties; i++) {
+		free(state.properties[i].value);
+	}
+	if (state.failed) {
+		remus_host_free(host);
+		free(host);
+		return 1;
+	}
+
+	host->bpm = old->bpm;
+	host->beats_per_bar = old->beats_per_bar;
+	host->frame = old->frame;
+	host->rolling = old->rolling;
+	host->loop_length = old->loop_length;
+	host->slot = old->slot;
+	host->follow = old->follow;
+	remus_host_free(old);
+	free(old);
+	check->host = host;
+	return 0;
+}
+
+static int
+play(Check* check, const Scenario* scenario)
+{
+	RemusHost* host = (RemusHost*)calloc(1, sizeof(RemusHost));
+	if (!host || remus_host_init(host, SAMPLE_RATE, scenario->n_channels)) {
+		free(host);
+		return 1;
+	}
+	host->loop_length = 1.0f;
+	host->rolling = true;
+	check->host = host;
+	check->input_pos = 0;
+	memset(&check->print, 0, sizeof(check->print));
+	memset(&check->waveform, 0, sizeof(check->waveform));
+	check->n_changed = 0;
+	check->n_loud = 0;
+	check->tone = 0.0;
+
+	const uint32_t n = scenario->block_size;
+	check->block_size = n;
+	for (const Step* step = scenario->steps; step->type != STEP_END; step++) {
+		host = check->host;
+		switch (step->type) {
+		case STEP_RUN:
+			run_bars(check, n, step->value);
+			break;
+		case STEP_ARM:
+			host->record_enable = 1.0f;
+			run_block(check, n);
+			host->record_enable = 0.0f;
+			break;
+		case STEP_BPM:
+			host->bpm = step->value;
+			break;
+		case STEP_METER:
+			host->beats_per_bar = step->value;
+			break;
+		case STEP_ROLL:
+			host->rolling = step->value > 0.5;
+			break;
+		case STEP_LOCATE:
+			host->frame += (int64_t)llround(step->value * bar_frames(host));
+			break;
+		case STEP_LENGTH:
+			host->loop_length = (float)step->value;
+			break;
+		case STEP_FOLLOW:
+			host->follow = (float)step->value;
+			break;
+		case STEP_OVERDUB:
+			host->overdub = (float)step->value;
+			break;
+		case STEP_SLOT:
+			host->slot = (float)step->value;
+			break;
+		case STEP_RING:
+			host->capture_ring = (float)step->value;
+			break;
+		case STEP_CAPTURE:
+			host->capture = 1.0f;
+			run_block(check, n);
+			host->capture = 0.0f;
+			break;
+		case STEP_FREEWHEEL:
+			host->freewheel = (float)step->value;
+			break;
+		case STEP_CMD_ARM:
+			remus_host_command(host, (uint32_t)step->value, "arm", 0);
+			break;
+		case STEP_CMD_STOP:
+			remus_host_command(host, (uint32_t)step->value, "stop", 0);
+			break;
+		case STEP_CMD_CLEAR:
+			remus_host_command(host, (uint32_t)step->value, "clear", 0);
+			break;
+		case STEP_CMD_OVERDUB:
+			remus_host_command(host, (uint32_t)step->value, "overdub", 0);
+			break;
+		case STEP_WAVEFORM:
+			remus_host_connect_peaks(host);
+			break;
+		case STEP_PEAKS:
+			check_peaks(check);
+			break;
+		case STEP_CMD_UNDO:
+			remus_host_command(host, (uint32_t)step->value, "undo", 0);
+			break;
+		case STEP_CMD_REDO:
+			remus_host_command(host, (uint32_t)step->value, "redo", 0);
+			break;
+		case STEP_KEEP:
+		case STEP_SAME:
+			keep_loop(check, (uint32_t)step->value, step->type == STEP_SAME, 0.0);
+			break;
+		case STEP_SAVE_BUSY:
+			keep_loop(check, 0, true, step->value);
+			break;
+		case STEP_TONE:
+			check->tone = step->value;
+			break;
+		case STEP_QUIET:
+			for (uint32_t c = 0; c < host->n_channels; c++) {
+				const uint32_t w = check->print.n_windows;
+				check->n_loud += !w || check->print.rms[w - 1][c] > step->value;
+			}
+			break;
+		case STEP_RESTORE:
+			if (swap_restored(check)) {
+				return 1;
+			}
+			break;
+		case STEP_END:
+			break;
+		}
+	}
+	remus_host_free(check->host);
+	free(check->host);
+	check->host = NULL;
+	for (uint32_t k = 0; k < KEPT_LOOPS; k++) {
+		free(check->kept[k]);
+		check->kept[k] = NULL;
+	}
+	return 0;
+}
+
+static void
+golden_path(char* path, size_t size, const char* dir, const char* name)
+{
+	snprintf(path, size, "%s/%s.txt", dir, name);
+}
+
+static int
+write_golden(const Print* print, const Scenario* scenario, const char* dir)
+{
+	char path[1024];
+	golden_path(path, sizeof(path), dir, scenario->name);
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		fprintf(stdout, "%s: cannot write %s: %s\n", scenario->name, path, strerror(errno));
+		return 1;
+	}
+	fprintf(file, "# window onset status, then rms and projection of each channel, %u frames per window\n",
+	        WINDOW);
+	for (uint32_t w = 0; w < print->n_windows; w++) {
+		fprintf(file, "%u %d %s", w, print->onset[w], print->status[w]);
+		for (uint32_t c = 0; c < scenario->n_channels; c++) {
+			fprintf(file, " %.7f %.7f", print->rms[w][c], print->proj[w][c]);
+		}
+		fprintf(file, "\n");
+	}
+	fclose(file);
+	return 0;
+}
+
+/* Compare with the golden file, reporting the first difference */
+static int
+compare_golden(const Print* print, const Scenario* scenario, const char* dir)
+{
+	char path[1024];
+	golden_path(path, sizeof(path), dir, scenario->name);
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		printf("FAIL %s: cannot read %s: %s\n", scenario->name, path, strerror(errno));
+		return 1;
+	}
+
+	char     line[256];
+	uint32_t n_windows = 0;
+	int      status = 0;
+	while (!status && fgets(line, sizeof(line), file)) {
+		if (line[0] == '#') {
+			continue;
+		}
+		uint32_t w;
+		int32_t  onset;
+		char     flags[4];
+		double   v[2 * HOST_MAX_CHANNELS] = { 0.0 };
+		int      n_fields = sscanf(line, "%u %d %3s %lf %lf %lf %lf %lf %lf %lf %lf", &w, &onset, flags,
+		                           &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+		if (n_fields != 3 + 2 * (int)scenario->n_channels || w != n_windows || w >= print->n_windows) {
+			printf("FAIL %s: window %u: output has %u windows, or the golden file is malformed\n",
+			       scenario->name, n_windows, print->n_windows);
+			status = 1;
+			break;
+		}
+		if (onset != print->onset[w] || strcmp(flags, print->status[w])) {
+			printf("FAIL %s: window %u: onset %d status %s, expected onset %d status %s\n",
+			       scenario->name, w, print->onset[w], print->status[w], onset, flags);
+			status = 1;
+		}
+		for (uint32_t c = 0; !status && c < scenario->n_channels; c++) {
+			const double rms = v[2 * c];
+			const double proj = v[2 * c + 1];
+			const double tolerance = 1e-5 + RMS_TOLERANCE * rms;
+			if (fabs(print->rms[w][c] - rms) > tolerance || fabs(print->proj[w][c] - proj) > tolerance) {
+				printf("FAIL %s: window %u channel %u: rms %.7f projection %.7f, expected %.7f %.7f\n",
+				       scenario->name, w, c, print->rms[w][c], print->proj[w][c], rms, proj);
+				status = 1;
+			}
+		}
+		n_windows++;
+	}
+	fclose(file);
+	if (!status && n_windows != print->n_windows) {
+		printf("FAIL %s: %u windows, expected %u\n", scenario->name, print->n_windows, n_windows);
+		status = 1;
+	}
+	if (!status) {
+		printf("ok   %s\n", scenario->name);
+	}
+	return status;
+}
+
+/* Steady states timed against the budget, in ns per sample and channel */
+typedef enum {
+	PERF_RECORDING,
+	PERF_PLAYING,
+	PERF_RESAMPLING,
+	PERF_OVERDUBBING,
+	N_PERF
+} PerfState;
+
+static const char* const perf_names[N_PERF] = { "recording", "playing", "resampling", "overdubbing" };
+
+/* Best mean cost of a state over PERF_REPEATS runs of PERF_BARS bars */
+static double
+measure(Check* check, uint32_t n_channels, uint32_t block_size, PerfState state)
+{
+	RemusHost* host = (RemusHost*)calloc(1, sizeof(RemusHost));
+	double     best = INFINITY;
+	if (!host || remus_host_init(host, SAMPLE_RATE, n_channels)) {
+		free(host);
+		return best;
+	}
+	host->loop_length = 4.0f;
+	host->rolling = true;
+	host->follow = (state == PERF_RESAMPLING) ? 2.0f : 0.0f;
+	check->host = host;
+
+	if (state == PERF_RECORDING) {
+		// Takes of PERF_BARS bars, each timed from its first recording block
+		host->loop_length = PERF_BARS;
+	} else {
+		run_bars(check, block_size, 0.5);
+		host->record_enable = 1.0f;
+		run_block(check, block_size);
+		host->record_enable = 0.0f;
+		run_bars(check, block_size, 6.0);
+		host->bpm = (state == PERF_RESAMPLING) ? 97.0 : host->bpm;
+		host->overdub = (state == PERF_OVERDUBBING) ? 1.0f : 0.0f;
+		run_bars(check, block_size, 1.0);
+	}
+
+	for (uint32_t r = 0; r < PERF_REPEATS; r++) {
+		if (state == PERF_RECORDING) {
+			host->record_enable = 1.0f;
+			run_block(check, block_size);
+			host->record_enable = 0.0f;
+			while (host->recording < 0.5f) {
+				run_block(check, block_size);
+			}
+		}
+		const uint64_t frames = (uint64_t)(PERF_BARS * bar_frames(host)) * 3 / 4;
+		uint64_t       ns = 0;
+		uint64_t       done = 0;
+		for (; done < frames; done += block_size) {
+			run_block(check, block_size);
+			ns += host->run_ns;
+		}
+		const double cost = (double)ns / (double)(done * n_channels);
+		best = (cost < best) ? cost : best;
+	}
+	remus_host_free(host);
+	free(host);
+	check->host = NULL;
+	return best;
+}
+
+/*
+ * Compare the cost of each steady state with its budget in perf.txt, lines
+ * of "state channels block_size ns_per_sample", scaled by scale.
+ */
+static int
+check_performance(Check* check, const char* dir, double scale)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/perf.txt", dir);
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		printf("FAIL perf: cannot read %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	char line[256];
+	int  status = 0;
+	while (fgets(line, sizeof(line), file)) {
+		char     name[32];
+		uint32_t n_channels;
+		uint32_t block_size;
+		double   budget;
+		if (line[0] == '#' || sscanf(line, "%31s %u %u %lf", name, &n_channels, &block_size, &budget) != 4) {
+			continue;
+		}
+		PerfState state = N_PERF;
+		for (uint32_t s = 0; s < N_PERF; s++) {
+			state = strcmp(name, perf_names[s]) ? state : (PerfState)s;
+		}
+		if (state == N_PERF || n_channels < 1 || n_channels > HOST_MAX_CHANNELS
+		    || block_size < 1 || block_size > HOST_MAX_BLOCK) {
+			printf("FAIL perf: unknown check %s", line);
+			status = 1;
+			continue;
+		}
+		const double cost = measure(check, n_channels, block_size, state);
+		const bool   ok = cost <= budget * scale;
+		printf("%s perf %s %u ch, block %u: %.2f ns/sample, budget %.2f\n", ok ? "ok  " : "FAIL",
+		       name, n_channels, block_size, cost, budget * scale);
+		status |= !ok;
+	}
+	fclose(file);
+	return status;
+}
+
+static void
+usage(const char* name)
+{
+	fprintf(stderr,
+	        "Usage: %s [-u] [-p SCALE] [-v] GOLDEN_DIR\n"
+	        "Replay the transport scenarios and compare their output with the golden files.\n"
+	        "  -u        Write the golden files from this build instead\n"
+	        "  -p SCALE  Scale of the performance budgets, 0 skips the performance checks (1)\n"
+	        "  -v        Keep the plugin diagnostics on stderr\n",
+	        name);
+}
+
+int
+main(int argc, char** argv)
+{
+	bool   update = false;
+	bool   verbose = false;
+	double scale = 1.0;
+	int    opt;
+
+	while ((opt = getopt(argc, argv, "up:vh")) != -1) {
+		switch (opt) {
+		case 'u':
+			update = true;
+			break;
+		case 'p':
+			scale = atof(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char* dir = argv[optind];
+
+	// The plugin traces to stderr without a host log
+	if (!verbose && !freopen("/dev/null", "w", stderr)) {
+		return 1;
+	}
+
+	static Check check;
+	int          status = 0;
+	for (uint32_t s = 0; s < N_SCENARIOS; s++) {
+		if (play(&check, &scenarios[s])) {
+			printf("FAIL %s: cannot instantiate the plugin or restore its state\n", scenarios[s].name);
+			status = 1;
+		} else if (check.waveform.n_wrong) {
+			printf("FAIL %s: %u waveform bins differ from the loop\n", scenarios[s].name,
+			       check.waveform.n_wrong);
+			status = 1;
+		} else if (check.n_changed) {
+			printf("FAIL %s: %u loops differ from the one kept\n", scenarios[s].name, check.n_changed);
+			status = 1;
+		} else if (check.n_loud) {
+			printf("FAIL %s: %u windows louder than expected\n", scenarios[s].name, check.n_loud);
+			status = 1;
+		} else if (update) {
+			status |= write_golden(&check.print, &scenarios[s], dir);
+		} else {
+			status |= compare_golden(&check.print, &scenarios[s], dir);
+		}
+	}
+	if (!update && scale > 0.0) {
+		status |= check_performance(&check, dir, scale);
+	}
+	return status;
+}